@@ -0,0 +1,333 @@
+#pragma once
+
+// ack mode, chat frames can ask receivers to acknowledge them
+//
+// fragments of a long message are frames of their own (see fragment.h), each is acked and retransmitted
+// on its own and the message shows the worst delivery of its fragments.
+//
+// receivers queue an ack (sender hash, sequence) and send it in their next frame, or in a ping if they
+// have nothing to send before the ack delay is up. The sender keeps a copy of each unacked frame and
+// retransmits only that frame when its timeout passes. Timeouts follow RFC 6298: per peer smoothed
+// RTT and RTT variance, measured only on frames acked without a retransmit (Karn's rule), and doubled
+// on each retransmit.
+
+#include <Arduino.h>
+
+#include "frame.h"
+
+const uint8_t MaxUnackedMessages = MaxFragments;
+const uint8_t MaxRetransmits = 3;
+const uint8_t MaxAckPeers = 4; // peers counted per message
+const uint8_t MaxPendingAcks = 8;
+
+// timeouts per transport, LoRa frames take ~200 ms each way at SF9 plus the UART at 9600 baud
+struct AckTiming
+{
+  uint32_t initialRtoMillis;
+  uint32_t minRtoMillis;
+  uint32_t maxRtoMillis;
+  uint32_t minAckDelayMillis; // receivers wait a random delay in this range for a frame to send the ack on
+  uint32_t maxAckDelayMillis;
+};
+
+const AckTiming LoRaAckTiming = {3000, 1000, 30000, 300, 1500};
+const AckTiming EspNowAckTiming = {300, 50, 5000, 5, 30};
+
+struct RttEstimator
+{
+  uint32_t srttMillis;
+  uint32_t rttvarMillis;
+  bool hasSample;
+
+  void sample(uint32_t rttMillis)
+  {
+    if (!hasSample)
+    {
+      srttMillis = rttMillis;
+      rttvarMillis = rttMillis / 2;
+      hasSample = true;
+      return;
+    }
+
+    uint32_t delta = srttMillis > rttMillis ? srttMillis - rttMillis : rttMillis - srttMillis;
+    rttvarMillis = (3 * rttvarMillis + delta) / 4;
+    srttMillis = (7 * srttMillis + rttMillis) / 8;
+  }
+
+  uint32_t rto(const AckTiming &timing) const
+  {
+    if (!hasSample)
+      return timing.initialRtoMillis;
+    uint32_t rto = srttMillis + std::max((uint32_t)1, 4 * rttvarMillis);
+    return std::max(timing.minRtoMillis, std::min(timing.maxRtoMillis, rto));
+  }
+};
+
+struct UnackedMessage
+{
+  uint8_t frameData[MaxFrameLength];
+  uint8_t frameDataLength;
+  uint16_t sequence;
+  uint16_t firstSequence; // of the message, the same as sequence unless it was fragmented
+  uint8_t channel;
+  bool isUsed;
+  bool isSent; // the timeout starts once the frame is on air, see sent()
+  bool isDone; // acked by every expected peer or out of retransmits, kept until released
+  bool hasHistoryId;
+  uint32_t historyId;
+  unsigned long firstSentMillis;
+  unsigned long retryMillis;
+  uint32_t rtoMillis;
+  uint8_t retransmits;
+  uint8_t expectedAcks;
+  uint8_t ackCount;
+  uint16_t ackedBy[MaxAckPeers];
+};
+
+// frames we sent that wait for acks
+class AckTracker
+{
+public:
+  // before the frame is sent, which starts its timeout
+  bool track(const uint8_t *frameData, size_t frameDataLength, uint16_t sequence, uint16_t firstSequence, uint8_t channel, uint32_t rtoMillis)
+  {
+    UnackedMessage *message = NULL;
+    for (uint8_t i = 0; i < MaxUnackedMessages && message == NULL; i++)
+      if (!messages[i].isUsed)
+        message = &messages[i];
+
+    if (message == NULL || frameDataLength > sizeof(message->frameData))
+      return false;
+
+    memcpy(message->frameData, frameData, frameDataLength);
+    message->frameDataLength = frameDataLength;
+    message->sequence = sequence;
+    message->firstSequence = firstSequence;
+    message->channel = channel;
+    message->isUsed = true;
+    message->isSent = false;
+    message->isDone = false;
+    message->hasHistoryId = false;
+    message->firstSentMillis = 0;
+    message->rtoMillis = rtoMillis;
+    message->retryMillis = 0;
+    message->retransmits = 0;
+    message->expectedAcks = MaxAckPeers; // until expect() is called
+    message->ackCount = 0;
+    return true;
+  }
+
+  // the frame went out for the first time, RTT and timeout count from now
+  void sent(UnackedMessage &message, unsigned long now)
+  {
+    if (message.isSent)
+      return;
+    message.isSent = true;
+    message.firstSentMillis = now;
+    message.retryMillis = now + message.rtoMillis;
+  }
+
+  UnackedMessage *find(uint16_t sequence)
+  {
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+      if (messages[i].isUsed && messages[i].sequence == sequence)
+        return &messages[i];
+    return NULL;
+  }
+
+  // counts an ack from a peer, rttMillis is set (else 0) if the frame wasn't retransmitted
+  // returns the message if the ack was new, it is done once every expected peer acked
+  UnackedMessage *acknowledge(uint16_t sequence, uint16_t peerHash, unsigned long now, uint32_t &rttMillis)
+  {
+    rttMillis = 0;
+    UnackedMessage *message = find(sequence);
+    if (message == NULL || !message->isSent || message->isDone)
+      return NULL;
+
+    for (uint8_t i = 0; i < message->ackCount; i++)
+      if (message->ackedBy[i] == peerHash)
+        return NULL;
+
+    if (message->ackCount < MaxAckPeers)
+      message->ackedBy[message->ackCount++] = peerHash;
+    if (message->retransmits == 0)
+      rttMillis = now - message->firstSentMillis;
+    if (message->ackCount >= message->expectedAcks)
+      finish(*message, now);
+    return message;
+  }
+
+  // sets how many peers should ack and the timeout once they are known, done if they already acked
+  void expect(UnackedMessage &message, uint8_t expectedAcks, uint32_t rtoMillis, unsigned long now)
+  {
+    if (message.isDone)
+      return;
+
+    message.expectedAcks = expectedAcks;
+    if (message.retransmits == 0)
+    {
+      message.rtoMillis = rtoMillis;
+      if (message.isSent)
+        message.retryMillis = message.firstSentMillis + rtoMillis;
+    }
+    if (message.ackCount >= expectedAcks)
+      finish(message, now);
+  }
+
+  template <typename F>
+  void forEach(F f)
+  {
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+      if (messages[i].isUsed)
+        f(messages[i]);
+  }
+
+  // done messages are released by the caller once their state is shown (see release()), or by poll()
+  // after another timeout if they never got a history entry to show it on
+  void release(UnackedMessage &message) { message.isUsed = false; }
+
+  // retransmit(message) resends frames whose timeout passed, finished(message) is called for frames
+  // that run out of retransmits
+  template <typename Retransmit, typename Finished>
+  void poll(unsigned long now, Retransmit retransmit, Finished finished)
+  {
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+    {
+      UnackedMessage &message = messages[i];
+      if (!message.isUsed || !message.isSent || (long)(now - message.retryMillis) < 0)
+        continue;
+
+      if (message.isDone)
+      {
+        if (!message.hasHistoryId)
+          release(message);
+        continue;
+      }
+
+      if (message.retransmits >= MaxRetransmits)
+      {
+        finish(message, now);
+        finished(message);
+        continue;
+      }
+
+      message.retransmits++;
+      message.rtoMillis *= 2; // back off
+      message.retryMillis = now + message.rtoMillis;
+      retransmit(message);
+    }
+  }
+
+  // the earliest retransmit or release, false if no sent message is tracked
+  bool nextDue(unsigned long &dueMillis) const
+  {
+    bool isTracked = false;
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+    {
+      const UnackedMessage &message = messages[i];
+      if (message.isUsed && message.isSent && (!isTracked || (long)(message.retryMillis - dueMillis) < 0))
+      {
+        dueMillis = message.retryMillis;
+        isTracked = true;
+      }
+    }
+    return isTracked;
+  }
+
+  size_t available() const
+  {
+    size_t count = 0;
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+      count += !messages[i].isUsed;
+    return count;
+  }
+
+  // messages still waiting for acks
+  size_t size() const
+  {
+    size_t count = 0;
+    for (uint8_t i = 0; i < MaxUnackedMessages; i++)
+      count += messages[i].isUsed && !messages[i].isDone;
+    return count;
+  }
+
+private:
+  void finish(UnackedMessage &message, unsigned long now)
+  {
+    message.isDone = true;
+    message.retryMillis = now + message.rtoMillis;
+  }
+
+  UnackedMessage messages[MaxUnackedMessages] = {};
+};
+
+// acks we owe other senders, taken by the next frame we send
+class PendingAcks
+{
+public:
+  // queues an ack, due is when to send a ping for it if no other frame went out first
+  void add(uint16_t senderHash, uint16_t sequence, unsigned long dueMillis)
+  {
+    for (uint8_t i = 0; i < count; i++)
+      if (acks[i].senderHash == senderHash && acks[i].sequence == sequence)
+        return;
+
+    if (count == MaxPendingAcks)
+    {
+      // drop the oldest, its sender will retransmit and we ack the duplicate
+      memmove(acks, acks + 1, sizeof(acks[0]) * (MaxPendingAcks - 1));
+      count--;
+    }
+
+    acks[count++] = {senderHash, sequence, dueMillis};
+    updateDue();
+  }
+
+  // writes up to maxAcks acks in the frame layout (see writeFrameAck()) and removes them
+  uint8_t take(uint8_t *ackData, uint8_t maxAcks)
+  {
+    uint8_t taken = std::min(count, maxAcks);
+    for (uint8_t i = 0; i < taken; i++)
+      writeFrameAck(ackData, i, acks[i].senderHash, acks[i].sequence);
+
+    memmove(acks, acks + taken, sizeof(acks[0]) * (count - taken));
+    count -= taken;
+    updateDue();
+    return taken;
+  }
+
+  // puts back the acks taken for a frame that couldn't be encoded, due now as they were about to go out
+  void restore(const FrameView &frame, unsigned long now)
+  {
+    for (uint8_t i = 0; i < frame.ackCount; i++)
+    {
+      uint16_t senderHash, sequence;
+      readFrameAck(frame, i, senderHash, sequence);
+      add(senderHash, sequence, now);
+    }
+  }
+
+  bool isDue(unsigned long now) const { return count > 0 && (long)(now - dueMillis) >= 0; }
+  unsigned long due() const { return dueMillis; }
+  uint8_t size() const { return count; }
+
+private:
+  struct PendingAck
+  {
+    uint16_t senderHash;
+    uint16_t sequence;
+    unsigned long dueMillis;
+  };
+
+  // the earliest due of the acks left
+  void updateDue()
+  {
+    for (uint8_t i = 0; i < count; i++)
+      if (i == 0 || (long)(acks[i].dueMillis - dueMillis) < 0)
+        dueMillis = acks[i].dueMillis;
+  }
+
+  PendingAck acks[MaxPendingAcks];
+  uint8_t count = 0;
+  unsigned long dueMillis = 0;
+};
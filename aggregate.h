@@ -0,0 +1,99 @@
+#pragma once
+
+// several frames sent as one radio frame, saving a preamble, header and UART round per frame
+//
+// aggregate: |frame count:8|AggregateMarker|length:8|frame|length:8|frame|...|
+//
+// the marker sits where v2 frames have their version byte and can't be mistaken for one or for a v1
+// username character. The frames inside are complete v2 frames, each with its own sender, sequence
+// number and acks, so duplicates, acks and relays work on them as if they came one by one. Aggregates
+// themselves are never relayed, relays send the frames inside on their own.
+
+#include <Arduino.h>
+
+#include "frame.h"
+
+const uint8_t AggregateMarker = 0x80;
+const size_t AggregateHeaderLength = 2;
+const uint8_t MaxAggregatedFrames = 16;
+
+bool isAggregateFrame(const uint8_t *frameData, size_t frameDataLength)
+{
+  return frameDataLength >= AggregateHeaderLength && frameData[1] == AggregateMarker;
+}
+
+// calls f(frameData, frameDataLength) for each frame inside, returns false if the aggregate is malformed,
+// in which case f is not called at all
+template <typename F>
+bool forEachAggregatedFrame(const uint8_t *frameData, size_t frameDataLength, F f)
+{
+  if (!isAggregateFrame(frameData, frameDataLength) || frameData[0] < 2 || frameData[0] > MaxAggregatedFrames)
+    return false;
+
+  // check every length first so a truncated aggregate is dropped whole
+  size_t offset = AggregateHeaderLength;
+  for (uint8_t i = 0; i < frameData[0]; i++)
+  {
+    if (offset >= frameDataLength || frameData[offset] < V2HeaderLength || offset + 1 + frameData[offset] > frameDataLength)
+      return false;
+    if (frameData[offset + 2] != FrameVersion2)
+      return false;
+    offset += 1 + frameData[offset];
+  }
+  if (offset != frameDataLength)
+    return false;
+
+  offset = AggregateHeaderLength;
+  for (uint8_t i = 0; i < frameData[0]; i++)
+  {
+    f(frameData + offset + 1, (size_t)frameData[offset]);
+    offset += 1 + frameData[offset];
+  }
+  return true;
+}
+
+// gathers frames for the next radio frame, a single frame is sent as is
+class FrameAggregator
+{
+public:
+  void clear()
+  {
+    frameCount = 0;
+    used = AggregateHeaderLength;
+  }
+
+  // false if the frame doesn't fit next to the ones gathered, the first frame always fits
+  bool add(const uint8_t *frameData, size_t frameDataLength, size_t capacity)
+  {
+    if (frameDataLength > MaxFrameLength)
+      return false;
+    if (frameCount > 0 && (frameCount == MaxAggregatedFrames || used + 1 + frameDataLength > capacity))
+      return false;
+
+    buffer[used] = frameDataLength;
+    memcpy(buffer + used + 1, frameData, frameDataLength);
+    used += 1 + frameDataLength;
+    frameCount++;
+    return true;
+  }
+
+  uint8_t count() const { return frameCount; }
+
+  // what to send, the aggregate or the one frame gathered
+  const uint8_t *data()
+  {
+    if (frameCount == 1)
+      return buffer + AggregateHeaderLength + 1;
+    buffer[0] = frameCount;
+    buffer[1] = AggregateMarker;
+    return buffer;
+  }
+
+  size_t length() const { return frameCount == 1 ? used - AggregateHeaderLength - 1 : used; }
+
+private:
+  // room for the header and length byte of a first frame up to MaxFrameLength
+  uint8_t buffer[AggregateHeaderLength + 1 + MaxFrameLength];
+  uint8_t frameCount = 0;
+  size_t used = AggregateHeaderLength;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+// LoRa time-on-air, used to size frames and pace transmissions on the E220
+
+#include <Arduino.h>
+
+const uint8_t LoRaPreambleSymbols = 8;
+const uint8_t LoRaCodingRate = 1; // 4/5
+const unsigned long E220UartBaudRate = 9600;
+
+struct LoRaModulation
+{
+  uint8_t spreadingFactor;
+  uint16_t bandwidthKHz;
+};
+
+// E220-900T22S(JP) air data rate register: bits 4-2 SF - 5, bits 1-0 bandwidth (125, 250, 500 kHz)
+LoRaModulation loraModulationFromAirDataRate(uint8_t airDataRate)
+{
+  LoRaModulation modulation;
+  modulation.spreadingFactor = 5 + ((airDataRate >> 2) & 0x07);
+  modulation.bandwidthKHz = 125 << std::min(airDataRate & 0x03, 2);
+  return modulation;
+}
+
+// Semtech SX126x time-on-air formula, explicit header and CRC on
+unsigned long loraAirtimeMicros(const LoRaModulation &modulation, size_t payloadLength)
+{
+  const int sf = modulation.spreadingFactor;
+  const unsigned long symbolMicros = ((1UL << sf) * 1000UL) / modulation.bandwidthKHz;
+  const int lowDataRateOptimize = symbolMicros > 16000 ? 1 : 0;
+
+  // preamble is n + 4.25 symbols, kept in quarter symbols to stay in integer math
+  unsigned long preambleQuarterSymbols = (LoRaPreambleSymbols * 4) + 17;
+
+  long payloadBits = 8 * (long)payloadLength - 4 * sf + 28 + 16;
+  long bitsPerBlock = 4 * (sf - 2 * lowDataRateOptimize);
+  long blocks = payloadBits > 0 ? (payloadBits + bitsPerBlock - 1) / bitsPerBlock : 0;
+  unsigned long payloadSymbols = 8 + blocks * (LoRaCodingRate + 4);
+
+  return (preambleQuarterSymbols * symbolMicros) / 4 + payloadSymbols * symbolMicros;
+}
+
+// E220 subpacket size register: 200, 128, 64 or 32 bytes, the longest frame sent as one packet
+size_t e220SubpacketLength(uint8_t subpacketSize)
+{
+  const size_t lengths[] = {200, 128, 64, 32};
+  return lengths[subpacketSize & 0x03];
+}
+
+// time to move a frame over the UART to the E220, 8N1 is 10 bits per byte
+unsigned long e220UartMicros(size_t payloadLength)
+{
+  return (payloadLength * 10UL * 1000000UL) / E220UartBaudRate;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// duty-cycle budget for LoRa, the airtime sent in the last hour
+//
+// sub-band limits are per hour (1% or 10% in the EU), so the budget is the duty cycle's share of an hour
+// and a frame may go out only if the airtime sent over the hour before it leaves room for it. Airtime is
+// summed in one minute slots, the oldest of which may be partly outside the hour, so the sum errs on the
+// side of too much and no rolling hour goes over the duty cycle. Frames are charged their airtime once
+// sent. Lower priorities need more of the budget left before they go out, see BudgetReservePercent.
+
+#include <Arduino.h>
+
+#include <mutex>
+
+#include "tx_queue.h"
+
+const unsigned long DutyCycleWindowMillis = 60UL * 60 * 1000;
+const uint8_t DutyCycleSlotCount = 60;
+const unsigned long DutyCycleSlotMillis = DutyCycleWindowMillis / DutyCycleSlotCount;
+const uint8_t DutyCycleOptions[] = {1, 10, 100}; // percent, 100 is no limit
+const uint8_t DutyCycleOptionCount = sizeof(DutyCycleOptions) / sizeof(DutyCycleOptions[0]);
+const uint8_t DefaultDutyCyclePercent = 10;
+
+// share of the budget that must be left for a priority to send, chat only needs its own airtime
+const uint8_t BudgetReservePercent[TxPriorityCount] = {0, 25, 50};
+
+class AirtimeBudget
+{
+public:
+  // a changed duty cycle keeps the airtime already sent in the hour
+  void configure(uint8_t dutyCyclePercent, unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance(now);
+    percent = std::max((uint8_t)1, std::min((uint8_t)100, dutyCyclePercent));
+    capacityMicros = (uint64_t)DutyCycleWindowMillis * 1000 * percent / 100;
+  }
+
+  // no limit, counters reset
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    percent = 100;
+    capacityMicros = spentMicros = 0;
+    memset(slotMicros, 0, sizeof(slotMicros));
+    deferred = dropped = 0;
+  }
+
+  uint8_t dutyCyclePercent() const { return percent; }
+  bool isLimited() const { return percent < 100; }
+
+  // whether a frame of that priority and airtime may go out now
+  bool allows(TxPriority priority, uint32_t airtimeMicros, unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!isLimited())
+      return true;
+    advance(now);
+    return windowMicros() + airtimeMicros + capacityMicros * BudgetReservePercent[priority] / 100 <= capacityMicros;
+  }
+
+  void spend(uint32_t airtimeMicros, unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance(now);
+    slotMicros[slot] += airtimeMicros;
+    spentMicros += airtimeMicros;
+  }
+
+  uint8_t remainingPercent(unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance(now);
+    uint64_t window = windowMicros();
+    return capacityMicros ? (capacityMicros - std::min(capacityMicros, window)) * 100 / capacityMicros : 100;
+  }
+
+  uint64_t spent() const { return spentMicros; }
+
+  uint32_t deferred = 0; // times the head of the queue had to wait for the budget
+  uint32_t dropped = 0;  // pings dropped for lack of budget
+
+private:
+  // moves to the slot holding now, clearing the ones that fell out of the hour
+  void advance(unsigned long now)
+  {
+    if (now - slotStartMillis >= (DutyCycleSlotCount + 1) * DutyCycleSlotMillis)
+    {
+      memset(slotMicros, 0, sizeof(slotMicros));
+      slotStartMillis = now;
+      return;
+    }
+    while (now - slotStartMillis >= DutyCycleSlotMillis)
+    {
+      slotStartMillis += DutyCycleSlotMillis;
+      slot = (slot + 1) % (DutyCycleSlotCount + 1);
+      slotMicros[slot] = 0;
+    }
+  }
+
+  // the current slot and the hour of slots before it
+  uint64_t windowMicros() const
+  {
+    uint64_t total = 0;
+    for (uint8_t i = 0; i <= DutyCycleSlotCount; i++)
+      total += slotMicros[i];
+    return total;
+  }
+
+  std::mutex mutex;
+  uint8_t percent = 100;
+  uint64_t capacityMicros = 0;
+  uint64_t spentMicros = 0;
+  uint32_t slotMicros[DutyCycleSlotCount + 1] = {};
+  uint8_t slot = 0;
+  unsigned long slotStartMillis = 0;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+// presence beacons (pings), scheduled Trickle style (RFC 6206)
+//
+// the interval starts at the transport's base ping interval and doubles each time one passes without a
+// new neighbour, up to a cap that grows with the number of neighbours, so the channel carries about the
+// same number of beacons whether 3 or 30 users are around. A new neighbour resets it to the base so they
+// learn about us soon. Each beacon is sent at a random point in the second half of its interval so
+// nodes don't synchronise, and is skipped if one of our own frames went out during the interval: every
+// frame carries our sender hash, and our name every few frames, so receivers renew our presence from
+// chat and ack pings alone.
+
+#include <Arduino.h>
+
+const uint8_t BeaconTargetNeighbours = 4; // neighbours whose beacons fit in one base interval
+const uint8_t MaxBeaconScale = 8;         // longest interval, in base intervals
+const uint8_t BeaconsPerPresenceTimeout = 3;
+
+class BeaconScheduler
+{
+public:
+  // starts over with the base interval, the first beacon is due at once
+  void begin(unsigned long baseMillis, unsigned long now)
+  {
+    this->baseMillis = baseMillis;
+    maxMillis = baseMillis;
+    intervalMillis = baseMillis;
+    suppressedCount = 0;
+    startInterval(now);
+    fireMillis = now;
+  }
+
+  unsigned long base() const { return baseMillis; }
+
+  // the cap, a power of two times the base interval for every BeaconTargetNeighbours neighbours
+  void setNeighbours(size_t neighbours)
+  {
+    unsigned long scale = 1;
+    while (scale < MaxBeaconScale && scale * BeaconTargetNeighbours < neighbours)
+      scale *= 2;
+    maxMillis = baseMillis * scale;
+    intervalMillis = std::min(intervalMillis, maxMillis);
+  }
+
+  // a new neighbour, beacon again within the base interval
+  void reset(unsigned long now)
+  {
+    if (intervalMillis == baseMillis)
+      return;
+    intervalMillis = baseMillis;
+    startInterval(now);
+  }
+
+  // returns true when a beacon is due, lastOwnFrameMillis is when we last sent a frame of our own
+  bool poll(unsigned long now, unsigned long lastOwnFrameMillis)
+  {
+    bool isDue = false;
+    if (!isFired && (long)(now - fireMillis) >= 0)
+    {
+      isFired = true;
+      isDue = (long)(lastOwnFrameMillis - startMillis) < 0;
+      suppressedCount += !isDue;
+    }
+
+    if ((long)(now - (startMillis + intervalMillis)) >= 0)
+    {
+      intervalMillis = std::min(intervalMillis * 2, maxMillis);
+      startInterval(now);
+    }
+    return isDue;
+  }
+
+  // when poll() next has something to do: send the beacon or start the next interval
+  unsigned long nextDue() const
+  {
+    unsigned long endMillis = startMillis + intervalMillis;
+    return !isFired && (long)(fireMillis - endMillis) < 0 ? fireMillis : endMillis;
+  }
+
+  // presence of users beaconing at our cap, with room for lost beacons
+  unsigned long presenceTimeoutMillis() const { return BeaconsPerPresenceTimeout * maxMillis; }
+
+  unsigned long interval() const { return intervalMillis; }
+  uint32_t suppressed() const { return suppressedCount; }
+
+private:
+  void startInterval(unsigned long now)
+  {
+    startMillis = now;
+    fireMillis = now + intervalMillis / 2 + random(0, intervalMillis / 2);
+    isFired = false;
+  }
+
+  unsigned long baseMillis = 0;
+  unsigned long maxMillis = 0;
+  unsigned long intervalMillis = 0;
+  unsigned long startMillis = 0;
+  unsigned long fireMillis = 0;
+  bool isFired = true;
+  uint32_t suppressedCount = 0;
+};
+
+const uint8_t MaxResponseTriggers = 4;
+
+// replies to new neighbours, coalesced and delayed so a node booting among many doesn't get them all at once
+//
+// the first new neighbour schedules a reply ping at a random point in the window, more new neighbours
+// before it goes out share it. The reply is dropped if another node's ping is overheard first or one of
+// our own frames goes out: the newcomer then knows the channel is in use, and the beacon reset by the
+// new neighbour (see BeaconScheduler::reset()) tells it about us within the base interval.
+class ResponseScheduler
+{
+public:
+  void clear()
+  {
+    isPending = false;
+    triggerCount = 0;
+  }
+
+  void schedule(uint16_t senderHash, unsigned long now, unsigned long windowMillis)
+  {
+    if (!isPending)
+    {
+      isPending = true;
+      scheduledMillis = now;
+      dueMillis = now + random(0, windowMillis);
+      triggerCount = 0;
+    }
+    else
+    {
+      coalescedCount++;
+    }
+
+    if (triggerCount < MaxResponseTriggers)
+      triggers[triggerCount++] = senderHash;
+  }
+
+  // a ping from another node, it replies in our place unless it is one of the newcomers
+  void overhear(uint16_t senderHash)
+  {
+    if (!isPending)
+      return;
+    for (uint8_t i = 0; i < triggerCount; i++)
+      if (triggers[i] == senderHash)
+        return;
+    isPending = false;
+    suppressedCount++;
+  }
+
+  // returns true when the reply is due, lastOwnFrameMillis is when we last sent a frame of our own
+  bool poll(unsigned long now, unsigned long lastOwnFrameMillis)
+  {
+    if (!isPending || (long)(now - dueMillis) < 0)
+      return false;
+
+    isPending = false;
+    if ((long)(lastOwnFrameMillis - scheduledMillis) > 0)
+    {
+      suppressedCount++;
+      return false;
+    }
+    return true;
+  }
+
+  bool pending() const { return isPending; }
+  unsigned long due() const { return dueMillis; }
+  uint32_t coalesced() const { return coalescedCount; }
+  uint32_t suppressed() const { return suppressedCount; }
+
+private:
+  bool isPending = false;
+  unsigned long scheduledMillis = 0;
+  unsigned long dueMillis = 0;
+  uint16_t triggers[MaxResponseTriggers];
+  uint8_t triggerCount = 0;
+  uint32_t coalescedCount = 0;
+  uint32_t suppressedCount = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+// timestamps of the boot phases, logged once the last one is reached and shown under Settings
+//
+// phases run on more than one task (the radio comes up on its own, see setup()), each one is marked
+// once by the task that finishes it and the table is complete when every phase has been marked
+
+#include <Arduino.h>
+#include <atomic>
+
+enum BootPhase : uint8_t
+{
+  BootSetup = 0,  // setup() entered, after the bootloader and Arduino core start
+  BootBoard,      // M5Cardputer.begin()
+  BootConfig,     // settings read from NVS (or imported from SD)
+  BootDisplay,    // display and canvases ready
+  BootFirstFrame, // system bar, tab bar and main window pushed
+  BootSdMount,    // SD card mounted, or given up on
+  BootStorage,    // chat logs open and storage task running
+  BootInput,      // keyboard scanning task running, setup() done
+  BootRadio,      // LoRa or ESP-NOW ready to send
+  BootPhaseCount
+};
+
+const char *const BootPhaseNames[BootPhaseCount] = {"setup", "board", "config", "display", "first frame", "SD mount", "storage", "input", "radio"};
+
+class BootProfile
+{
+public:
+  // returns true for the mark that completes the table
+  bool mark(BootPhase phase, unsigned long micros)
+  {
+    if (marks[phase] != 0)
+      return false;
+    marks[phase] = micros;
+    return marked.fetch_add(1, std::memory_order_acq_rel) + 1 == BootPhaseCount;
+  }
+
+  bool has(BootPhase phase) const { return marks[phase] != 0; }
+  bool isComplete() const { return marked.load(std::memory_order_acquire) == BootPhaseCount; }
+
+  // since the chip started, 0 if not reached yet
+  unsigned long millisAt(BootPhase phase) const { return marks[phase] / 1000; }
+
+  // time spent in a phase, from the latest phase reached before it on any task
+  unsigned long phaseMillis(BootPhase phase) const
+  {
+    if (marks[phase] == 0)
+      return 0;
+
+    unsigned long start = 0;
+    for (uint8_t i = 0; i < BootPhaseCount; i++)
+    {
+      if (marks[i] != 0 && marks[i] < marks[phase] && marks[i] > start)
+        start = marks[i];
+    }
+    return (marks[phase] - start) / 1000;
+  }
+
+private:
+  volatile unsigned long marks[BootPhaseCount] = {};
+  std::atomic<uint8_t> marked{0};
+};
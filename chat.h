@@ -0,0 +1,1196 @@
+#pragma once
+
+// chat stack shared by the Cardputer firmware and the native host build, no M5 or radio dependencies here
+
+#include <atomic>
+#include <mutex>
+
+#include "ack.h"
+#include "aggregate.h"
+#include "airtime_budget.h"
+#include "beacon.h"
+#include "chat_layout.h"
+#include "chat_log.h"
+#include "common.h"
+#include "duplicate_filter.h"
+#include "fragment.h"
+#include "frame.h"
+#include "message_history.h"
+#include "presence.h"
+#include "relay.h"
+#include "spsc_queue.h"
+#include "storage.h"
+#include "transport.h"
+#include "tx_queue.h"
+
+#define PING_CHANNEL 0b11
+#define PING_MESSAGE ""
+#define LORA_PING_INTERVAL_MS 1000 * 60    // 1 minute, shortest beacon interval, see beacon.h
+#define ESP_NOW_PING_INTERVAL_MS 1000 * 15   // 15 seconds
+#define PRESENCE_TIMEOUT_MS 1000 * 60 * 3 // 3 minutes, the time before a msg "expires" for the purposes of tracking a user presence, longer with many users around
+
+// per-sender sequence number, 14 bits of which the frame nonce is the low 6, see frame.h
+// starts at a random value so a restarted sender isn't mistaken for duplicates of its last frames
+uint16_t messageSequence = 0;
+
+// active radio, set by the firmware (LoRa or ESP-NOW) or the host harness (loopback)
+Transport *transport = NULL;
+// once the transmit task runs only it changes transport, between frames, when the UI task asks for it
+void (*transportSwap)() = NULL; // set by the firmware, brings up the radio the settings ask for
+std::atomic<bool> isTransportSwapPending{false};
+
+// used by draw loop to trigger redraws
+volatile bool receivedMessage = false; // signal to redraw window
+// the UI task sleeps until woken, set by the firmware, the host harness calls processQueuedMessages() itself
+void (*uiWake)() = NULL;    // frames received, messages sent or read back from a log
+void (*uiRefresh)() = NULL; // a frame went out or came in, for the system bar's indicators
+volatile unsigned long lastRx = false;
+volatile unsigned long lastTx = false;
+volatile unsigned long lastOwnFrameMillis = 0; // frames that carry our sender hash, a beacon is skipped after one
+
+// other users seen, see presence.h
+PresenceTable presence(PRESENCE_TIMEOUT_MS);
+DuplicateFilter duplicateFilter;
+RelayQueue relayQueue;
+BeaconScheduler beacon; // UI task only
+ResponseScheduler responsePing;
+
+// ack mode state, shared by the transmit and UI tasks
+std::mutex ackMutex;
+AckTracker ackTracker;
+PendingAcks pendingAcks;
+
+// longest wait before relaying a frame, LoRa frames take ~200 ms at SF9 so this leaves room for neighbouring relays to hear each other
+const unsigned long LoRaRelayWindowMillis = 4000;
+const unsigned long EspNowRelayWindowMillis = 40;
+
+// replies to new neighbours are spread over this window, see ResponseScheduler
+const unsigned long LoRaResponseWindowMillis = 4000;
+const unsigned long EspNowResponseWindowMillis = 100;
+
+struct ChatTab
+{
+  unsigned char channel;
+  // only accessed from the UI task, see processQueuedMessages()
+  MessageHistory history;
+  MessageLayoutCache layout; // wrapped lines per history entry
+  ChatLog log;               // every message in the history is logged while it is open, see loadOlderMessages()
+  String messageBuffer;
+  int viewIndex; // lines scrolled back from the newest, 0 follows new messages
+};
+
+const int ChatScrollPageLines = 6;
+const size_t ChatLogPageMessages = 8; // read back from the log at a time, a screenful as messages take a line or more
+
+const uint8_t ChatTabCount = 3;
+ChatTab chatTab[ChatTabCount];
+
+// history capacity per channel, message count and text arena bytes, allocated once at boot
+const uint16_t ChatTabHistoryMessages[ChatTabCount] = {128, 64, 64};
+const uint16_t ChatTabHistoryArenaBytes[ChatTabCount] = {6144, 3072, 3072};
+
+// chat state (chatTab, presence) is only touched by the UI task, other tasks hand it work through these
+// one queue per producer: LoRa receive task, ESP-NOW receive callback, transmit task
+const size_t RxQueueCapacity = 8;
+SpscQueue<ReceivedFrame, RxQueueCapacity> loraRxQueue;
+SpscQueue<ReceivedFrame, RxQueueCapacity> espNowRxQueue;
+SpscQueue<Message, 8> sentMessageQueue;
+
+// everything sent goes through the transmit task, which alone encodes and sends frames (see processTxQueue())
+TxQueue txQueue;
+void (*txWake)() = NULL;          // set by the firmware to wake the transmit task, the host drains the queue itself
+unsigned long radioReadyMillis = 0; // when the radio is done with the last frame, transmit task only
+AirtimeBudget airtimeBudget;        // LoRa only, ESP-NOW has no duty cycle
+FrameAggregator txAggregate;        // frames for the next radio frame, transmit task only
+
+// messages with frames in txAggregate, handed to the UI task with their result once the last of their
+// frames is sent, see flushFrames(), transmit task only
+struct PendingSend
+{
+  Message message;
+  uint8_t framesLeft; // not sent yet, 0 when the entry is free
+  bool isFailed;
+};
+
+// the message each frame in txAggregate belongs to
+struct AggregatedFrame
+{
+  uint8_t sendIndex; // in pendingSends, or NoPendingSend for pings and frames sent as is
+  bool isTracked;    // waits for acks, its timeout starts when it is sent
+  uint16_t sequence;
+};
+
+const uint8_t MaxPendingSends = 8; // as many as sentMessageQueue holds
+const uint8_t NoPendingSend = 0xFF;
+PendingSend pendingSends[MaxPendingSends];
+AggregatedFrame txAggregateFrames[MaxAggregatedFrames];
+
+// the SD card is only touched by the storage task once setup() is done, see processStorage()
+WriteBehindQueue storageQueue;
+StorageSink *storage = NULL;   // set by the firmware once the card is mounted
+void (*storageWake)() = NULL; // wakes the storage task
+
+// older messages read back from the chat logs for the UI task, one request at a time
+struct LogLoadRequest
+{
+  uint8_t channel;
+  uint32_t newestRecord;
+  uint8_t count;
+};
+
+struct LoadedMessage
+{
+  uint32_t record;
+  Message message;
+};
+
+SpscQueue<LogLoadRequest, 2> logLoadQueue;
+SpscQueue<LoadedMessage, ChatLogPageMessages> loadedMessageQueue;
+volatile bool isLogLoading = false;
+
+Reassembler reassembler;
+
+// settings, UI task only, messages take username, ack and compression mode with them when queued (see TxSender)
+String username = "user";
+bool pingMode = true;
+bool relayMode = false;
+bool ackMode = false;
+bool compressionMode = true;
+bool aggregationMode = true; // send queued frames together, see aggregate.h
+
+// v2 frames carry the full username every FullNameInterval frames, pings always carry it
+// set by the UI task as frames come in, cleared by the transmit task once a frame carries them
+const uint8_t FullNameInterval = 8;
+const uint32_t NameRequestPending = 0x10000; // with the hash in the low bits
+std::atomic<uint8_t> framesSinceFullName{FullNameInterval};
+std::atomic<bool> fullNameRequested{false};   // another user asked for our name
+std::atomic<uint32_t> pendingNameRequest{0}; // we saw a hash with no name, ask for it in the next frame
+
+String getHexString(const void *data, size_t size)
+{
+  const byte *bytes = (const byte *)(data);
+  String hexDump = "";
+
+  for (size_t i = 0; i < size; ++i)
+  {
+    char hex[4];
+    snprintf(hex, sizeof(hex), "%02x ", bytes[i]);
+    hexDump += hex;
+  }
+
+  return hexDump; // Return the accumulated hex dump string
+}
+
+// best rssi of the users seen recently on a transport, kept up to date as frames arrive
+int getPresenceRssi(bool isEspNow)
+{
+  presence.expire(millis());
+  return presence.getMaxRssi(isEspNow);
+}
+
+// ask for the full name of a sender in our next frame
+void requestName(uint16_t senderHash)
+{
+  pendingNameRequest = NameRequestPending | senderHash;
+}
+
+bool recordPresence(FrameView &frame, int rssi, bool isEspNow)
+{
+  // return true if presence is new or renewed
+  // frames that only carry the sender hash get their username filled in from the presence
+
+  bool isRenewed;
+  Presence &user = presence.touch(frame.senderHash, isEspNow, rssi, millis(), isRenewed);
+
+  if (frame.flags & FrameFlags::FullName)
+  {
+    if (!user.isNameKnown || !frameUsernameEquals(frame, user.username, strlen(user.username)))
+    {
+      copyToBuffer(user.username, sizeof(user.username), frame.username, frame.usernameLength);
+      user.isNameKnown = true;
+    }
+  }
+  else
+  {
+    frame.username = user.username;
+    frame.usernameLength = strlen(user.username);
+    if (!user.isNameKnown)
+      requestName(frame.senderHash);
+  }
+
+  if (isRenewed)
+    log_w("new %s presence: %s", isEspNow ? "ESP-NOW" : "LoRa", user.username);
+
+  return isRenewed;
+}
+
+// the username and settings messages queued now are sent with, UI task only
+TxSender currentSender()
+{
+  TxSender sender;
+  copyToBuffer(sender.username, sizeof(sender.username), username.c_str(), username.length());
+  sender.hash = usernameHash(sender.username, strlen(sender.username));
+  sender.flags = (compressionMode ? FrameFlags::Compressed : 0) | (ackMode ? FrameFlags::AckRequest : 0);
+  return sender;
+}
+
+// encodes our next frame into at most frameCapacity bytes, returns 0 if the text doesn't fit
+// pending acks ride along and are written to ackData, which must outlive the frame, as does sender
+size_t createFrame(FrameView &frame, const TxSender &sender, int channel, const char *messageText, size_t messageTextLength, uint8_t *frameData,
+                   size_t frameCapacity, uint8_t *ackData)
+{
+  frame.version = FrameVersion;
+  frame.nonce = messageSequence & 0x3F;
+  frame.sequence = messageSequence;
+  frame.channel = channel;
+  frame.flags = FrameFlags::Sequence;
+  frame.senderHash = sender.hash;
+  frame.fragmentIndex = 0;
+  frame.isLastFragment = true;
+  frame.requestedHash = 0;
+  frame.username = sender.username;
+  frame.usernameLength = strlen(sender.username);
+  frame.text = messageText;
+  frame.textLength = std::min(messageTextLength, (size_t)MaxMessageLength);
+
+  if (channel == PING_CHANNEL || fullNameRequested || framesSinceFullName >= FullNameInterval)
+  {
+    frame.flags |= FrameFlags::FullName;
+  }
+
+  uint32_t nameRequest = pendingNameRequest;
+  if (nameRequest != 0)
+  {
+    frame.flags |= FrameFlags::NameRequest;
+    frame.requestedHash = nameRequest & 0xFFFF;
+  }
+
+  if ((sender.flags & FrameFlags::Compressed) && frame.textLength > 0)
+  {
+    frame.flags |= FrameFlags::Compressed;
+  }
+
+  if ((sender.flags & FrameFlags::AckRequest) && channel != PING_CHANNEL && frame.textLength > 0)
+  {
+    frame.flags |= FrameFlags::AckRequest;
+  }
+
+  // as many as fit next to the header and some text, put back if the message can't be encoded, if the
+  // send fails they are lost and the retransmit is acked instead
+  frame.ackCount = 0;
+  size_t ackRoom = frameHeaderLength(frame) + 1 + (frame.textLength > 0 ? MinFragmentTextLength : 0);
+  uint8_t maxAcks = frameCapacity > ackRoom ? std::min((size_t)MaxFrameAcks, (frameCapacity - ackRoom) / FrameAckLength) : 0;
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    frame.ackCount = pendingAcks.take(ackData, maxAcks);
+  }
+  frame.acks = ackData;
+  if (frame.ackCount > 0)
+  {
+    frame.flags |= FrameFlags::Ack;
+  }
+
+  log_d("creating frame: |%d|%d|%02x|%04x|%.*s|", channel, messageSequence, frame.flags, frame.senderHash, (int)messageTextLength, messageText);
+  return encodeFrame(frameData, frameCapacity, frame);
+}
+
+// splits text that didn't fit in the frame from createFrame() into fragments of up to mtu bytes, the
+// first fragment carries that frame's name, name request and acks, the rest only what they need
+// returns the fragment count and each fragment's text length, 0 if the text needs too many fragments
+uint8_t planFragments(FrameView &frame, const char *text, size_t textLength, size_t mtu, uint8_t *fragmentTextLengths)
+{
+  uint8_t scratch[MaxFrameLength];
+  uint8_t firstFlags = frame.flags | FrameFlags::Fragment;
+  frame.flags = firstFlags;
+
+  uint8_t fragmentCount = 0;
+  for (size_t offset = 0; offset < textLength; fragmentCount++)
+  {
+    if (fragmentCount == MaxFragments)
+      return 0;
+
+    frame.fragmentIndex = fragmentCount;
+    size_t length = fitFrameText(frame, text + offset, textLength - offset, scratch, mtu);
+    if (length == 0)
+      return 0;
+
+    fragmentTextLengths[fragmentCount] = length;
+    offset += length;
+    frame.flags &= ~(FrameFlags::FullName | FrameFlags::NameRequest | FrameFlags::Ack);
+  }
+
+  frame.flags = firstFlags;
+  return fragmentCount;
+}
+
+// hands a message to the UI task for the history, with the reason if it failed, call with ackMutex held
+void reportSend(PendingSend &send)
+{
+  Message &message = send.message;
+  if (send.isFailed)
+  {
+    // its frames aren't worth retransmitting once it shows as failed
+    if (message.deliveryState == Sending)
+    {
+      ackTracker.forEach([&](UnackedMessage &fragment) {
+        if (fragment.channel == message.channel && fragment.firstSequence == message.sequence)
+          ackTracker.release(fragment);
+      });
+    }
+    message.sequence = 0;
+    message.deliveryState = NotTracked;
+    strcpy(message.text, "send failed");
+  }
+
+  if (!sentMessageQueue.push(message))
+    log_w("sent message queue full");
+  else if (uiWake != NULL)
+    uiWake();
+}
+
+// sends the frames gathered so far as one radio frame once the radio is done with the one before, the
+// result goes to the messages the frames belong to and the ack timeouts of tracked frames start
+// transmit task only
+int flushFrames()
+{
+  if (txAggregate.count() == 0)
+    return 0;
+
+  long waitMillis = (long)(radioReadyMillis - millis());
+  if (waitMillis > 0)
+    delay(waitMillis);
+
+  const uint8_t *frameData = txAggregate.data();
+  size_t frameDataLength = txAggregate.length();
+  if (txAggregate.count() > 1)
+    log_d("sending %d frames in one", txAggregate.count());
+
+  int result = transport->send(frameData, frameDataLength);
+  if (result == 0)
+  {
+    lastTx = millis();
+    if (uiRefresh != NULL)
+      uiRefresh();
+    radioReadyMillis = millis() + transport->frameMillis(frameDataLength);
+    if (!transport->isEspNow())
+      airtimeBudget.spend(transport->airtimeMicros(frameDataLength), millis());
+  }
+  else
+  {
+    log_e("error sending %s frame: %d", transport->name(), result);
+  }
+
+  unsigned long now = millis();
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    for (uint8_t i = 0; i < txAggregate.count(); i++)
+    {
+      const AggregatedFrame &frame = txAggregateFrames[i];
+      UnackedMessage *unacked = frame.isTracked && result == 0 ? ackTracker.find(frame.sequence) : NULL;
+      if (unacked != NULL)
+        ackTracker.sent(*unacked, now);
+
+      if (frame.sendIndex == NoPendingSend)
+        continue;
+      PendingSend &send = pendingSends[frame.sendIndex];
+      send.isFailed |= result != 0;
+      if (--send.framesLeft == 0)
+        reportSend(send);
+    }
+  }
+
+  txAggregate.clear();
+  return result;
+}
+
+// adds a frame to the next radio frame, which is sent first if the frame doesn't fit in it
+// the last frame waits for flushFrames(), called once the transmit queue is empty, which reports the
+// result to the message the frame belongs to, transmit task only
+int transmitFrame(const uint8_t *frameData, size_t frameDataLength, uint8_t sendIndex, bool isTracked, uint16_t sequence)
+{
+  size_t capacity = std::min(transport->mtu(), MaxFrameLength);
+  if (!txAggregate.add(frameData, frameDataLength, capacity))
+  {
+    flushFrames();
+    txAggregate.add(frameData, frameDataLength, capacity);
+  }
+  txAggregateFrames[txAggregate.count() - 1] = {sendIndex, isTracked, sequence};
+  return aggregationMode ? 0 : flushFrames();
+}
+
+// a free pendingSends entry, the frames gathered are sent first to free one if needed
+uint8_t reservePendingSend()
+{
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    for (uint8_t i = 0; i < MaxPendingSends; i++)
+      if (pendingSends[i].framesLeft == 0)
+        return i;
+    flushFrames();
+  }
+  return NoPendingSend;
+}
+
+// encodes fragment index of a planned message, sequence numbers follow on from the first fragment's
+size_t encodeFragment(FrameView &frame, uint8_t firstFlags, uint16_t firstSequence, const char *text, const uint8_t *fragmentTextLengths,
+                      uint8_t index, uint8_t fragmentCount, uint8_t *frameData, size_t mtu)
+{
+  size_t offset = 0;
+  for (uint8_t i = 0; i < index; i++)
+    offset += fragmentTextLengths[i];
+
+  frame.flags = index == 0 ? firstFlags : firstFlags & ~(FrameFlags::FullName | FrameFlags::NameRequest | FrameFlags::Ack);
+  frame.sequence = (firstSequence + index) & SequenceMask;
+  frame.nonce = frame.sequence & 0x3F;
+  frame.fragmentIndex = index;
+  frame.isLastFragment = index == fragmentCount - 1;
+  frame.text = text + offset;
+  frame.textLength = fragmentTextLengths[index];
+  return encodeFrame(frameData, mtu, frame);
+}
+
+// encodes a message and hands its frames to the radio, fragments of a long one are sent back to back
+// paced by the radio, the message reaches the UI task once they are sent (see flushFrames())
+// returns false if it can't be encoded, called from the transmit task, other tasks use queueMessage()
+bool sendMessage(const TxSender &sender, int channel, const char *text, size_t textLength)
+{
+  if (transport == NULL)
+  {
+    log_e("no transport");
+    return false;
+  }
+
+  textLength = std::min(textLength, (size_t)MaxMessageLength);
+  size_t mtu = std::min(transport->mtu(), MaxFrameLength) - 1; // room for relays to add the hops left byte
+
+  FrameView frame;
+  uint8_t ackData[MaxFrameAcks * FrameAckLength];
+  uint8_t frameData[MaxFrameLength];
+  size_t frameDataLength = createFrame(frame, sender, channel, text, textLength, frameData, mtu, ackData);
+
+  // too long for one frame
+  uint8_t fragmentCount = 1;
+  uint8_t fragmentTextLengths[MaxFragments];
+  uint8_t firstFlags = frame.flags;
+  uint16_t firstSequence = messageSequence;
+  if (frameDataLength == 0)
+  {
+    fragmentCount = planFragments(frame, text, textLength, mtu, fragmentTextLengths);
+    if (fragmentCount == 0)
+    {
+      log_e("message doesn't fit in %d %s fragments of %d bytes", MaxFragments, transport->name(), (int)mtu);
+      std::lock_guard<std::mutex> lock(ackMutex);
+      pendingAcks.restore(frame, millis());
+      return false;
+    }
+
+    firstFlags = frame.flags;
+    frameDataLength = encodeFragment(frame, firstFlags, firstSequence, text, fragmentTextLengths, 0, fragmentCount, frameData, mtu);
+  }
+
+  if (firstFlags & FrameFlags::FullName)
+  {
+    framesSinceFullName = 0;
+    fullNameRequested = false;
+  }
+  else if (framesSinceFullName < FullNameInterval)
+  {
+    framesSinceFullName++;
+  }
+
+  // unless another one came in meanwhile
+  uint32_t nameRequest = NameRequestPending | frame.requestedHash;
+  if (firstFlags & FrameFlags::NameRequest)
+    pendingNameRequest.compare_exchange_strong(nameRequest, 0);
+
+  // fragments are tracked one by one, only if there is room for all of them
+  const AckTiming &timing = transport->isEspNow() ? EspNowAckTiming : LoRaAckTiming;
+  bool isTracked;
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    isTracked = (firstFlags & FrameFlags::AckRequest) && ackTracker.available() >= fragmentCount;
+  }
+
+  // pings have nothing to show
+  uint8_t sendIndex = channel == PING_CHANNEL ? NoPendingSend : reservePendingSend();
+  if (sendIndex != NoPendingSend)
+  {
+    PendingSend &send = pendingSends[sendIndex];
+    send.framesLeft = fragmentCount;
+    send.isFailed = false;
+    Message &sentMessage = send.message;
+    sentMessage.channel = channel;
+    sentMessage.sequence = firstSequence;
+    sentMessage.deliveryState = isTracked ? Sending : NotTracked;
+    sentMessage.username[0] = '\0';
+    copyToBuffer(sentMessage.text, sizeof(sentMessage.text), text, textLength);
+    sentMessage.isEspNow = transport->isEspNow();
+    sentMessage.rssi = 0;
+  }
+
+  messageSequence = (messageSequence + fragmentCount) & SequenceMask;
+  lastOwnFrameMillis = millis();
+
+  // a lost fragment is only resent in ack mode
+  for (uint8_t i = 0; i < fragmentCount; i++)
+  {
+    if (i > 0)
+      frameDataLength = encodeFragment(frame, firstFlags, firstSequence, text, fragmentTextLengths, i, fragmentCount, frameData, mtu);
+    else
+      log_d("sending frame: %s", getHexString(frameData, frameDataLength).c_str());
+
+    if (isTracked)
+    {
+      std::lock_guard<std::mutex> lock(ackMutex);
+      ackTracker.track(frameData, frameDataLength, frame.sequence, firstSequence, channel, timing.initialRtoMillis);
+    }
+
+    int result = transmitFrame(frameData, frameDataLength, sendIndex, isTracked, frame.sequence);
+    if (result != 0)
+      log_e("error sending %s %s: %d", transport->name(), fragmentCount > 1 ? "fragment" : "frame", result);
+  }
+
+  return true;
+}
+
+bool sendMessage(const TxSender &sender, int channel, const String &messageText)
+{
+  return sendMessage(sender, channel, messageText.c_str(), messageText.length());
+}
+
+// UI task: the transmit task swaps the radio once done with the frame it is on, see processTxQueue()
+void requestTransportSwap()
+{
+  isTransportSwapPending = true;
+  if (txWake != NULL)
+    txWake();
+}
+
+// non-blocking, the transmit task sends the message and hands it to the UI task for the history
+// returns false if the queue for that priority is full, UI task only, see currentSender()
+bool queueMessage(TxPriority priority, uint8_t channel, const char *text, size_t textLength)
+{
+  if (!txQueue.push(priority, TxMessage, channel, text, std::min(textLength, (size_t)MaxMessageLength), currentSender(), millis()))
+    return false;
+  if (txWake != NULL)
+    txWake();
+  return true;
+}
+
+// a ping, unless one of at least that priority is already waiting
+bool queuePing(TxPriority priority)
+{
+  for (uint8_t p = TxAck; p <= priority; p++)
+    if (txQueue.size((TxPriority)p) > 0)
+      return false;
+  return queueMessage(priority, PING_CHANNEL, PING_MESSAGE, strlen(PING_MESSAGE));
+}
+
+// a frame sent as is (relays, retransmits)
+bool queueFrame(const uint8_t *frameData, size_t frameDataLength)
+{
+  if (!txQueue.push(TxChat, TxFrame, 0, frameData, frameDataLength, TxSender(), millis()))
+    return false;
+  if (txWake != NULL)
+    txWake();
+  return true;
+}
+
+// airtime of a queued request before it is encoded, assumes uncompressed text and a full header
+uint32_t txAirtimeMicros(const TxRequest &request)
+{
+  if (request.kind == TxFrame)
+    return transport->airtimeMicros(request.length);
+
+  const size_t headerLength = 8 + strlen(request.sender.username) + 1;
+  size_t mtu = std::min(transport->mtu(), (size_t)MaxFrameLength);
+  size_t textRoom = mtu > headerLength ? mtu - headerLength : 1;
+  uint32_t airtimeMicros = 0;
+  size_t textLeft = request.length;
+  do
+  {
+    size_t textLength = std::min(textLeft, textRoom);
+    airtimeMicros += transport->airtimeMicros(headerLength + textLength);
+    textLeft -= textLength;
+  } while (textLeft > 0);
+  return airtimeMicros;
+}
+
+// transmit task: sends the next queued request, returns false if there was nothing to send or the
+// duty-cycle budget holds it back
+bool processTxQueue()
+{
+  // frames gathered for the old radio go out on it first
+  if (isTransportSwapPending.exchange(false) && transportSwap != NULL)
+  {
+    if (transport != NULL)
+      flushFrames();
+    transportSwap();
+    radioReadyMillis = millis();
+    if (uiRefresh != NULL)
+      uiRefresh();
+  }
+
+  TxRequest request;
+  TxPriority priority;
+  if (!txQueue.peek(request, priority))
+  {
+    // nothing more to go with the frames gathered
+    if (transport != NULL)
+      flushFrames();
+    return false;
+  }
+
+  // pings are dropped when the budget is low, a later one replaces them, everything else waits for it
+  // frames gathered but not sent yet aren't charged, so they count against the budget as well
+  uint32_t gatheredMicros = transport != NULL && txAggregate.count() > 0 ? transport->airtimeMicros(txAggregate.length()) : 0;
+  if (transport != NULL && !transport->isEspNow() && !airtimeBudget.allows(priority, gatheredMicros + txAirtimeMicros(request), millis()))
+  {
+    if (priority != TxPing)
+    {
+      airtimeBudget.deferred++;
+      flushFrames();
+      return false;
+    }
+    log_d("airtime budget low, dropping ping");
+    airtimeBudget.dropped++;
+    txQueue.pop(request, priority, millis());
+    return true;
+  }
+
+  txQueue.pop(request, priority, millis());
+
+  log_d("tx priority %d after %lu ms in queue", priority, millis() - request.queuedMillis);
+
+  if (transport == NULL)
+    return true;
+
+  if (request.kind == TxFrame)
+  {
+    int result = transmitFrame(request.data, request.length, NoPendingSend, false, 0);
+    if (result != 0)
+      log_e("error sending queued %s frame: %d", transport->name(), result);
+    return true;
+  }
+
+  // the UI task adds it to the history once sent, or with the reason if it can't be
+  if (!sendMessage(request.sender, request.channel, (const char *)request.data, request.length) && request.channel != PING_CHANNEL)
+  {
+    PendingSend failed;
+    failed.message.channel = request.channel;
+    failed.message.deliveryState = NotTracked;
+    failed.message.username[0] = '\0';
+    failed.message.isEspNow = transport->isEspNow();
+    failed.message.rssi = 0;
+    failed.isFailed = true;
+    std::lock_guard<std::mutex> lock(ackMutex);
+    reportSend(failed);
+  }
+  return true;
+}
+
+DeliveryState getDeliveryState(const UnackedMessage &message)
+{
+  if (!message.isDone)
+    return Sending;
+  if (message.ackCount >= message.expectedAcks)
+    return Delivered;
+  return message.ackCount > 0 ? PartlyDelivered : NotDelivered;
+}
+
+// shows the state of an unacked message on its history entry, the worst of its fragments once all of
+// them are done, then releases them, call with ackMutex held
+void updateDeliveryState(UnackedMessage &message)
+{
+  if (!message.hasHistoryId)
+    return; // not in the history yet, see processQueuedMessages()
+
+  uint8_t channel = message.channel;
+  uint16_t firstSequence = message.firstSequence;
+  auto isSameMessage = [&](const UnackedMessage &fragment) {
+    return fragment.channel == channel && fragment.firstSequence == firstSequence;
+  };
+
+  bool isDone = true;
+  uint8_t state = Delivered;
+  ackTracker.forEach([&](UnackedMessage &fragment) {
+    if (!isSameMessage(fragment))
+      return;
+    if (fragment.isDone)
+      state = std::max(state, (uint8_t)getDeliveryState(fragment));
+    else
+      isDone = false;
+  });
+  if (!isDone)
+    state = Sending;
+
+  HistoryEntry *entry = chatTab[channel].history.find(message.historyId);
+  if (entry != NULL && entry->deliveryState != state)
+  {
+    entry->deliveryState = state;
+    receivedMessage = true;
+  }
+
+  if (isDone)
+  {
+    ackTracker.forEach([&](UnackedMessage &fragment) {
+      if (isSameMessage(fragment))
+        ackTracker.release(fragment);
+    });
+  }
+}
+
+// queues an ack for a frame that asked for one, sent with our next frame or a ping once due
+void queueAck(uint16_t senderHash, uint16_t sequence, bool isEspNow)
+{
+  const AckTiming &timing = isEspNow ? EspNowAckTiming : LoRaAckTiming;
+  unsigned long due = millis() + random(timing.minAckDelayMillis, timing.maxAckDelayMillis + 1);
+  std::lock_guard<std::mutex> lock(ackMutex);
+  pendingAcks.add(senderHash, sequence, due);
+}
+
+// acks in a received frame addressed to us, the frame's sender is the peer that acked
+void processAcks(const FrameView &frame, uint16_t ownHash, bool isEspNow)
+{
+  Presence *peer = presence.find(frame.senderHash, isEspNow);
+  std::lock_guard<std::mutex> lock(ackMutex);
+
+  for (uint8_t i = 0; i < frame.ackCount; i++)
+  {
+    uint16_t ackedHash, ackedSequence;
+    readFrameAck(frame, i, ackedHash, ackedSequence);
+    if (ackedHash != ownHash)
+      continue;
+
+    uint32_t rttMillis;
+    UnackedMessage *message = ackTracker.acknowledge(ackedSequence, frame.senderHash, millis(), rttMillis);
+    if (message == NULL)
+      continue;
+
+    log_d("ack for %d from %04x, rtt %u ms", ackedSequence, frame.senderHash, rttMillis);
+    if (rttMillis > 0 && peer != NULL)
+      peer->rtt.sample(rttMillis);
+    updateDeliveryState(*message);
+  }
+}
+
+// adds the message to its channel's history and log, UI task only
+const HistoryEntry *appendToHistory(const Message &message)
+{
+  ChatTab &tab = chatTab[message.channel];
+  const HistoryEntry *entry = tab.history.append(message);
+  if (entry != NULL && tab.log.isOpen() && !tab.log.append(message))
+    log_e("chat log %c closed, write failed", 'A' + tab.channel);
+  return entry;
+}
+
+void receiveMessage(const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow)
+{
+  // several frames sent as one, each is received as if it came on its own
+  if (isAggregateFrame(frameData, frameDataLength))
+  {
+    bool isValid = forEachAggregatedFrame(frameData, frameDataLength, [&](const uint8_t *innerData, size_t innerLength) {
+      receiveMessage(innerData, innerLength, rssi, isEspNow);
+    });
+    if (!isValid)
+      log_w("dropping malformed aggregate frame");
+    return;
+  }
+
+  // drop frames seen before (retransmits, relays) before spending anything on them
+  // a copy heard while waiting to relay means a neighbour already relayed it
+  uint16_t senderHash = 0, sequence = 0;
+  bool hasSequence = peekFrameSequence(frameData, frameDataLength, senderHash, sequence);
+  if (hasSequence && duplicateFilter.isDuplicate(senderHash, isEspNow, sequence))
+  {
+    if (relayQueue.cancel(senderHash, sequence))
+      log_d("relay of %04x:%d cancelled, overheard", senderHash, sequence);
+    // a retransmit from the sender (not a relay) means our ack was lost, v2 flags are the third byte
+    if ((frameData[2] & FrameFlags::AckRequest) && !(frameData[2] & FrameFlags::Relayed))
+      queueAck(senderHash, sequence, isEspNow);
+    log_d("dropping duplicate frame %04x:%d", senderHash, sequence);
+    return;
+  }
+
+  // our own frames relayed back to us
+  uint16_t ownHash = usernameHash(username.c_str(), username.length());
+  if (hasSequence && senderHash == ownHash)
+    return;
+
+  log_d("received frame: %s", getHexString(frameData, frameDataLength).c_str());
+
+  FrameView frame;
+  char textBuffer[MaxMessageLength];
+  if (!decodeFrame(frameData, frameDataLength, frame) || !decompressFrameText(frame, textBuffer, sizeof(textBuffer)))
+  {
+    log_w("dropping malformed frame");
+    return;
+  }
+  log_d("parsed frame: v%d|%d|%d|%02x|%04x|%.*s|", frame.version, frame.channel, frame.nonce, frame.flags, frame.senderHash, frame.textLength, frame.text);
+
+  lastRx = millis();
+  if (uiRefresh != NULL)
+    uiRefresh();
+
+  if (relayMode && hasSequence && frame.hopsLeft > 0)
+  {
+    unsigned long relayDelay = relayDelayMillis(rssi, isEspNow ? EspNowRelayWindowMillis : LoRaRelayWindowMillis);
+    relayQueue.schedule(frameData, frameDataLength, senderHash, sequence, millis() + relayDelay);
+  }
+
+  if ((frame.flags & FrameFlags::NameRequest) && frame.requestedHash == ownHash)
+  {
+    log_w("full name requested");
+    fullNameRequested = true;
+  }
+
+  // a new neighbour, answer (unless we just sent a frame it heard) and beacon at the base interval for a while
+  // another node's ping answers in our place, see ResponseScheduler
+  unsigned long responseWindowMillis = isEspNow ? EspNowResponseWindowMillis : LoRaResponseWindowMillis;
+  if (recordPresence(frame, rssi, isEspNow))
+  {
+    beacon.reset(millis());
+    if (millis() - lastOwnFrameMillis > responseWindowMillis)
+      responsePing.schedule(frame.senderHash, millis(), responseWindowMillis);
+  }
+  else if (frame.channel == PING_CHANNEL && frame.textLength == 0)
+  {
+    responsePing.overhear(frame.senderHash);
+  }
+
+  if (frame.flags & FrameFlags::Ack)
+    processAcks(frame, ownHash, isEspNow);
+
+  if (frame.textLength == 0 || frame.channel >= ChatTabCount)
+    return;
+
+  if (hasSequence && (frame.flags & FrameFlags::AckRequest))
+    queueAck(frame.senderHash, frame.sequence, isEspNow);
+
+  Message message;
+  message.sequence = frame.sequence;
+  message.channel = frame.channel;
+  message.deliveryState = NotTracked;
+  copyToBuffer(message.username, sizeof(message.username), frame.username, frame.usernameLength);
+
+  if (frame.flags & FrameFlags::Fragment)
+  {
+    // shown once every fragment arrived, known by the first fragment's sequence number
+    size_t textLength;
+    unsigned long timeoutMillis = isEspNow ? EspNowReassemblyTimeoutMillis : LoRaReassemblyTimeoutMillis;
+    if (!reassembler.add(frame, isEspNow, millis(), timeoutMillis, message.text, sizeof(message.text) - 1, textLength))
+      return;
+    message.text[textLength] = '\0';
+    message.sequence = (frame.sequence - frame.fragmentIndex) & SequenceMask;
+  }
+  else
+  {
+    copyToBuffer(message.text, sizeof(message.text), frame.text, frame.textLength);
+  }
+
+  message.isEspNow = isEspNow;
+  message.rssi = rssi;
+  appendToHistory(message);
+  receivedMessage = true;
+}
+
+// producer side, no parsing or allocation so it is safe from the WiFi callback
+// LoRa and ESP-NOW frames go to separate queues, each has a single producer
+bool queueReceivedFrame(const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow)
+{
+  if (frameDataLength > MAX_FRAME_LENGTH)
+    return false;
+
+  SpscQueue<ReceivedFrame, RxQueueCapacity> &queue = isEspNow ? espNowRxQueue : loraRxQueue;
+  ReceivedFrame *receivedFrame = queue.beginPush();
+  if (receivedFrame == NULL)
+    return false;
+
+  memcpy(receivedFrame->data, frameData, frameDataLength);
+  receivedFrame->length = frameDataLength;
+  receivedFrame->rssi = rssi;
+  receivedFrame->isEspNow = isEspNow;
+  queue.commitPush();
+  if (uiWake != NULL)
+    uiWake();
+  return true;
+}
+
+size_t processReceiveQueue(SpscQueue<ReceivedFrame, RxQueueCapacity> &queue)
+{
+  size_t processed = 0;
+  ReceivedFrame *receivedFrame;
+  while ((receivedFrame = queue.front()) != NULL)
+  {
+    receiveMessage(receivedFrame->data, receivedFrame->length, receivedFrame->rssi, receivedFrame->isEspNow);
+    queue.commitPop();
+    processed++;
+  }
+  return processed;
+}
+
+// once a sent message is in the history: every active user on the transport should ack it, up to
+// MaxAckPeers, and the timeout is the slowest of theirs
+void expectAcks(const HistoryEntry &entry, bool isEspNow)
+{
+  const AckTiming &timing = isEspNow ? EspNowAckTiming : LoRaAckTiming;
+  uint8_t peers = 0;
+  uint32_t rtoMillis = 0;
+  presence.expire(millis());
+  presence.forEachByRecency([&](const Presence &user) {
+    if (!user.isActive)
+      return false;
+    if (user.isEspNow == isEspNow && peers < MaxAckPeers)
+    {
+      peers++;
+      rtoMillis = std::max(rtoMillis, user.rtt.rto(timing));
+    }
+    return true;
+  });
+
+  // every fragment of the message, the entry's sequence number is its first
+  std::lock_guard<std::mutex> lock(ackMutex);
+  UnackedMessage *first = NULL;
+  ackTracker.forEach([&](UnackedMessage &message) {
+    if (message.channel != entry.channel || message.firstSequence != entry.sequence)
+      return;
+
+    message.historyId = entry.id;
+    message.hasHistoryId = true;
+    ackTracker.expect(message, std::max((uint8_t)1, peers), peers > 0 ? rtoMillis : timing.initialRtoMillis, millis());
+    first = &message;
+  });
+
+  if (first != NULL)
+    updateDeliveryState(*first);
+}
+
+// retransmits unacked frames and sends a ping for acks nobody else carried in time
+void pollAcks()
+{
+  bool isAckPingDue;
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    ackTracker.poll(
+        millis(),
+        [](UnackedMessage &message) {
+          if (transport == NULL)
+            return;
+          log_w("retransmitting %d, try %d", message.sequence, message.retransmits);
+          if (!queueFrame(message.frameData, message.frameDataLength))
+            log_w("tx queue full, retransmit of %d skipped", message.sequence);
+        },
+        [](UnackedMessage &message) {
+          log_w("%d not acked by every peer, %d of %d", message.sequence, message.ackCount, message.expectedAcks);
+          updateDeliveryState(message);
+        });
+    isAckPingDue = pendingAcks.isDue(millis());
+  }
+
+  // a ping to carry the acks, unless a frame that takes them is already queued
+  if (isAckPingDue && txQueue.size(TxChat) == 0)
+    queuePing(TxAck);
+}
+
+// presence beacons instead of pings at a fixed interval, see beacon.h
+void pollBeacon()
+{
+  unsigned long now = millis();
+  unsigned long baseMillis = transport->isEspNow() ? ESP_NOW_PING_INTERVAL_MS : LORA_PING_INTERVAL_MS;
+  if (beacon.base() != baseMillis)
+    beacon.begin(baseMillis, now); // transport changed, announce ourselves on it
+
+  presence.expire(now);
+  beacon.setNeighbours(presence.activeCount(transport->isEspNow()));
+  presence.setTimeout(std::max((unsigned long)PRESENCE_TIMEOUT_MS, beacon.presenceTimeoutMillis()));
+
+  if (beacon.poll(now, lastOwnFrameMillis) && pingMode)
+    queuePing(TxPing);
+
+  if (responsePing.poll(now, lastOwnFrameMillis))
+  {
+    log_w("new presence, sending response ping");
+    queuePing(TxPing);
+  }
+}
+
+// consumer side, called from the UI task, sets receivedMessage if there is anything new to draw
+size_t processQueuedMessages()
+{
+  size_t processed = processReceiveQueue(loraRxQueue) + processReceiveQueue(espNowRxQueue);
+
+  if (transport != NULL)
+  {
+    // a relay left in its queue is retried next time, or cancelled if overheard meanwhile
+    relayQueue.poll(millis(), [](const uint8_t *frameData, size_t frameDataLength) {
+      return queueFrame(frameData, frameDataLength);
+    });
+  }
+
+  // read back from a chat log, dropped if the history changed at its oldest end since the request
+  LoadedMessage loaded;
+  while (loadedMessageQueue.pop(loaded))
+  {
+    ChatTab &tab = chatTab[loaded.message.channel];
+    if (loaded.record + 1 + tab.history.size() == tab.log.size() && tab.history.prepend(loaded.message) != NULL)
+    {
+      tab.layout.reindex();
+      receivedMessage = true;
+      processed++;
+    }
+  }
+
+  Message sentMessage;
+  while (sentMessageQueue.pop(sentMessage))
+  {
+    const HistoryEntry *entry = appendToHistory(sentMessage);
+    if (entry != NULL && sentMessage.deliveryState == Sending)
+      expectAcks(*entry, sentMessage.isEspNow);
+    receivedMessage = true;
+    processed++;
+  }
+
+  if (transport != NULL)
+  {
+    pollAcks();
+    pollBeacon();
+  }
+
+  return processed;
+}
+
+const unsigned long MinProcessWaitMillis = 10; // an ack ping can stay due while chat is queued to carry the acks
+
+// how long the UI task may sleep before processQueuedMessages() has a relay, retransmit, ack or beacon
+// due, at most maxMillis, anything that arrives meanwhile wakes it through uiWake
+unsigned long processWaitMillis(unsigned long now, unsigned long maxMillis)
+{
+  if (transport == NULL)
+    return maxMillis;
+
+  unsigned long waitMillis = maxMillis;
+  auto waitFor = [&](unsigned long dueMillis) {
+    long untilDue = (long)(dueMillis - now);
+    waitMillis = std::min(waitMillis, (unsigned long)std::max(untilDue, (long)MinProcessWaitMillis));
+  };
+
+  unsigned long dueMillis = 0;
+  if (relayQueue.nextDue(dueMillis))
+    waitFor(dueMillis);
+  if (responsePing.pending())
+    waitFor(responsePing.due());
+  if (beacon.base() != 0)
+    waitFor(beacon.nextDue());
+  {
+    std::lock_guard<std::mutex> lock(ackMutex);
+    if (ackTracker.nextDue(dueMillis))
+      waitFor(dueMillis);
+    if (pendingAcks.size() > 0)
+      waitFor(pendingAcks.due());
+  }
+  return waitMillis;
+}
+
+void initChatTabs()
+{
+  messageSequence = random(0, SequenceMask + 1);
+
+  for (uint8_t i = 0; i < ChatTabCount; i++)
+  {
+    chatTab[i].channel = i;
+    chatTab[i].history.init(ChatTabHistoryMessages[i], ChatTabHistoryArenaBytes[i]);
+    chatTab[i].layout.init(ChatTabHistoryMessages[i]);
+    chatTab[i].messageBuffer = "";
+    chatTab[i].viewIndex = 0;
+  }
+}
+
+// reads up to count messages older than the history's oldest back from the log, returns how many were added
+// the history doesn't evict for them, so scrolling back stops at its capacity
+size_t loadOlderMessages(ChatTab &tab, size_t count)
+{
+  size_t loaded = 0;
+  Message message;
+  while (loaded < count && tab.log.size() > tab.history.size() && tab.history.size() < tab.history.capacity())
+  {
+    uint32_t record = tab.log.size() - tab.history.size() - 1;
+    if (!tab.log.read(record, tab.channel, message) || tab.history.prepend(message) == NULL)
+      break;
+    loaded++;
+  }
+
+  if (loaded > 0)
+    tab.layout.reindex();
+  return loaded;
+}
+
+// UI task: asks the storage task for the page before the history's oldest message, without waiting for the card
+void requestOlderMessages(ChatTab &tab)
+{
+  if (isLogLoading || !tab.log.isOpen() || tab.log.size() <= tab.history.size() || tab.history.size() >= tab.history.capacity())
+    return;
+
+  LogLoadRequest request;
+  request.channel = tab.channel;
+  request.newestRecord = tab.log.size() - tab.history.size() - 1;
+  request.count = ChatLogPageMessages;
+  isLogLoading = true;
+  if (!logLoadQueue.push(request))
+    isLogLoading = false;
+  else if (storageWake != NULL)
+    storageWake();
+}
+
+// storage task: writes out the queue when due and serves log reads, returns true if it did either
+// a read first flushes the queue, so it sees every record appended before the request
+bool processStorage(unsigned long now)
+{
+  if (storage == NULL)
+    return false;
+
+  LogLoadRequest request;
+  bool hasRequest = logLoadQueue.pop(request);
+  bool isFlushed = (hasRequest || storageQueue.isFlushDue(now)) && storageQueue.flush(*storage) > 0;
+  if (!hasRequest)
+    return isFlushed;
+
+  ChatTab &tab = chatTab[request.channel];
+  for (uint8_t i = 0; i < request.count && i <= request.newestRecord; i++)
+  {
+    LoadedMessage *loaded = loadedMessageQueue.beginPush();
+    if (loaded == NULL)
+      break;
+    loaded->record = request.newestRecord - i;
+    if (!tab.log.read(loaded->record, request.channel, loaded->message))
+      break;
+    loadedMessageQueue.commitPush();
+  }
+  isLogLoading = false;
+  if (uiWake != NULL)
+    uiWake();
+  return true;
+}
+
+// picks up a channel's log at boot, only the last screenful is read now and the rest as the user scrolls back
+bool beginChatLog(uint8_t channel, LogFile *log, LogFile *index)
+{
+  ChatTab &tab = chatTab[channel];
+  if (!tab.log.begin(log, index))
+    return false;
+
+  // records indexed by begin() are still queued
+  if (storage != NULL)
+    storageQueue.flush(*storage);
+
+  tab.history.clear();
+  loadOlderMessages(tab, ChatLogPageMessages);
+  return true;
+}
+
+size_t chatHistoryMemoryBytes()
+{
+  size_t bytes = 0;
+  for (uint8_t i = 0; i < ChatTabCount; i++)
+    bytes += chatTab[i].history.memoryBytes();
+  return bytes;
+}
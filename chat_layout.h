@@ -0,0 +1,274 @@
+#pragma once
+
+// line wrapping for the chat window, results are cached per message and only recomputed when
+// the line width changes (font or window size), so a redraw only touches the visible lines
+//
+// each cached layout also records the running line count of the messages before it (a prefix sum),
+// so the message holding any scroll position is found with a binary search. The index is extended
+// as messages arrive and only rebuilt when the width or mode (LoRa/ESP-NOW) changes.
+
+#include <Arduino.h>
+
+#include "message_history.h"
+
+const uint8_t MaxCachedLines = 8;  // longer messages cache their line count and re-wrap when drawn
+const uint8_t MaxMessageLines = 64; // upper bound on lines per message when drawing
+
+struct MessageLayout
+{
+  uint32_t id;         // history entry the layout belongs to
+  uint32_t generation; // layout generation it was computed for, 0 is never current
+  uint8_t lineCount;
+  uint32_t firstLine; // lines in earlier messages shown in the same mode, see MessageLayoutCache::index()
+  uint16_t lineStarts[MaxCachedLines]; // offsets into the text, lines end where the next one starts
+};
+
+// greedy word wrap, no allocation. The first line is firstLineWidth chars wide (room for the username),
+// the rest lineWidth. Words longer than a line are broken. Stores up to maxLines line starts and
+// returns the total line count.
+uint8_t wrapText(const char *text, uint16_t textLength, uint8_t firstLineWidth, uint8_t lineWidth, uint16_t *lineStarts, uint8_t maxLines)
+{
+  uint8_t lineCount = 0;
+  uint16_t i = 0;
+
+  while (i < textLength && lineCount < 255)
+  {
+    // lines start at the next non-space char
+    while (i < textLength && isspace((uint8_t)text[i]))
+      i++;
+    if (i == textLength)
+      break;
+
+    uint8_t width = lineCount == 0 ? firstLineWidth : lineWidth;
+    if (width == 0)
+      width = 1;
+
+    if (lineCount < maxLines)
+      lineStarts[lineCount] = i;
+    lineCount++;
+
+    uint16_t lineStart = i;
+    uint16_t lineEnd = i; // end of last whole word that fits
+
+    while (i < textLength)
+    {
+      uint16_t wordStart = i;
+      while (i < textLength && !isspace((uint8_t)text[i]))
+        i++;
+
+      if (i - lineStart <= width)
+      {
+        lineEnd = i;
+        while (i < textLength && isspace((uint8_t)text[i]))
+          i++;
+        continue;
+      }
+
+      if (lineEnd == lineStart)
+      {
+        // a single word wider than the line, break it
+        i = lineStart + width;
+      }
+      else
+      {
+        i = wordStart;
+      }
+      break;
+    }
+  }
+
+  return lineCount;
+}
+
+// length of a wrapped line with trailing whitespace dropped
+uint16_t lineLength(const char *text, uint16_t lineStart, uint16_t lineEnd)
+{
+  while (lineEnd > lineStart && isspace((uint8_t)text[lineEnd - 1]))
+    lineEnd--;
+  return lineEnd - lineStart;
+}
+
+class MessageLayoutCache
+{
+public:
+  ~MessageLayoutCache() { delete[] layouts; }
+
+  // one slot per history entry, ids of live entries never share a slot
+  bool init(uint16_t historyCapacity)
+  {
+    if (layouts != NULL)
+      return false;
+
+    layouts = new MessageLayout[historyCapacity];
+    capacity = historyCapacity;
+    for (uint16_t i = 0; i < capacity; i++)
+      layouts[i].generation = 0;
+    return true;
+  }
+
+  // returns true if the layout changed and cached wraps were dropped
+  bool setLineWidth(uint8_t width)
+  {
+    if (width == lineWidth)
+      return false;
+
+    lineWidth = width;
+    invalidate();
+    return true;
+  }
+
+  // drops every cached wrap in O(1), entries are re-wrapped as they are drawn
+  void invalidate() { generation++; }
+
+  // rebuilds the line index on the next index() keeping cached wraps, for entries prepended to the history
+  void reindex() { indexGeneration = 0; }
+
+  uint8_t getLineWidth() const { return lineWidth; }
+
+  // first line is shortened by the username tag on other users' messages
+  uint8_t firstLineWidth(const HistoryEntry &entry) const
+  {
+    size_t usernameLength = strlen(entry.username);
+    return usernameLength == 0 ? lineWidth : (lineWidth > usernameLength + 1 ? lineWidth - usernameLength - 1 : 1);
+  }
+
+  const MessageLayout &get(const MessageHistory &history, const HistoryEntry &entry) { return wrap(history, entry); }
+
+  // extends the line index to the newest entry, returns the number of lines added
+  uint32_t index(const MessageHistory &history, bool isEspNow)
+  {
+    bool rebuild = indexGeneration != generation || indexIsEspNow != isEspNow;
+    if (rebuild)
+    {
+      indexGeneration = generation;
+      indexIsEspNow = isEspNow;
+      totalLines = 0;
+      nextIndexId = 0;
+    }
+
+    if (history.isEmpty())
+      return 0;
+
+    uint32_t oldestId = history.at(0).id;
+    uint32_t newestId = history.newest().id;
+    if (nextIndexId < oldestId)
+      nextIndexId = oldestId;
+
+    uint32_t linesBefore = totalLines;
+    for (; nextIndexId <= newestId; nextIndexId++)
+    {
+      const HistoryEntry &entry = history.at(nextIndexId - oldestId);
+      MessageLayout &layout = wrap(history, entry);
+      layout.firstLine = totalLines;
+      if (entry.isEspNow == isEspNow)
+        totalLines += layout.lineCount;
+    }
+
+    return rebuild ? 0 : totalLines - linesBefore;
+  }
+
+  // lines in the history shown in the indexed mode, call index() first
+  uint32_t lineCount(const MessageHistory &history) const
+  {
+    return history.isEmpty() ? 0 : totalLines - layouts[history.at(0).id % capacity].firstLine;
+  }
+
+  // history position of the message holding line, counted from the oldest line in the history
+  size_t findLine(const MessageHistory &history, uint32_t line) const
+  {
+    uint32_t target = layouts[history.at(0).id % capacity].firstLine + line;
+
+    // last entry that starts at or before the line, entries with no lines share the next one's start
+    size_t low = 0;
+    size_t high = history.size();
+    while (high - low > 1)
+    {
+      size_t middle = (low + high) / 2;
+      if (layouts[history.at(middle).id % capacity].firstLine <= target)
+        low = middle;
+      else
+        high = middle;
+    }
+    return low;
+  }
+
+  uint32_t wraps() const { return wrapCount; }
+
+private:
+  MessageLayout &wrap(const MessageHistory &history, const HistoryEntry &entry)
+  {
+    MessageLayout &layout = layouts[entry.id % capacity];
+    if (layout.id != entry.id || layout.generation != generation)
+    {
+      layout.id = entry.id;
+      layout.generation = generation;
+      layout.lineCount = wrapText(history.text(entry), entry.textLength, firstLineWidth(entry), lineWidth, layout.lineStarts, MaxCachedLines);
+      wrapCount++;
+    }
+    return layout;
+  }
+
+  MessageLayout *layouts = NULL;
+  uint16_t capacity = 0;
+  uint32_t generation = 1;
+  uint8_t lineWidth = 0;
+  uint32_t wrapCount = 0;
+
+  // line index state
+  uint32_t indexGeneration = 0;
+  bool indexIsEspNow = false;
+  uint32_t nextIndexId = 0;
+  uint32_t totalLines = 0;
+};
+
+// walks the visible lines from the bottom of the window up, scrollLines above the newest line
+// drawLine(entry, lineIndex, line, lineLength, row) is called with row 0 at the bottom
+// cost depends on rowCount and not the history length, call cache.index() first
+template <typename DrawLine>
+int layoutVisibleLines(const MessageHistory &history, MessageLayoutCache &cache, bool isEspNow, int rowCount, uint32_t scrollLines, DrawLine drawLine)
+{
+  uint32_t totalLines = cache.lineCount(history);
+  if (totalLines == 0)
+    return 0;
+
+  uint32_t bottomLine = totalLines - 1 - std::min(scrollLines, totalLines - 1);
+  size_t bottomIndex = cache.findLine(history, bottomLine);
+  uint32_t oldestFirstLine = cache.get(history, history.at(0)).firstLine;
+  int linesDrawn = 0;
+
+  for (int i = bottomIndex; i >= 0 && linesDrawn < rowCount; i--)
+  {
+    const HistoryEntry &entry = history.at(i);
+
+    // show only messages that match the current mode
+    if (entry.isEspNow != isEspNow)
+      continue;
+
+    const char *text = history.text(entry);
+    const MessageLayout &layout = cache.get(history, entry);
+
+    const uint16_t *lineStarts = layout.lineStarts;
+    uint16_t wrappedStarts[MaxMessageLines];
+    uint8_t lineCount = layout.lineCount;
+    if (lineCount > MaxCachedLines)
+    {
+      lineCount = wrapText(text, entry.textLength, cache.firstLineWidth(entry), cache.getLineWidth(), wrappedStarts, MaxMessageLines);
+      lineCount = std::min(lineCount, MaxMessageLines);
+      lineStarts = wrappedStarts;
+    }
+
+    // the bottom message may be partly scrolled off the window
+    int lastLine = lineCount - 1;
+    if (i == (int)bottomIndex)
+      lastLine = std::min(lastLine, (int)(oldestFirstLine + bottomLine - layout.firstLine));
+
+    for (int j = lastLine; j >= 0 && linesDrawn < rowCount; j--)
+    {
+      uint16_t lineEnd = (j + 1 < lineCount) ? lineStarts[j + 1] : entry.textLength;
+      drawLine(entry, j, text + lineStarts[j], lineLength(text, lineStarts[j], lineEnd), linesDrawn);
+      linesDrawn++;
+    }
+  }
+
+  return linesDrawn;
+}
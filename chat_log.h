@@ -0,0 +1,241 @@
+#pragma once
+
+// chat history kept on the SD card, an append-only log per channel with an offset index beside it
+//
+// log record: |LogRecordMagic|flags|rssi:16|usernameLength:8|textLength:8|username|text|
+// index: |offset:32|offset:32|...|, one little endian offset into the log per record
+//
+// record k is found with one index read and one log read, so opening the log and loading the last
+// screenful cost the same whatever its length. The log is written before the index: after a reset
+// between the two, begin() indexes the records found past the last indexed one.
+//
+// the UI task appends while the storage task reads pages back, the record count and log size are
+// only touched under the log's lock so a read never sees a record whose index entry isn't counted.
+// Reads copy them under the lock and go to the card after, so an append never waits for the card.
+
+#include <Arduino.h>
+
+#include <mutex>
+
+#include "common.h"
+#include "storage.h"
+
+const uint8_t LogRecordMagic = 0xC5;
+const size_t LogRecordHeaderLength = 6;
+const size_t LogIndexEntryLength = 4;
+
+namespace LogRecordFlags
+{
+  const uint8_t EspNow = 0x01;
+}
+
+// an append-only file, on SD on the device and in memory on the host
+class LogFile
+{
+public:
+  virtual ~LogFile() {}
+  virtual size_t size() = 0;
+  virtual bool read(size_t offset, void *data, size_t length) = 0;
+  virtual bool append(const void *data, size_t length) = 0;
+};
+
+// log file behind the write-behind queue: appends are queued from any task, size and reads go to the card
+// and only happen on the storage task, or at boot before it starts
+class QueuedLogFile : public LogFile
+{
+public:
+  void begin(StorageSink *sink, WriteBehindQueue *queue, uint8_t file)
+  {
+    this->sink = sink;
+    this->queue = queue;
+    this->file = file;
+  }
+
+  size_t size() override { return sink->size(file); }
+  bool read(size_t offset, void *data, size_t length) override { return sink->read(file, offset, data, length); }
+  bool append(const void *data, size_t length) override { return queue->write(file, data, length, false, millis()); }
+
+private:
+  StorageSink *sink = NULL;
+  WriteBehindQueue *queue = NULL;
+  uint8_t file = 0;
+};
+
+class ChatLog
+{
+public:
+  // returns false if the files can't be used, the log stays closed
+  bool begin(LogFile *log, LogFile *index)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    close();
+    if (log == NULL || index == NULL)
+      return false;
+
+    this->log = log;
+    this->index = index;
+    recovered = 0;
+    logSize = log->size();
+    size_t indexSize = index->size();
+    recordCount = indexSize / LogIndexEntryLength;
+
+    // a torn index write, pad it to a whole entry that points nowhere so the next ones line up
+    if (indexSize % LogIndexEntryLength != 0)
+    {
+      uint8_t padding[LogIndexEntryLength] = {0xFF, 0xFF, 0xFF, 0xFF};
+      if (!index->append(padding, LogIndexEntryLength - indexSize % LogIndexEntryLength))
+        return closed();
+      recordCount++;
+    }
+
+    // index the records written after the last indexed one
+    size_t offset = 0;
+    if (recordCount > 0)
+    {
+      uint32_t lastOffset;
+      uint8_t header[LogRecordHeaderLength];
+      if (readOffset(index, recordCount - 1, lastOffset) && readHeader(log, logSize, lastOffset, header))
+        offset = lastOffset + recordLength(header);
+      else
+        offset = logSize; // can't tell where the last record ends, leave the rest unindexed
+    }
+    uint8_t header[LogRecordHeaderLength];
+    while (offset < logSize && readHeader(log, logSize, offset, header))
+    {
+      if (!appendOffset(offset))
+        return closed();
+      offset += recordLength(header);
+      recovered++;
+    }
+
+    return true;
+  }
+
+  void end()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    close();
+  }
+
+  bool isOpen()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return log != NULL;
+  }
+
+  uint32_t size()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recordCount;
+  }
+
+  uint32_t recoveredCount() const { return recovered; } // by the last begin()
+
+  // the log is closed if a write fails, so the records stay in step with the history
+  bool append(const Message &message)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (log == NULL)
+      return false;
+
+    size_t usernameLength = strnlen(message.username, MaxUsernameLength);
+    size_t textLength = strnlen(message.text, MaxMessageLength);
+    uint8_t record[LogRecordHeaderLength + MaxUsernameLength + MaxMessageLength];
+    record[0] = LogRecordMagic;
+    record[1] = message.isEspNow ? LogRecordFlags::EspNow : 0;
+    record[2] = (uint16_t)message.rssi & 0xFF;
+    record[3] = (uint16_t)message.rssi >> 8;
+    record[4] = usernameLength;
+    record[5] = textLength;
+    memcpy(record + LogRecordHeaderLength, message.username, usernameLength);
+    memcpy(record + LogRecordHeaderLength + usernameLength, message.text, textLength);
+
+    size_t length = LogRecordHeaderLength + usernameLength + textLength;
+    if (!log->append(record, length) || !appendOffset(logSize))
+      return closed();
+    logSize += length;
+    return true;
+  }
+
+  // record 0 is the oldest, returns false if it is unreadable
+  bool read(uint32_t record, uint8_t channel, Message &message)
+  {
+    LogFile *log, *index;
+    uint32_t recordCount;
+    size_t logSize;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      log = this->log;
+      index = this->index;
+      recordCount = this->recordCount;
+      logSize = this->logSize;
+    }
+
+    uint32_t offset;
+    uint8_t header[LogRecordHeaderLength];
+    if (log == NULL || record >= recordCount || !readOffset(index, record, offset) || !readHeader(log, logSize, offset, header))
+      return false;
+
+    size_t usernameLength = header[4];
+    size_t textLength = header[5];
+    if (!log->read(offset + LogRecordHeaderLength, message.username, usernameLength) ||
+        !log->read(offset + LogRecordHeaderLength + usernameLength, message.text, textLength))
+      return false;
+    message.username[usernameLength] = '\0';
+    message.text[textLength] = '\0';
+
+    message.sequence = 0;
+    message.channel = channel;
+    message.deliveryState = NotTracked; // acks aren't logged, only that the message was sent
+    message.isEspNow = header[1] & LogRecordFlags::EspNow;
+    message.rssi = (int16_t)(header[2] | header[3] << 8);
+    return true;
+  }
+
+private:
+  void close()
+  {
+    log = index = NULL;
+    recordCount = 0;
+    logSize = 0;
+  }
+
+  bool closed()
+  {
+    close();
+    return false;
+  }
+
+  static size_t recordLength(const uint8_t *header) { return LogRecordHeaderLength + header[4] + header[5]; }
+
+  static bool readHeader(LogFile *log, size_t logSize, size_t offset, uint8_t *header)
+  {
+    return offset + LogRecordHeaderLength <= logSize && log->read(offset, header, LogRecordHeaderLength) &&
+           header[0] == LogRecordMagic && header[4] <= MaxUsernameLength && offset + recordLength(header) <= logSize;
+  }
+
+  static bool readOffset(LogFile *index, uint32_t record, uint32_t &offset)
+  {
+    uint8_t entry[LogIndexEntryLength];
+    if (!index->read(record * LogIndexEntryLength, entry, LogIndexEntryLength))
+      return false;
+    offset = entry[0] | entry[1] << 8 | entry[2] << 16 | (uint32_t)entry[3] << 24;
+    return true;
+  }
+
+  bool appendOffset(uint32_t offset)
+  {
+    uint8_t entry[LogIndexEntryLength] = {(uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24)};
+    if (!index->append(entry, LogIndexEntryLength))
+      return false;
+    recordCount++;
+    return true;
+  }
+
+  std::mutex mutex;
+  LogFile *log = NULL;
+  LogFile *index = NULL;
+  uint32_t recordCount = 0;
+  size_t logSize = 0;
+  uint32_t recovered = 0;
+};
@@ -1,5 +1,9 @@
+#pragma once
+
 #include <Arduino.h>
 
+#include "frame.h"
+
 enum RedrawFlags
 {
   MainWindow = 0b001,
@@ -8,49 +12,52 @@ enum RedrawFlags
   None = 0b000
 };
 
-// TODO: refine message format
-struct Message
+// delivery of own messages sent in ack mode, see ack.h
+enum DeliveryState : uint8_t
 {
-  uint8_t nonce : 6;
-  uint8_t channel : 2; // 4 channels, 0b01,0b10,0b11 channels, 0b11 reserved for pings
-  String username;     // use MAC or something tied to device?
-  bool isEspNow;
-  int rssi;
-  String text;
+  NotTracked = 0,  // sent without an ack request, or received
+  Sending,         // waiting for acks
+  Delivered,       // acked by every expected peer
+  PartlyDelivered, // out of retransmits with some acks
+  NotDelivered     // out of retransmits with no acks
 };
 
-// track presence of other users
-struct Presence
+// message in flight between tasks, fixed size so handing one over never allocates
+struct Message
 {
-  String username;
+  uint16_t sequence : 14;               // sender's sequence number, the frame nonce is the low 6 bits
+  uint16_t channel : 2;                 // 4 channels, 0b01,0b10,0b11 channels, 0b11 reserved for pings
+  uint8_t deliveryState;
+  char username[MaxUsernameLength + 1]; // empty for own messages
   bool isEspNow;
   int rssi;
-  unsigned long lastSeenMillis;
+  char text[MaxMessageLength + 1];
 };
-std::vector<Presence> presence;
 
-struct ChatTab
+inline void copyToBuffer(char *dest, size_t destSize, const char *src, size_t srcLength)
 {
-  unsigned char channel;
-  // TODO: access in thread-safe way
-  std::vector<Message> messages;
-  String messageBuffer;
-  int viewIndex;
-};
+  srcLength = std::min(srcLength, destSize - 1);
+  memcpy(dest, src, srcLength);
+  dest[srcLength] = '\0';
+}
 
 enum Settings
 {
   Username = 0,
   Brightness = 1,
   PingMode = 2,
-  RepeatMode = 3,
-  EspNowMode = 4,
-  WriteConfig = 5,
-  LoRaSettings = 6
+  RelayMode = 3,
+  AckMode = 4,
+  EspNowMode = 5,
+  Compression = 6,
+  DutyCycle = 7,
+  WriteConfig = 8,
+  LoRaSettings = 9,
+  BootTimes = 10
 };
 
-const int SettingsCount = 7;
-const String SettingsNames[SettingsCount] = {"Username", "Brightness", "Ping Mode", "Repeat Mode", "ESP-NOW Mode", "App Config", "LoRa Config"};
+const int SettingsCount = 11;
+const String SettingsNames[SettingsCount] = {"Username", "Brightness", "Ping Mode", "Relay Mode", "ACK Mode", "ESP-NOW Mode", "Compression", "Duty Cycle", "App Config", "LoRa Config", "Boot Times"};
 const String SettingsFilename = "/LoRaChat.conf";
 
 // hack
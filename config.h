@@ -0,0 +1,201 @@
+#pragma once
+
+// app settings, kept as a small binary blob in NVS and read at boot without touching the SD card
+//
+// blob: |ConfigVersion|length|username[9]|brightness|dutyCyclePercent|flags|
+//
+// fields are only ever added at the end. A blob from an older version keeps the defaults for the fields
+// it lacks, one from a newer version is read up to the fields this one knows. The SD card text file
+// (name=value per line) is only imported when NVS holds no settings, and exported on save.
+
+#include <Arduino.h>
+
+#include "airtime_budget.h"
+#include "common.h"
+
+const char *const PreferencesNamespace = "lorachat";
+const char *const ConfigKey = "config";
+const uint8_t ConfigVersion = 1;
+const size_t ConfigBlobHeaderLength = 2;
+const size_t ConfigBlobLength = ConfigBlobHeaderLength + MaxUsernameLength + 1 + 3;
+const size_t MaxConfigLineLength = 64; // longer lines are ignored
+
+namespace ConfigFlags
+{
+  const uint8_t PingMode = 0x01;
+  const uint8_t RelayMode = 0x02;
+  const uint8_t AckMode = 0x04;
+  const uint8_t EspNowMode = 0x08;
+  const uint8_t Compression = 0x10;
+}
+
+struct Config
+{
+  char username[MaxUsernameLength + 1] = "user";
+  uint8_t brightness = 70;
+  uint8_t dutyCyclePercent = DefaultDutyCyclePercent;
+  uint8_t flags = ConfigFlags::PingMode | ConfigFlags::Compression;
+
+  bool has(uint8_t flag) const { return flags & flag; }
+  void set(uint8_t flag, bool isOn) { flags = isOn ? flags | flag : flags & ~flag; }
+};
+
+size_t packConfig(const Config &config, uint8_t *blob)
+{
+  blob[0] = ConfigVersion;
+  blob[1] = ConfigBlobLength;
+  memcpy(blob + ConfigBlobHeaderLength, config.username, MaxUsernameLength + 1);
+  blob[ConfigBlobHeaderLength + MaxUsernameLength + 1] = config.brightness;
+  blob[ConfigBlobHeaderLength + MaxUsernameLength + 2] = config.dutyCyclePercent;
+  blob[ConfigBlobHeaderLength + MaxUsernameLength + 3] = config.flags;
+  return ConfigBlobLength;
+}
+
+// false if the blob isn't a config blob, config is left as it was
+bool unpackConfig(const uint8_t *blob, size_t length, Config &config)
+{
+  if (length < ConfigBlobHeaderLength || blob[0] == 0 || blob[1] != length)
+    return false;
+
+  Config unpacked;
+  size_t offset = ConfigBlobHeaderLength;
+  if (length >= offset + MaxUsernameLength + 1)
+    copyToBuffer(unpacked.username, sizeof(unpacked.username), (const char *)blob + offset, strnlen((const char *)blob + offset, MaxUsernameLength));
+  offset += MaxUsernameLength + 1;
+  if (length > offset)
+    unpacked.brightness = blob[offset];
+  if (length > offset + 1)
+    unpacked.dutyCyclePercent = std::max(1, std::min(100, (int)blob[offset + 1]));
+  if (length > offset + 2)
+    unpacked.flags = blob[offset + 2];
+
+  config = unpacked;
+  return true;
+}
+
+// --- text file, parsed in place with no allocation
+
+// bounds of s with surrounding whitespace dropped
+inline void trimSpan(const char *&s, size_t &length)
+{
+  while (length > 0 && isspace((uint8_t)*s))
+  {
+    s++;
+    length--;
+  }
+  while (length > 0 && isspace((uint8_t)s[length - 1]))
+    length--;
+}
+
+inline bool spanEquals(const char *s, size_t length, const char *word)
+{
+  return strlen(word) == length && strncasecmp(s, word, length) == 0;
+}
+
+inline bool spanIsOn(const char *s, size_t length)
+{
+  return spanEquals(s, length, "on") || spanEquals(s, length, "true") || spanEquals(s, length, "1");
+}
+
+inline int spanToInt(const char *s, size_t length)
+{
+  int value = 0;
+  for (size_t i = 0; i < length && isdigit((uint8_t)s[i]); i++)
+    value = value * 10 + (s[i] - '0');
+  return value;
+}
+
+// name=value, names and on/off values in any case, returns false if the line sets nothing
+bool parseConfigLine(const char *line, size_t length, Config &config)
+{
+  const char *equals = (const char *)memchr(line, '=', length);
+  if (equals == NULL)
+    return false;
+
+  const char *name = line;
+  size_t nameLength = equals - line;
+  const char *value = equals + 1;
+  size_t valueLength = length - nameLength - 1;
+  trimSpan(name, nameLength);
+  trimSpan(value, valueLength);
+
+  if (spanEquals(name, nameLength, "username"))
+  {
+    copyToBuffer(config.username, sizeof(config.username), value, valueLength);
+    for (char *c = config.username; *c; c++)
+      *c = tolower(*c); // as the old reader did
+  }
+  else if (spanEquals(name, nameLength, "brightness"))
+    config.brightness = std::min(255, spanToInt(value, valueLength));
+  else if (spanEquals(name, nameLength, "pingmode"))
+    config.set(ConfigFlags::PingMode, spanIsOn(value, valueLength));
+  else if (spanEquals(name, nameLength, "relaymode") || spanEquals(name, nameLength, "repeatmode")) // repeat mode was the old name
+    config.set(ConfigFlags::RelayMode, spanIsOn(value, valueLength));
+  else if (spanEquals(name, nameLength, "ackmode"))
+    config.set(ConfigFlags::AckMode, spanIsOn(value, valueLength));
+  else if (spanEquals(name, nameLength, "espnowmode"))
+    config.set(ConfigFlags::EspNowMode, spanIsOn(value, valueLength));
+  else if (spanEquals(name, nameLength, "compression"))
+    config.set(ConfigFlags::Compression, spanIsOn(value, valueLength));
+  else if (spanEquals(name, nameLength, "dutycycle"))
+    config.dutyCyclePercent = spanEquals(value, valueLength, "off") ? 100 : std::max(1, std::min(100, spanToInt(value, valueLength)));
+  else
+    return false;
+  return true;
+}
+
+// feeds a file through in chunks of any size, holding one line at a time
+class ConfigParser
+{
+public:
+  // returns the number of settings read
+  size_t feed(const char *data, size_t length, Config &config)
+  {
+    size_t settings = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      if (data[i] == '\n')
+      {
+        settings += finishLine(config);
+        continue;
+      }
+      if (lineLength < MaxConfigLineLength)
+        line[lineLength] = data[i];
+      lineLength++;
+    }
+    return settings;
+  }
+
+  // the last line may not end in a newline
+  size_t finish(Config &config) { return finishLine(config); }
+
+private:
+  size_t finishLine(Config &config)
+  {
+    bool isSet = lineLength <= MaxConfigLineLength && parseConfigLine(line, lineLength, config);
+    lineLength = 0;
+    return isSet;
+  }
+
+  char line[MaxConfigLineLength];
+  size_t lineLength = 0;
+};
+
+// the text file, returns its length or 0 if it doesn't fit
+size_t formatConfig(const Config &config, char *text, size_t size)
+{
+  int length = snprintf(text, size,
+                        "username=%s\n"
+                        "brightness=%d\n"
+                        "pingMode=%s\n"
+                        "relayMode=%s\n"
+                        "ackMode=%s\n"
+                        "espNowMode=%s\n"
+                        "compression=%s\n"
+                        "dutyCycle=%d\n",
+                        config.username, config.brightness, config.has(ConfigFlags::PingMode) ? "on" : "off",
+                        config.has(ConfigFlags::RelayMode) ? "on" : "off", config.has(ConfigFlags::AckMode) ? "on" : "off",
+                        config.has(ConfigFlags::EspNowMode) ? "on" : "off", config.has(ConfigFlags::Compression) ? "on" : "off",
+                        config.dutyCyclePercent);
+  return length > 0 && (size_t)length < size ? length : 0;
+}
@@ -1,5 +1,7 @@
 #include <M5Cardputer.h>
 
+#include "airtime_budget.h"
+#include "common.h"
 #include "icon_bmp.h"
 
 // RBG565 colors
@@ -73,6 +75,42 @@ inline void draw_rssi_indicator(M5Canvas *canvas, int x, int y, int rssi, bool a
   : canvas->drawRect(barX, barY + (bar4 - bar4), barW, bar4, TFT_SILVER);
 }
 
+// vertical bar of the LoRa duty-cycle budget left, orange once pings are dropped, red once ack pings wait
+inline void draw_airtime_indicator(M5Canvas *canvas, int x, int y, int remainingPct)
+{
+  const int barw = 4;
+  const int barh = 11;
+  const int ya = y - barh / 2;
+
+  int fillh = (barh - 2) * remainingPct / 100;
+  uint16_t fillColor = remainingPct > BudgetReservePercent[TxPing] ? COLOR_TEAL : (remainingPct > BudgetReservePercent[TxAck] ? COLOR_ORANGE : TFT_RED);
+  canvas->drawRect(x - barw / 2, ya, barw, barh, TFT_SILVER);
+  canvas->fillRect(x - barw / 2 + 1, ya + 1 + (barh - 2 - fillh), barw - 2, fillh, fillColor);
+}
+
+// dot left of an own message: hollow while waiting for acks, filled when acked by everyone,
+// orange when only some acked, red when nobody did
+inline void draw_delivery_indicator(M5Canvas *canvas, int x, int y, uint8_t deliveryState)
+{
+  const int r = 2;
+
+  switch (deliveryState)
+  {
+  case DeliveryState::Sending:
+    canvas->drawCircle(x, y, r, TFT_SILVER);
+    break;
+  case DeliveryState::Delivered:
+    canvas->fillCircle(x, y, r, TFT_GREEN);
+    break;
+  case DeliveryState::PartlyDelivered:
+    canvas->fillCircle(x, y, r, UX_COLOR_ACCENT);
+    break;
+  case DeliveryState::NotDelivered:
+    canvas->fillCircle(x, y, r, TFT_RED);
+    break;
+  }
+}
+
 inline void draw_battery_indicator(M5Canvas *canvas, int x, int y, int batteryPct)
 {
   const int battw = 24;
@@ -0,0 +1,114 @@
+#pragma once
+
+// per-sender duplicate filter for received frames, checked before a frame is parsed
+//
+// each sender has a 64-bit window of the sequence numbers at and below the highest one seen from it.
+// Senders live in a fixed set associative table: a lookup checks the ways of one set, and a new sender
+// replaces the least recently used way, so time and memory stay constant however many peers are in range.
+
+#include <Arduino.h>
+
+#include "frame.h"
+
+const uint8_t DuplicateWindowBits = 64;
+const uint8_t DuplicateFilterSets = 16; // power of two
+const uint8_t DuplicateFilterWays = 4;
+
+class DuplicateFilter
+{
+public:
+  DuplicateFilter() { clear(); }
+
+  void clear()
+  {
+    memset(windows, 0, sizeof(windows));
+    useCounter = 0;
+    duplicateCount = 0;
+  }
+
+  // true if the sequence number was already seen from this sender, otherwise records it
+  bool isDuplicate(uint16_t senderHash, bool isEspNow, uint16_t sequence)
+  {
+    sequence &= SequenceMask;
+    SenderWindow &window = findWindow(senderHash, isEspNow);
+    window.lastUsed = ++useCounter;
+
+    if (!window.isUsed)
+    {
+      window.isUsed = true;
+      window.senderHash = senderHash;
+      window.isEspNow = isEspNow;
+      startWindow(window, sequence);
+      return false;
+    }
+
+    // sequence numbers wrap, anything up to half the space ahead counts as newer
+    uint16_t ahead = (sequence - window.highestSequence) & SequenceMask;
+    if (ahead != 0 && ahead < (SequenceMask + 1) / 2)
+    {
+      window.seen = ahead >= DuplicateWindowBits ? 1 : (window.seen << ahead) | 1;
+      window.highestSequence = sequence;
+      return false;
+    }
+
+    uint16_t behind = (window.highestSequence - sequence) & SequenceMask;
+    if (behind < DuplicateWindowBits)
+    {
+      uint64_t bit = (uint64_t)1 << behind;
+      if (window.seen & bit)
+      {
+        duplicateCount++;
+        return true;
+      }
+      window.seen |= bit;
+      return false;
+    }
+
+    // far behind the window, most likely the sender restarted
+    startWindow(window, sequence);
+    return false;
+  }
+
+  uint32_t duplicates() const { return duplicateCount; }
+
+private:
+  struct SenderWindow
+  {
+    uint64_t seen; // bit n set if highestSequence - n was received
+    uint32_t lastUsed;
+    uint16_t senderHash;
+    uint16_t highestSequence;
+    bool isEspNow;
+    bool isUsed;
+  };
+
+  // the sender's window, or the way it should replace
+  SenderWindow &findWindow(uint16_t senderHash, bool isEspNow)
+  {
+    SenderWindow *set = windows[(senderHash ^ (senderHash >> 8) ^ isEspNow) & (DuplicateFilterSets - 1)];
+    SenderWindow *victim = &set[0];
+
+    for (uint8_t i = 0; i < DuplicateFilterWays; i++)
+    {
+      SenderWindow &window = set[i];
+      if (window.isUsed && window.senderHash == senderHash && window.isEspNow == isEspNow)
+        return window;
+
+      if (!window.isUsed ? victim->isUsed : (victim->isUsed && window.lastUsed < victim->lastUsed))
+        victim = &window;
+    }
+
+    victim->isUsed = false;
+    return *victim;
+  }
+
+  void startWindow(SenderWindow &window, uint16_t sequence)
+  {
+    window.highestSequence = sequence;
+    window.seen = 1;
+  }
+
+  SenderWindow windows[DuplicateFilterSets][DuplicateFilterWays];
+  uint32_t useCounter;
+  uint32_t duplicateCount;
+};
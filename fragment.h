@@ -0,0 +1,161 @@
+#pragma once
+
+// messages too long for one frame are split into fragments, each a frame of its own
+//
+// fragments take consecutive sequence numbers, so duplicates, relays and acks work per fragment as for
+// any other frame, and the message is known by the sequence number of its first fragment. Each fragment
+// is filled with as much text as fits the transport's MTU after compression. Receivers collect
+// fragments in a few fixed slots, out of order, until the last one and every one before it arrived.
+// A slot that isn't complete before its timeout is dropped, the oldest slot is reused when all are busy.
+
+#include <Arduino.h>
+
+#include "frame.h"
+
+const uint8_t ReassemblyCapacity = 4;
+const uint8_t MinFragmentTextLength = 8; // room kept for text when adding optional header fields
+
+// longest fragment wait, LoRa fragments are paced by airtime and may be retransmitted
+const unsigned long LoRaReassemblyTimeoutMillis = 30000;
+const unsigned long EspNowReassemblyTimeoutMillis = 3000;
+
+// longest prefix of text that fits in a frame of frameCapacity with the frame's header, 0 if none does
+// scratch must hold frameCapacity bytes
+size_t fitFrameText(FrameView &frame, const char *text, size_t textLength, uint8_t *scratch, size_t frameCapacity)
+{
+  frame.text = text;
+  size_t low = 0;
+  size_t high = std::min(textLength, (size_t)MaxMessageLength);
+
+  // compressed length grows with the text, so binary search the prefix length
+  while (low < high)
+  {
+    size_t length = (low + high + 1) / 2;
+    frame.textLength = length;
+    if (encodeFrame(scratch, frameCapacity, frame) > 0)
+      low = length;
+    else
+      high = length - 1;
+  }
+
+  frame.textLength = low;
+  return low;
+}
+
+class Reassembler
+{
+public:
+  void clear()
+  {
+    for (uint8_t i = 0; i < ReassemblyCapacity; i++)
+      slots[i].isUsed = false;
+  }
+
+  // adds a fragment's (decompressed) text, returns true and copies the message to text once complete
+  bool add(const FrameView &frame, bool isEspNow, unsigned long now, unsigned long timeoutMillis,
+           char *text, size_t textCapacity, size_t &textLength)
+  {
+    uint16_t firstSequence = (frame.sequence - frame.fragmentIndex) & SequenceMask;
+    Slot &slot = findSlot(frame.senderHash, isEspNow, firstSequence, now);
+    if (!slot.isUsed)
+    {
+      slot.isUsed = true;
+      slot.senderHash = frame.senderHash;
+      slot.isEspNow = isEspNow;
+      slot.firstSequence = firstSequence;
+      slot.expiresMillis = now + timeoutMillis;
+      slot.receivedMask = 0;
+      slot.fragmentCount = 0;
+      slot.textUsed = 0;
+    }
+
+    uint16_t bit = 1 << frame.fragmentIndex;
+    if (slot.receivedMask & bit)
+      return false;
+
+    if (slot.textUsed + frame.textLength > sizeof(slot.text) || (slot.fragmentCount > 0 && frame.fragmentIndex >= slot.fragmentCount))
+    {
+      log_w("dropping malformed fragments from %04x", frame.senderHash);
+      slot.isUsed = false;
+      droppedCount++;
+      return false;
+    }
+
+    memcpy(slot.text + slot.textUsed, frame.text, frame.textLength);
+    slot.offsets[frame.fragmentIndex] = slot.textUsed;
+    slot.lengths[frame.fragmentIndex] = frame.textLength;
+    slot.textUsed += frame.textLength;
+    slot.receivedMask |= bit;
+    if (frame.isLastFragment)
+      slot.fragmentCount = frame.fragmentIndex + 1;
+
+    if (slot.fragmentCount == 0 || slot.receivedMask != (uint16_t)((1UL << slot.fragmentCount) - 1))
+      return false;
+
+    // fragments arrive in any order, copy them out in order
+    textLength = 0;
+    for (uint8_t i = 0; i < slot.fragmentCount && textLength < textCapacity; i++)
+    {
+      size_t length = std::min((size_t)slot.lengths[i], textCapacity - textLength);
+      memcpy(text + textLength, slot.text + slot.offsets[i], length);
+      textLength += length;
+    }
+    slot.isUsed = false;
+    return true;
+  }
+
+  size_t size() const
+  {
+    size_t count = 0;
+    for (uint8_t i = 0; i < ReassemblyCapacity; i++)
+      count += slots[i].isUsed;
+    return count;
+  }
+
+  uint32_t dropped() const { return droppedCount; }
+
+private:
+  struct Slot
+  {
+    char text[MaxMessageLength];
+    uint16_t offsets[MaxFragments]; // into text, in arrival order
+    uint8_t lengths[MaxFragments];
+    uint16_t receivedMask;
+    uint16_t textUsed;
+    uint16_t senderHash;
+    uint16_t firstSequence;
+    uint8_t fragmentCount; // 0 until the last fragment arrives
+    bool isEspNow;
+    bool isUsed;
+    unsigned long expiresMillis;
+  };
+
+  // the message's slot, else a free one, an expired one or the one that expires first
+  Slot &findSlot(uint16_t senderHash, bool isEspNow, uint16_t firstSequence, unsigned long now)
+  {
+    Slot *victim = &slots[0];
+    for (uint8_t i = 0; i < ReassemblyCapacity; i++)
+    {
+      Slot &slot = slots[i];
+      if (slot.isUsed && (long)(now - slot.expiresMillis) >= 0)
+      {
+        slot.isUsed = false;
+        droppedCount++;
+      }
+
+      if (slot.isUsed && slot.senderHash == senderHash && slot.isEspNow == isEspNow && slot.firstSequence == firstSequence)
+        return slot;
+
+      if (!slot.isUsed ? victim->isUsed : (victim->isUsed && (long)(slot.expiresMillis - victim->expiresMillis) < 0))
+        victim = &slot;
+    }
+
+    if (victim->isUsed)
+      droppedCount++;
+    victim->isUsed = false;
+    return *victim;
+  }
+
+  Slot slots[ReassemblyCapacity] = {};
+  uint32_t droppedCount = 0;
+};
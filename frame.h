@@ -0,0 +1,411 @@
+#pragma once
+
+// frame codec, encodes from and decodes into caller owned memory with no heap allocation
+//
+// v1 frame: |nonce:6,channel:2|username\0|text\0|, text omitted for pings
+// v2 frame: |nonce:6,channel:2|version|flags|sender hash:16|[sequence high:8]|[hops left:8]|[last:1,fragment index:7]|[ack count:8|acks]|[requested hash:16]|[username\0]|text|
+//
+// v1 usernames are alphanumeric, so a v2 version byte in the second position can't be mistaken for one.
+// v2 frames identify the sender by a hash of the username and only carry the full name now and then
+// (see FullNameInterval in chat.h) or when another user asks for it with a name request.
+// With a sequence high byte the nonce is the low 6 bits of a 14-bit per-sender sequence number,
+// which receivers use to drop duplicate frames (see duplicate_filter.h).
+// Senders leave out the hops left byte, relays add it and count it down (see relayFrame() and relay.h).
+// Text longer than the transport's MTU is split into fragments with consecutive sequence numbers (see fragment.h).
+// Acks are (sender hash:16, sequence:16) of frames received with an ack request (see ack.h).
+
+#include <Arduino.h>
+
+#include "text_compression.h"
+
+const uint8_t MinUsernameLength = 2; // TODO
+const uint8_t MaxUsernameLength = 8;
+const uint8_t MaxMessageLength = 255; // split into fragments when it doesn't fit in one frame
+const uint8_t V1MaxMessageLength = 100;
+
+const uint8_t FrameVersion1 = 0x01; // implied, v1 frames have no version byte
+const uint8_t FrameVersion2 = 0x02;
+const uint8_t FrameVersion = FrameVersion2; // version sent
+
+enum FrameFlags
+{
+  FullName = 0x01,    // username follows the header
+  NameRequest = 0x02, // requested hash follows the header, owner of that hash should send its full name
+  Compressed = 0x04,  // text is compressed, see text_compression.h
+  Sequence = 0x08,    // sequence high byte follows the sender hash
+  Relayed = 0x10,     // hops left byte follows the sequence high byte
+  AckRequest = 0x20,  // receivers should ack this frame
+  Ack = 0x40,         // acks for other senders' frames follow the hops left byte
+  Fragment = 0x80,    // fragment byte follows the hops left byte, text is part of a longer message
+};
+
+const uint8_t MaxHops = 3; // times a frame may be relayed
+const uint8_t MaxFrameAcks = 4;
+const uint8_t FrameAckLength = 4;
+const uint8_t MaxFragments = 16;
+const uint8_t LastFragment = 0x80;
+
+const uint8_t SequenceBits = 14;
+const uint16_t SequenceMask = (1 << SequenceBits) - 1;
+
+const size_t V1MinFrameLength = 1 + MinUsernameLength + 1;
+const size_t V1MaxFrameLength = 1 + MaxUsernameLength + 1 + V1MaxMessageLength + 1;
+const size_t V2HeaderLength = 5;
+const size_t V2MaxFrameLength = 250; // ESP-NOW max payload, transports with a smaller MTU send shorter frames
+const size_t MaxFrameLength = V2MaxFrameLength;
+
+// decoded frame, username and text point into the frame buffer and are not NUL-terminated
+struct FrameView
+{
+  uint8_t version;
+  uint8_t nonce;
+  uint8_t channel;
+  uint8_t flags;
+  uint16_t senderHash;
+  uint16_t sequence;      // nonce in the low 6 bits, the high bits are only sent with FrameFlags::Sequence
+  uint8_t hopsLeft;       // sent with FrameFlags::Relayed, MaxHops for frames straight from the sender
+  uint8_t fragmentIndex;  // valid with FrameFlags::Fragment, 0 otherwise
+  bool isLastFragment;    // valid with FrameFlags::Fragment, true otherwise
+  uint8_t ackCount;       // valid with FrameFlags::Ack
+  const uint8_t *acks;    // ackCount acks, see readFrameAck()
+  uint16_t requestedHash; // valid with FrameFlags::NameRequest
+  const char *username;   // valid with FrameFlags::FullName
+  uint8_t usernameLength;
+  const char *text;
+  uint8_t textLength;
+};
+
+// 32-bit FNV-1a folded to 16 bits
+uint16_t usernameHash(const char *username, size_t usernameLength)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < usernameLength; i++)
+  {
+    hash ^= (uint8_t)username[i];
+    hash *= 16777619u;
+  }
+  return (uint16_t)(hash >> 16) ^ (uint16_t)hash;
+}
+
+// v1 encoder, kept for comparison and for talking to older firmware
+// returns the encoded length, or 0 if the frame does not fit in frameCapacity
+size_t encodeFrameV1(uint8_t *frameData, size_t frameCapacity, uint8_t channel, uint8_t nonce,
+                     const char *username, size_t usernameLength, const char *text, size_t textLength)
+{
+  usernameLength = std::min(usernameLength, (size_t)MaxUsernameLength);
+  textLength = std::min(textLength, (size_t)V1MaxMessageLength);
+
+  size_t frameDataLength = 1 + usernameLength + 1 + (textLength > 0 ? textLength + 1 : 0);
+  if (frameDataLength > frameCapacity)
+    return 0;
+
+  uint8_t *p = frameData;
+  *p++ = (nonce & 0x3F) | ((channel & 0x03) << 6);
+
+  memcpy(p, username, usernameLength);
+  p += usernameLength;
+  *p++ = '\0';
+
+  if (textLength > 0)
+  {
+    memcpy(p, text, textLength);
+    p += textLength;
+    *p++ = '\0';
+  }
+
+  return frameDataLength;
+}
+
+// encoded v2 length without the text
+size_t frameHeaderLength(const FrameView &frame)
+{
+  size_t headerLength = V2HeaderLength;
+  if (frame.flags & FrameFlags::Sequence)
+    headerLength += 1;
+  if (frame.flags & FrameFlags::Relayed)
+    headerLength += 1;
+  if (frame.flags & FrameFlags::Fragment)
+    headerLength += 1;
+  if (frame.flags & FrameFlags::Ack)
+    headerLength += 1 + std::min(frame.ackCount, MaxFrameAcks) * FrameAckLength;
+  if (frame.flags & FrameFlags::NameRequest)
+    headerLength += 2;
+  if (frame.flags & FrameFlags::FullName)
+    headerLength += std::min(frame.usernameLength, MaxUsernameLength) + 1;
+  return headerLength;
+}
+
+// v2 encoder, username is only written with FrameFlags::FullName and requestedHash with FrameFlags::NameRequest
+// with FrameFlags::Compressed the text is compressed in place, the flag is dropped from the frame if that doesn't save anything
+// returns the encoded length, or 0 if the frame does not fit in frameCapacity, compressed if that makes it fit
+size_t encodeFrame(uint8_t *frameData, size_t frameCapacity, const FrameView &frame)
+{
+  size_t usernameLength = (frame.flags & FrameFlags::FullName) ? std::min(frame.usernameLength, MaxUsernameLength) : 0;
+  size_t textLength = std::min(frame.textLength, MaxMessageLength);
+
+  size_t headerLength = frameHeaderLength(frame);
+  size_t frameDataLength = headerLength + textLength;
+  if (headerLength > frameCapacity || (frameDataLength > frameCapacity && !(frame.flags & FrameFlags::Compressed)))
+    return 0;
+
+  uint8_t *p = frameData;
+  *p++ = (frame.nonce & 0x3F) | ((frame.channel & 0x03) << 6);
+  *p++ = FrameVersion2;
+  uint8_t *flags = p;
+  *p++ = frame.flags;
+  *p++ = frame.senderHash & 0xFF;
+  *p++ = frame.senderHash >> 8;
+
+  if (frame.flags & FrameFlags::Sequence)
+    *p++ = (frame.sequence & SequenceMask) >> 6;
+
+  if (frame.flags & FrameFlags::Relayed)
+    *p++ = frame.hopsLeft;
+
+  if (frame.flags & FrameFlags::Fragment)
+    *p++ = (frame.fragmentIndex & ~LastFragment) | (frame.isLastFragment ? LastFragment : 0);
+
+  if (frame.flags & FrameFlags::Ack)
+  {
+    uint8_t ackCount = std::min(frame.ackCount, MaxFrameAcks);
+    *p++ = ackCount;
+    memcpy(p, frame.acks, ackCount * FrameAckLength);
+    p += ackCount * FrameAckLength;
+  }
+
+  if (frame.flags & FrameFlags::NameRequest)
+  {
+    *p++ = frame.requestedHash & 0xFF;
+    *p++ = frame.requestedHash >> 8;
+  }
+
+  if (frame.flags & FrameFlags::FullName)
+  {
+    memcpy(p, frame.username, usernameLength);
+    p += usernameLength;
+    *p++ = '\0';
+  }
+
+  if (frame.flags & FrameFlags::Compressed)
+  {
+    // only keep the compressed text if it is strictly shorter
+    size_t compressedCapacity = std::min(textLength - 1, frameCapacity - headerLength);
+    size_t compressedLength = textLength > 1 ? compressText(frame.text, textLength, p, compressedCapacity) : 0;
+    if (compressedLength > 0)
+      return headerLength + compressedLength;
+
+    *flags &= ~FrameFlags::Compressed;
+    if (frameDataLength > frameCapacity)
+      return 0;
+  }
+
+  memcpy(p, frame.text, textLength);
+
+  return frameDataLength;
+}
+
+bool decodeFrameV1(const uint8_t *frameData, size_t frameDataLength, FrameView &frame)
+{
+  if (frameDataLength < V1MinFrameLength || frameDataLength > V1MaxFrameLength)
+    return false;
+
+  frame.version = FrameVersion1;
+  frame.nonce = frameData[0] & 0x3F;
+  frame.channel = (frameData[0] >> 6) & 0x03;
+  frame.flags = FrameFlags::FullName;
+  frame.sequence = frame.nonce;
+  frame.hopsLeft = 0; // v1 frames are not relayed
+  frame.fragmentIndex = 0;
+  frame.isLastFragment = true;
+  frame.ackCount = 0;
+  frame.acks = NULL;
+  frame.requestedHash = 0;
+
+  const char *username = (const char *)(frameData + 1);
+  const char *usernameEnd = (const char *)memchr(username, '\0', std::min(frameDataLength - 1, (size_t)MaxUsernameLength + 1));
+  if (usernameEnd == NULL)
+    return false;
+
+  frame.username = username;
+  frame.usernameLength = usernameEnd - username;
+  frame.senderHash = usernameHash(frame.username, frame.usernameLength);
+
+  // text runs to its terminator or the end of the frame, whichever is first
+  const char *text = usernameEnd + 1;
+  size_t textBytes = (const char *)(frameData + frameDataLength) - text;
+  const char *textEnd = (const char *)memchr(text, '\0', textBytes);
+
+  frame.text = text;
+  frame.textLength = textEnd ? textEnd - text : textBytes;
+
+  return true;
+}
+
+bool decodeFrameV2(const uint8_t *frameData, size_t frameDataLength, FrameView &frame)
+{
+  if (frameDataLength < V2HeaderLength || frameDataLength > V2MaxFrameLength)
+    return false;
+
+  const uint8_t *p = frameData;
+  const uint8_t *end = frameData + frameDataLength;
+
+  frame.nonce = p[0] & 0x3F;
+  frame.channel = (p[0] >> 6) & 0x03;
+  frame.version = p[1];
+  frame.flags = p[2];
+  frame.senderHash = p[3] | (p[4] << 8);
+  p += V2HeaderLength;
+
+  frame.sequence = frame.nonce;
+  if (frame.flags & FrameFlags::Sequence)
+  {
+    if (end - p < 1)
+      return false;
+    frame.sequence |= *p++ << 6;
+  }
+
+  frame.hopsLeft = MaxHops;
+  if (frame.flags & FrameFlags::Relayed)
+  {
+    if (end - p < 1)
+      return false;
+    frame.hopsLeft = *p++;
+  }
+
+  frame.fragmentIndex = 0;
+  frame.isLastFragment = true;
+  if (frame.flags & FrameFlags::Fragment)
+  {
+    // fragments are put back together by sequence number
+    if (end - p < 1 || !(frame.flags & FrameFlags::Sequence) || (*p & ~LastFragment) >= MaxFragments)
+      return false;
+    frame.fragmentIndex = *p & ~LastFragment;
+    frame.isLastFragment = *p & LastFragment;
+    p++;
+  }
+
+  frame.ackCount = 0;
+  frame.acks = NULL;
+  if (frame.flags & FrameFlags::Ack)
+  {
+    if (end - p < 1 || p[0] > MaxFrameAcks || end - p - 1 < p[0] * FrameAckLength)
+      return false;
+    frame.ackCount = p[0];
+    frame.acks = p + 1;
+    p += 1 + frame.ackCount * FrameAckLength;
+  }
+
+  frame.requestedHash = 0;
+  if (frame.flags & FrameFlags::NameRequest)
+  {
+    if (end - p < 2)
+      return false;
+    frame.requestedHash = p[0] | (p[1] << 8);
+    p += 2;
+  }
+
+  frame.username = NULL;
+  frame.usernameLength = 0;
+  if (frame.flags & FrameFlags::FullName)
+  {
+    const uint8_t *usernameEnd = (const uint8_t *)memchr(p, '\0', std::min((size_t)(end - p), (size_t)MaxUsernameLength + 1));
+    if (usernameEnd == NULL)
+      return false;
+
+    frame.username = (const char *)p;
+    frame.usernameLength = usernameEnd - p;
+    p = usernameEnd + 1;
+  }
+
+  // compressed text can't be longer than the text it came from
+  if (end - p > MaxMessageLength)
+    return false;
+
+  frame.text = (const char *)p;
+  frame.textLength = end - p;
+
+  return true;
+}
+
+bool decodeFrame(const uint8_t *frameData, size_t frameDataLength, FrameView &frame)
+{
+  if (frameDataLength >= 2 && frameData[1] == FrameVersion2)
+    return decodeFrameV2(frameData, frameDataLength, frame);
+
+  return decodeFrameV1(frameData, frameDataLength, frame);
+}
+
+void writeFrameAck(uint8_t *acks, uint8_t index, uint16_t senderHash, uint16_t sequence)
+{
+  uint8_t *ack = acks + index * FrameAckLength;
+  ack[0] = senderHash & 0xFF;
+  ack[1] = senderHash >> 8;
+  ack[2] = sequence & 0xFF;
+  ack[3] = sequence >> 8;
+}
+
+void readFrameAck(const FrameView &frame, uint8_t index, uint16_t &senderHash, uint16_t &sequence)
+{
+  const uint8_t *ack = frame.acks + index * FrameAckLength;
+  senderHash = ack[0] | (ack[1] << 8);
+  sequence = ack[2] | (ack[3] << 8);
+}
+
+// reads the sender and sequence number straight from the frame bytes, before any other parsing
+// returns false for frames without a full sequence number (v1, or v2 without FrameFlags::Sequence)
+bool peekFrameSequence(const uint8_t *frameData, size_t frameDataLength, uint16_t &senderHash, uint16_t &sequence)
+{
+  if (frameDataLength < V2HeaderLength + 1 || frameData[1] != FrameVersion2 || !(frameData[2] & FrameFlags::Sequence))
+    return false;
+
+  senderHash = frameData[3] | (frameData[4] << 8);
+  sequence = (frameData[0] & 0x3F) | (frameData[V2HeaderLength] << 6);
+  return true;
+}
+
+// copy of a received frame for a relay to send on, with one hop less, the rest is copied as is
+// returns the relayed length, or 0 if the frame can't be relayed (no hops left, or no sequence number to
+// drop duplicates with)
+size_t relayFrame(const uint8_t *frameData, size_t frameDataLength, uint8_t *relayData, size_t relayCapacity)
+{
+  const size_t hopsOffset = V2HeaderLength + 1;
+  if (frameDataLength < hopsOffset || frameData[1] != FrameVersion2 || !(frameData[2] & FrameFlags::Sequence))
+    return 0;
+
+  bool isRelayed = frameData[2] & FrameFlags::Relayed;
+  if (isRelayed && frameDataLength <= hopsOffset)
+    return 0;
+
+  uint8_t hopsLeft = isRelayed ? frameData[hopsOffset] : MaxHops;
+  size_t restOffset = isRelayed ? hopsOffset + 1 : hopsOffset;
+  size_t relayDataLength = hopsOffset + 1 + frameDataLength - restOffset;
+  if (hopsLeft == 0 || relayDataLength > relayCapacity)
+    return 0;
+
+  memcpy(relayData, frameData, hopsOffset);
+  relayData[2] |= FrameFlags::Relayed;
+  relayData[hopsOffset] = hopsLeft - 1;
+  memcpy(relayData + hopsOffset + 1, frameData + restOffset, frameDataLength - restOffset);
+  return relayDataLength;
+}
+
+// decompresses frame.text into buffer if needed and points frame.text at the result
+bool decompressFrameText(FrameView &frame, char *buffer, size_t capacity)
+{
+  if (!(frame.flags & FrameFlags::Compressed))
+    return true;
+
+  size_t textLength;
+  if (!decompressText((const uint8_t *)frame.text, frame.textLength, buffer, std::min(capacity, (size_t)MaxMessageLength), textLength))
+    return false;
+
+  frame.text = buffer;
+  frame.textLength = textLength;
+  frame.flags &= ~FrameFlags::Compressed;
+  return true;
+}
+
+bool frameUsernameEquals(const FrameView &frame, const char *username, size_t usernameLength)
+{
+  return frame.usernameLength == usernameLength && memcmp(frame.username, username, usernameLength) == 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// key presses from the keyboard scanning task to the UI task, one event per press with the time it was seen
+//
+// the Cardputer keyboard is a 4x14 matrix behind a 3-to-8 decoder with no interrupt line, so it has to be
+// scanned. KeyScanner paces the scans by how recently the keyboard was used: every few ms while keys are
+// down or were just pressed, slower after a few seconds idle and slower again after half a minute, but never
+// slower than the shortest tap, as nothing wakes the scan when a key goes down. Keys are
+// debounced each on their own: a key seen up for less than KeyDebounceMillis is still the same press, so
+// switch bounce doesn't repeat it, while presses of other keys in between (rollover) are all kept.
+
+#include <Arduino.h>
+
+const uint8_t KeyRows = 4;
+const uint8_t KeyColumns = 14;
+const uint8_t KeyCount = KeyRows * KeyColumns; // a bit each in a scan
+
+const unsigned long KeyDebounceMillis = 15;
+const unsigned long FastScanMillis = 5;  // keys down or pressed in the last KeyActiveMillis
+const unsigned long SlowScanMillis = 20; // until KeyIdleMillis
+const unsigned long IdleScanMillis = 30;
+const unsigned long MinKeyPressMillis = 40; // about the shortest tap, held at least this long it is seen at any scan rate
+const unsigned long KeyActiveMillis = 2000;
+const unsigned long KeyIdleMillis = 30000;
+
+inline uint8_t keyIndex(uint8_t x, uint8_t y) { return y * KeyColumns + x; }
+
+enum KeyKind : uint8_t
+{
+  KeyChar = 0,
+  KeyDel,
+  KeyEnter,
+  KeyTab
+};
+
+struct KeyEvent
+{
+  unsigned long millis; // scan that saw the press
+  uint8_t kind;
+  char c;  // KeyChar, shifted if shift was held
+  bool fn; // held with the key
+};
+
+class KeyScanner
+{
+public:
+  // pressed has a bit per key down in this scan, returns a bit per key newly pressed
+  uint64_t update(uint64_t pressed, unsigned long now)
+  {
+    scanCount++;
+
+    // held keys seen up start their debounce, seen down again they stay held
+    releasing &= ~pressed;
+    uint64_t up = held & ~pressed & ~releasing;
+    for (uint8_t i = 0; i < KeyCount; i++)
+    {
+      uint64_t bit = 1ULL << i;
+      if (up & bit)
+        releasedMillis[i] = now;
+      else if ((releasing & bit) && now - releasedMillis[i] >= KeyDebounceMillis)
+      {
+        held &= ~bit;
+        releasing &= ~bit;
+      }
+    }
+    releasing |= up;
+
+    uint64_t newlyPressed = pressed & ~held;
+    held |= newlyPressed;
+    if (pressed != 0)
+      lastActiveMillis = now;
+    return newlyPressed;
+  }
+
+  // wait before the next scan
+  unsigned long scanDelay(unsigned long now) const
+  {
+    if (held != 0 || now - lastActiveMillis < KeyActiveMillis)
+      return FastScanMillis;
+    return now - lastActiveMillis < KeyIdleMillis ? SlowScanMillis : IdleScanMillis;
+  }
+
+  uint32_t scans() const { return scanCount; }
+
+private:
+  uint64_t held = 0;      // debounced, down or up for less than KeyDebounceMillis
+  uint64_t releasing = 0; // held keys seen up, since releasedMillis
+  unsigned long releasedMillis[KeyCount] = {};
+  unsigned long lastActiveMillis = 0;
+  uint32_t scanCount = 0;
+};
+
+// press to glyph on screen, measured by the UI task once the redraw for an event is pushed
+struct KeyLatencyStats
+{
+  void add(unsigned long latencyMillis)
+  {
+    count++;
+    totalMillis += latencyMillis;
+    maxMillis = std::max(maxMillis, (uint32_t)latencyMillis);
+  }
+
+  uint32_t meanMillis() const { return count > 0 ? totalMillis / count : 0; }
+
+  uint32_t count = 0;
+  uint32_t totalMillis = 0;
+  uint32_t maxMillis = 0;
+};
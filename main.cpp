@@ -1,44 +1,78 @@
+#include <esp_heap_caps.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
 #include <M5Cardputer.h>
 #include <M5_LoRa_E220_JP.h>
+#include <Preferences.h>
 #include <SD.h>
 #include <WiFi.h>
 
+#include "boot_profile.h"
+#include "chat.h"
 #include "common.h"
+#include "config.h"
 #include "draw_helper.h"
-
-#define PING_CHANNEL 0b11
-#define PING_MESSAGE ""
-#define LORA_PING_INTERVAL_MS 1000 * 60    // 1 minute
-#define ESP_NOW_PING_INTERVAL_MS 1000 * 15   // 15 seconds
-#define PRESENCE_TIMEOUT_MS 1000 * 60 * 3 // 3 minutes, the time before a msg "expires" for the purposes of tracking a user presence
-
-uint8_t messageNonce = 0;
+#include "key_events.h"
+#include "radio_transport.h"
+#include "screenshot.h"
 
 LoRa_E220_JP lora;
 struct LoRaConfigItem_t loraConfig;
 struct RecvFrame_t loraFrame;
 TaskHandle_t loraReceiveTaskHandle = NULL;
+TaskHandle_t txTaskHandle = NULL;
+TaskHandle_t storageTaskHandle = NULL;
+TaskHandle_t setupTaskHandle = NULL;
+volatile bool isRadioBooting = false; // radio comes up on its own task during setup(), see radioBootTask()
 bool isLoraInit = false;
+LoRaTransport loraTransport(lora, loraConfig);
 
 uint8_t espNowBroadcastAddress[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 esp_now_peer_info_t espNowBroadcastPeerInfo;
 int espNowLastRssi = 0;
 bool isEspNowInit = false;
+EspNowTransport espNowTransport(espNowBroadcastAddress);
 
 M5Canvas *canvas;
 M5Canvas *canvasSystemBar;
 M5Canvas *canvasTabBar;
 
-// used by draw loop to trigger redraws
-volatile uint8_t keyboardRedrawFlags = RedrawFlags::None;
-volatile bool receivedMessage = false; // signal to redraw window
-volatile int updateDelay = 0;
-volatile unsigned long lastRx = false;
-volatile unsigned long lastTx = false;
+// the UI task sleeps until one of these is set
+EventGroupHandle_t uiEvents = NULL;
+const EventBits_t UiKeyEvent = 1 << 0;    // keys pressed, see keyEventQueue
+const EventBits_t UiQueuedEvent = 1 << 1; // something for processQueuedMessages(), see uiWake
+const EventBits_t UiRefreshEvent = 1 << 2; // refresh timer or uiRefresh
+const EventBits_t UiScreenshotEvent = 1 << 3;
+const EventBits_t UiEvents = UiKeyEvent | UiQueuedEvent | UiRefreshEvent | UiScreenshotEvent;
+const unsigned long MaxUiWaitMillis = 1000;
+const unsigned long ScreenshotPollMillis = 10; // while rows wait for room in the storage queue
 const int RxTxShowDelay = 1000; // ms
 
+// system bar and user info tab refreshes, one-shot and restarted with the next delay each time it fires
+TimerHandle_t refreshTimer = NULL;
+const unsigned long RefreshMillis = 5000;
+const unsigned long UserInfoRefreshMillis = 1000; // last seen times
+
+// memory stats logging
+const unsigned long MemoryStatsInterval = 60 * 1000;
+unsigned long lastMemoryStats = 0;
+
+// key presses from the keyboard scanning task, handled by the UI task, see key_events.h
+const size_t KeyEventQueueCapacity = 32;
+SpscQueue<KeyEvent, KeyEventQueueCapacity> keyEventQueue;
+KeyScanner keyScanner;                // keyboard scanning task only
+volatile uint32_t keyScanMicros = 0;  // spent scanning
+KeyLatencyStats keyLatency;           // UI task only
+uint32_t lastKeyScans = 0;            // at the last stats log
+uint32_t lastKeyScanMicros = 0;
+unsigned long lastKeyStatsMillis = 0;
+
+// boot phase timestamps, see boot_profile.h
+BootProfile bootProfile;
+bool showBootProfile = false; // Boot Times setting opened
+
 // system bar state
 uint8_t batteryPct = M5Cardputer.Power.getBatteryLevel();
 int maxRssi = -1000;
@@ -47,24 +81,20 @@ int maxRssi = -1000;
 uint8_t activeTabIndex;
 const uint8_t UserInfoTabIndex = 3;
 const uint8_t SettingsTabIndex = 4;
-const uint8_t ChatTabCount = 3;
 const uint8_t TabCount = 5;
-ChatTab chatTab[ChatTabCount];
 
 // settings
 uint8_t activeSettingIndex;
-const uint8_t MinUsernameLength = 2; // TODO
-const uint8_t MaxUsernameLength = 8;
-const uint8_t MaxMessageLength = 100; // TODO
-String username = "user";
 uint8_t brightness = 70;
+uint8_t dutyCyclePercent = DefaultDutyCyclePercent;
 float chatTextSize = 1.0; // TODO: S, M, L?
-bool pingMode = true;
-bool repeatMode = false;
 bool espNowMode = false;
 int loraWriteStage = 0;
-int sdWriteStage = 0;
+int configWriteStage = 0;
 bool sdInit = false;
+volatile bool screenshotRequested = false; // by BtnA, taken by the UI task
+ScreenshotWriter screenshot;
+uint8_t heldRedrawFlags = RedrawFlags::None; // redraws wait while a screenshot reads the canvases
 SPIClass SPI2;
 
 // display layout constants
@@ -87,130 +117,70 @@ const uint8_t wy = sy + sh;
 const uint8_t ww = w - wx;
 const uint8_t wh = h - wy;
 
-String getHexString(const void *data, size_t size)
+// a row of the screen as the canvases hold it, system bar on top, tab bar and main window below
+void readScreenRow(int y, uint16_t *pixels)
 {
-  const byte *bytes = (const byte *)(data);
-  String hexDump = "";
-
-  for (size_t i = 0; i < size; ++i)
+  if (y < sy + sh)
   {
-    char hex[4];
-    snprintf(hex, sizeof(hex), "%02x ", bytes[i]);
-    hexDump += hex;
+    canvasSystemBar->readRect(0, y - sy, sw, 1, (lgfx::rgb565_t *)pixels + sx);
+    return;
   }
-
-  return hexDump; // Return the accumulated hex dump string
+  canvasTabBar->readRect(0, y - ty, tw, 1, (lgfx::rgb565_t *)pixels + tx);
+  canvas->readRect(0, y - wy, ww, 1, (lgfx::rgb565_t *)pixels + wx);
 }
 
-void saveScreenshot()
+void logMemoryStats()
 {
-  size_t pngLen;
-  uint8_t *pngBytes = (uint8_t *)M5Cardputer.Display.createPng(&pngLen, 0, 0, 240, 135);
+  log_w("heap: %u free, %u min free, %u largest block, chat history: %u bytes",
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+        heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+        heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+        chatHistoryMemoryBytes());
 
-  int i = 0;
-  String filename;
-  do
+  for (uint8_t i = 0; i < ChatTabCount; i++)
   {
-    filename = "/screenshot." + String(i++) + ".png";
-  } while (SD.exists(filename));
-
-  File file = SD.open(filename, FILE_WRITE);
-  if (file)
-  {
-    file.write(pngBytes, pngLen);
-    file.flush();
-    file.close();
-    USBSerial.println("saved screenshot to " + filename + ", " + String(pngLen) + " bytes");
+    const MessageHistory &history = chatTab[i].history;
+    log_w("  channel %c: %u/%u messages, %u text bytes, %u evicted",
+          'A' + i, history.size(), history.capacity(), history.arenaBytesUsed(), history.evictedCount());
   }
-  else
+
+  for (uint8_t p = 0; p < TxPriorityCount; p++)
   {
-    USBSerial.println("cannot save screenshot to file " + filename);
+    TxQueueStats stats = txQueue.getStats((TxPriority)p);
+    uint32_t sent = stats.queued - stats.depth;
+    log_w("  tx %s: %u queued, %u dropped, depth %u (max %u), %u ms mean, %u ms max in queue",
+          TxPriorityNames[p], stats.queued, stats.dropped, stats.depth, stats.maxDepth,
+          sent ? stats.totalQueueMillis / sent : 0, stats.maxQueueMillis);
   }
-
-  free(pngBytes);
 }
 
-std::vector<String> getMessageLines(const String &message, int lineWidth)
+void logInputStats()
 {
-  std::vector<String> messageLines;
-  String currentLine;
-  String word;
-
-  for (char c : message)
-  {
-    if (std::isspace(c))
-    {
-      if (currentLine.length() + word.length() <= lineWidth)
-      {
-        currentLine += (currentLine.isEmpty() ? "" : " ") + word;
-        word.clear();
-      }
-      else
-      {
-        messageLines.push_back(currentLine);
-        currentLine.clear();
-
-        currentLine += word; // TODO: word too long, hyphenate
-        word.clear();
-      }
-    }
-    else
-    {
-      word += c;
-    }
-  }
-
-  if (!currentLine.isEmpty() || !word.isEmpty())
-  {
-    currentLine += (currentLine.isEmpty() ? "" : " ") + word;
-    messageLines.push_back(currentLine);
-  }
-
-  return messageLines;
+  unsigned long intervalMillis = std::max(millis() - lastKeyStatsMillis, 1UL);
+  uint32_t scans = keyScanner.scans() - lastKeyScans;
+  uint32_t scanMicros = keyScanMicros - lastKeyScanMicros;
+  unsigned long scanHundredths = scanMicros * 10UL / intervalMillis; // hundredths of a percent of the interval
+  log_w("keys: %u pressed, press to glyph %u ms mean, %u ms max, %lu scans/s, scanning %lu.%02lu%% of a core",
+        keyLatency.count, keyLatency.meanMillis(), keyLatency.maxMillis, scans * 1000UL / intervalMillis,
+        scanHundredths / 100, scanHundredths % 100);
+
+  lastKeyStatsMillis = millis();
+  lastKeyScans += scans;
+  lastKeyScanMicros += scanMicros;
 }
 
-int getPresenceRssi()
+void logBootProfile()
 {
-  int maxRssiAllUsers = -1000;
-
-  for (auto presence : presence)
-  {
-    // only consider presences that match the current mode
-    if (espNowMode && !presence.isEspNow ||
-        !espNowMode && presence.isEspNow)
-    {
-      continue;
-    }
-
-    // only consider presences that have been seen recently
-    if (presence.rssi > maxRssiAllUsers && millis() - presence.lastSeenMillis < PRESENCE_TIMEOUT_MS)
-    {
-      maxRssiAllUsers = presence.rssi;
-    }
-  }
-
-  return maxRssiAllUsers;
+  log_w("boot: first frame at %lu ms, radio ready at %lu ms", bootProfile.millisAt(BootFirstFrame), bootProfile.millisAt(BootRadio));
+  for (uint8_t i = 0; i < BootPhaseCount; i++)
+    log_w("  %-11s %5lu ms  +%lu ms", BootPhaseNames[i], bootProfile.millisAt((BootPhase)i), bootProfile.phaseMillis((BootPhase)i));
 }
 
-bool recordPresence(const Message &message)
+// called by whichever task finishes the phase, the one that finishes the last phase logs them all
+void markBootPhase(BootPhase phase)
 {
-  // return true if presence is new or renewed
-
-  for (int i = 0; i < presence.size(); i++)
-  {
-    if (presence[i].username == message.username && presence[i].isEspNow == message.isEspNow)
-    {
-      presence[i].rssi = message.rssi;
-
-      bool beenAWhile = millis() - presence[i].lastSeenMillis > PRESENCE_TIMEOUT_MS;
-      presence[i].lastSeenMillis = millis();
-      return beenAWhile;
-    }
-  }
-
-  log_w("new %s presence: %s", message.isEspNow ? "ESP-NOW" : "LoRa", message.username.c_str());
-  presence.push_back({message.username, message.isEspNow, message.rssi, millis()});
-  return true;
+  if (bootProfile.mark(phase, micros()))
+    logBootProfile();
 }
 
 void drawSystemBar()
@@ -228,6 +198,8 @@ void drawSystemBar()
     draw_tx_indicator(canvasSystemBar, sw - 71, sy + 1 * (sh / 3) - 1);
   if (millis() - lastRx < RxTxShowDelay)
     draw_rx_indicator(canvasSystemBar, sw - 71, sy + 2 * (sh / 3) - 1);
+  if (!espNowMode && airtimeBudget.isLimited())
+    draw_airtime_indicator(canvasSystemBar, sw - 81, sy + sh / 2 - 1, airtimeBudget.remainingPercent(millis()));
   draw_rssi_indicator(canvasSystemBar, sw - 60, sy + sh / 2 - 1, maxRssi, !espNowMode);
   draw_battery_indicator(canvasSystemBar, sw - 30, sy + sh / 2 - 1, batteryPct);
   canvasSystemBar->pushSprite(sx, sy);
@@ -289,7 +261,6 @@ void drawTabBar()
 
 void drawChatWindow()
 {
-  // TODO: only change when font changes
   int rowCount = (wh - 3 * m) / (canvas->fontHeight() + m) - 1;
   int colCount = (ww - 4 * m) / canvas->fontWidth() - 1;
   int messageWidth = (colCount * 3) / 4;
@@ -308,75 +279,64 @@ void drawChatWindow()
     canvas->drawString(chatTab[activeTabIndex].messageBuffer, ww - 2 * m, messageBufferY + messageBufferHeight / 2);
   }
 
-  // draw message window
-  if (chatTab[activeTabIndex].messages.size() > 0)
-  {
-    int linesDrawn = 0;
-
-    // draw all messages or until window is full
-    // TODO: view index, scrolling
-    for (int i = chatTab[activeTabIndex].messages.size() - 1; i >= 0; i--)
-    {
-      Message message = chatTab[activeTabIndex].messages[i];
-      bool isOwnMessage = message.username.isEmpty();
-
-      // show only messages that match the current mode
-      if (message.isEspNow != espNowMode)
-      {
-        continue;
-      }
+  // draw message window, lines are wrapped once per message and cached until the width changes
+  ChatTab &tab = chatTab[activeTabIndex];
+  tab.layout.setLineWidth(messageWidth);
+  uint32_t addedLines = tab.layout.index(tab.history, espNowMode);
 
-      int cursorX;
-      if (isOwnMessage)
-      {
-        cursorX = ww - 2 * m;
-        canvas->setTextDatum(top_right);
-      }
-      else
-      {
-        cursorX = 2 * m;
-        canvas->setTextDatum(top_left);
-        message.text = message.username + message.text;
-      }
+  // within a screen of the oldest line in memory, read older messages back from the log
+  if (tab.viewIndex + 2 * rowCount > (int)tab.layout.lineCount(tab.history))
+  {
+    requestOlderMessages(tab); // prepended by processQueuedMessages() when read
+  }
 
-      std::vector<String> lines = getMessageLines(message.text, messageWidth);
-      for (int j = lines.size() - 1; j >= 0; j--)
-      {
-        int cursorY = 2 * m + (rowCount - linesDrawn - 1) * (canvas->fontHeight() + m);
-        // canvas->setTextColor(TFT_SILVER);
-        if (j == 0 && !isOwnMessage)
-        {
-          int usernameWidth = canvas->fontWidth() * (message.username.length() + 1);
-          int textColor = UX_COLOR_ACCENT2;
-          int borderColor = UX_COLOR_ACCENT;
-
-          canvas->setTextColor(textColor);
-          canvas->drawString(lines[j].substring(0, message.username.length()), cursorX, cursorY);
-          canvas->drawRoundRect(cursorX - 2, cursorY - 2, usernameWidth - 3, canvas->fontHeight() + 4, 2, borderColor);
-
-          canvas->setTextColor(TFT_SILVER);
-          canvas->drawString(lines[j].substring(message.username.length()), cursorX + usernameWidth, cursorY);
-        }
-        else
-        {
-          canvas->setTextColor(TFT_SILVER);
-          canvas->drawString(lines[j], cursorX, cursorY);
-        }
-
-        linesDrawn++;
-
-        if (linesDrawn >= rowCount)
-        {
-          break;
-        }
-      }
-    }
+  // viewIndex is the number of lines scrolled back, stay on the same lines while new ones arrive
+  if (tab.viewIndex > 0)
+  {
+    tab.viewIndex += addedLines;
   }
+  int maxViewIndex = std::max(0, (int)tab.layout.lineCount(tab.history) - rowCount);
+  tab.viewIndex = std::min(tab.viewIndex, maxViewIndex);
+
+  layoutVisibleLines(tab.history, tab.layout, espNowMode, rowCount, tab.viewIndex,
+                     [&](const HistoryEntry &message, uint8_t lineIndex, const char *line, uint16_t lineLength, int row)
+                     {
+                       bool isOwnMessage = message.username[0] == '\0';
+                       int cursorX = isOwnMessage ? ww - 2 * m : 2 * m;
+                       int cursorY = 2 * m + (rowCount - row - 1) * (canvas->fontHeight() + m);
+
+                       char lineText[MaxMessageLength + 1];
+                       copyToBuffer(lineText, sizeof(lineText), line, lineLength);
+
+                       canvas->setTextDatum(isOwnMessage ? top_right : top_left);
+
+                       if (lineIndex == 0 && !isOwnMessage)
+                       {
+                         int usernameWidth = canvas->fontWidth() * (strlen(message.username) + 1);
+                         int textColor = UX_COLOR_ACCENT2;
+                         int borderColor = UX_COLOR_ACCENT;
+
+                         canvas->setTextColor(textColor);
+                         canvas->drawString(message.username, cursorX, cursorY);
+                         canvas->drawRoundRect(cursorX - 2, cursorY - 2, usernameWidth - 3, canvas->fontHeight() + 4, 2, borderColor);
+
+                         cursorX += usernameWidth;
+                       }
+
+                       // delivery state of own messages sent in ack mode, left of their first line
+                       if (lineIndex == 0 && isOwnMessage && message.deliveryState != NotTracked)
+                       {
+                         int indicatorX = cursorX - canvas->textWidth(lineText) - 4;
+                         draw_delivery_indicator(canvas, indicatorX, cursorY + canvas->fontHeight() / 2, message.deliveryState);
+                       }
+
+                       canvas->setTextColor(TFT_SILVER);
+                       canvas->drawString(lineText, cursorX, cursorY);
+                     });
 }
 
 void drawUserPresenceWindow()
 {
-  // TODO: order by last seen
   int entryYOffset = 20;
   int rowHeight = m + canvas->fontHeight() + m;
   int rowCount = (wh - entryYOffset) / rowHeight;
@@ -391,48 +351,49 @@ void drawUserPresenceWindow()
     canvas->drawLine(10, 3 * m + canvas->fontHeight() + i, ww - 10, 3 * m + canvas->fontHeight() + i, UX_COLOR_LIGHT);
   }
 
+  // most recently seen first
   canvas->setTextDatum(top_left);
-  for (int i = 0; i < presence.size(); i++)
-  {
-    // only display presences that match the current mode
-    if (espNowMode && !presence[i].isEspNow ||
-        !espNowMode && presence[i].isEspNow)
-    {
-      continue;
-    }
-
-    int cursorY = entryYOffset + i * rowHeight;
-    int lastSeenSecs = (millis() - presence[i].lastSeenMillis) / 1000;
-
-    String lastSeenString = String(lastSeenSecs) + "s"; // show seconds by default
-    if (lastSeenSecs > 60 * 60 * 3)                     // show hours after 3h
-    {
-      lastSeenString = String(lastSeenSecs / (60 * 60)) + "h";
-    }
-    else if (lastSeenSecs > PRESENCE_TIMEOUT_MS / 1000) // show minutes after 5m
-    {
-      lastSeenString = String(lastSeenSecs / 60) + "m";
-    }
-
-    String userPresenceString = String(presence[i].username.c_str()) + "RSSI: " + String(presence[i].rssi) + ", last seen: " + lastSeenString;
-    int usernameWidth = canvas->fontWidth() * (presence[i].username.length() + 1);
-    int textColor = UX_COLOR_ACCENT2;
-    int borderColor = UX_COLOR_ACCENT;
-
-    canvas->setTextColor(textColor);
-    canvas->drawString(userPresenceString.substring(0, presence[i].username.length()), cursorX, cursorY);
-    canvas->drawRoundRect(cursorX - 2, cursorY - 2, usernameWidth - 3, canvas->fontHeight() + 4, 2, borderColor);
-
-    canvas->setTextColor(TFT_SILVER);
-    canvas->drawString(userPresenceString.substring(presence[i].username.length()), cursorX + usernameWidth, cursorY);
-
-    linesDrawn++;
-
-    if (linesDrawn >= rowCount)
-    {
-      break;
-    }
-  }
+  presence.forEachByRecency([&](const Presence &user)
+                            {
+                              // only display presences that match the current mode
+                              if (user.isEspNow != espNowMode)
+                              {
+                                return true;
+                              }
+
+                              int cursorY = entryYOffset + linesDrawn * rowHeight;
+                              int lastSeenSecs = (millis() - user.lastSeenMillis) / 1000;
+
+                              char lastSeenString[12];
+                              if (lastSeenSecs > 60 * 60 * 3) // show hours after 3h
+                              {
+                                snprintf(lastSeenString, sizeof(lastSeenString), "%dh", lastSeenSecs / (60 * 60));
+                              }
+                              else if (lastSeenSecs > presence.timeout() / 1000) // show minutes once expired
+                              {
+                                snprintf(lastSeenString, sizeof(lastSeenString), "%dm", lastSeenSecs / 60);
+                              }
+                              else // show seconds by default
+                              {
+                                snprintf(lastSeenString, sizeof(lastSeenString), "%ds", lastSeenSecs);
+                              }
+
+                              char userPresenceString[48];
+                              snprintf(userPresenceString, sizeof(userPresenceString), "RSSI: %d, last seen: %s", user.rssi, lastSeenString);
+                              int usernameWidth = canvas->fontWidth() * (strlen(user.username) + 1);
+                              int textColor = UX_COLOR_ACCENT2;
+                              int borderColor = UX_COLOR_ACCENT;
+
+                              canvas->setTextColor(textColor);
+                              canvas->drawString(user.username, cursorX, cursorY);
+                              canvas->drawRoundRect(cursorX - 2, cursorY - 2, usernameWidth - 3, canvas->fontHeight() + 4, 2, borderColor);
+
+                              canvas->setTextColor(TFT_SILVER);
+                              canvas->drawString(userPresenceString, cursorX + usernameWidth, cursorY);
+
+                              linesDrawn++;
+                              return linesDrawn < rowCount;
+                            });
 }
 
 void drawSettingsWindow()
@@ -464,15 +425,10 @@ void drawSettingsWindow()
 
   String writeConfigSetting;
   int writeConfigSettingColor = 0;
-  switch (sdWriteStage)
+  switch (configWriteStage)
   {
   case 0:
-    writeConfigSetting = sdInit ? "Write to SD?" : "No SD found";
-    writeConfigSettingColor = sdInit ? 0 : TFT_YELLOW;
-    break;
-  case 1:
-    writeConfigSetting = "Overwrite?";
-    writeConfigSettingColor = TFT_YELLOW;
+    writeConfigSetting = sdInit ? "Save + SD?" : "Save?";
     break;
   case 2:
     writeConfigSetting = "OK!";
@@ -488,20 +444,27 @@ void drawSettingsWindow()
   settingValues[Settings::Username] = username;
   settingValues[Settings::Brightness] = String(brightness);
   settingValues[Settings::PingMode] = String(pingMode ? "On" : "Off");
-  settingValues[Settings::RepeatMode] = String(repeatMode ? "On" : "Off");
+  settingValues[Settings::RelayMode] = String(relayMode ? "On" : "Off");
+  settingValues[Settings::AckMode] = String(ackMode ? "On" : "Off");
   settingValues[Settings::EspNowMode] = String(espNowMode ? "On" : "Off");
+  settingValues[Settings::Compression] = String(compressionMode ? "On" : "Off");
+  settingValues[Settings::DutyCycle] = dutyCyclePercent < 100 ? String(dutyCyclePercent) + "%" : String("Off");
   settingValues[Settings::WriteConfig] = writeConfigSetting;
   settingValues[Settings::LoRaSettings] = loraSetting;
+  settingValues[Settings::BootTimes] = bootProfile.isComplete() ? String(bootProfile.millisAt(BootRadio)) + " ms" : String("...");
 
   int settingColors[SettingsCount];
   settingColors[Settings::Username] = username.length() < MinUsernameLength ? TFT_RED : (activeSettingIndex == Settings::Username ? TFT_GREEN : 0);
   settingColors[Settings::Brightness] = 0;
   settingColors[Settings::PingMode] = pingMode ? TFT_GREEN : TFT_RED;
-  settingColors[Settings::RepeatMode] = repeatMode ? TFT_GREEN : TFT_RED;
+  settingColors[Settings::RelayMode] = relayMode ? TFT_GREEN : TFT_RED;
+  settingColors[Settings::AckMode] = ackMode ? TFT_GREEN : TFT_RED;
   settingColors[Settings::EspNowMode] = espNowMode ? TFT_GREEN : TFT_RED;
-  ;
+  settingColors[Settings::Compression] = compressionMode ? TFT_GREEN : TFT_RED;
+  settingColors[Settings::DutyCycle] = dutyCyclePercent < 100 ? TFT_GREEN : TFT_RED;
   settingColors[Settings::WriteConfig] = writeConfigSettingColor;
   settingColors[Settings::LoRaSettings] = loraSettingColor;
+  settingColors[Settings::BootTimes] = 0;
 
   canvas->setTextColor(TFT_SILVER);
   canvas->setTextDatum(top_center);
@@ -512,9 +475,14 @@ void drawSettingsWindow()
     canvas->drawLine(10, 3 * m + canvas->fontHeight() + i, ww - 10, 3 * m + canvas->fontHeight() + i, UX_COLOR_LIGHT);
   }
 
-  for (int i = 0; i < SettingsCount; i++)
+  // scroll the list to keep the active setting in view
+  int rowHeight = m + canvas->fontHeight() + m;
+  int rowCount = (wh - settingYOffset - canvas->fontHeight()) / rowHeight + 1;
+  int firstRow = std::max(0, activeSettingIndex - rowCount + 1);
+
+  for (int i = firstRow; i < SettingsCount && i < firstRow + rowCount; i++)
   {
-    int settingY = settingYOffset + i * (m + canvas->fontHeight() + m);
+    int settingY = settingYOffset + (i - firstRow) * rowHeight;
     int settingColor = i == activeSettingIndex ? COLOR_ORANGE : TFT_SILVER;
 
     canvas->setTextColor(settingColor);
@@ -527,6 +495,35 @@ void drawSettingsWindow()
   }
 }
 
+// opened from the Boot Times setting, when each phase was reached and how long it took
+void drawBootProfileWindow()
+{
+  int entryYOffset = 20;
+  int rowHeight = canvas->fontHeight() + 1;
+
+  canvas->setTextColor(TFT_SILVER);
+  canvas->setTextDatum(top_center);
+  canvas->drawString("Boot Times", ww / 2, 2 * m);
+  for (int i = 0; i <= 1; i++)
+  {
+    canvas->drawLine(10, 3 * m + canvas->fontHeight() + i, ww - 10, 3 * m + canvas->fontHeight() + i, UX_COLOR_LIGHT);
+  }
+
+  canvas->setTextDatum(top_left);
+  for (uint8_t i = 0; i < BootPhaseCount; i++)
+  {
+    BootPhase phase = (BootPhase)i;
+    char row[40];
+    if (bootProfile.has(phase))
+      snprintf(row, sizeof(row), "%-11s %5lu ms  +%lu ms", BootPhaseNames[i], bootProfile.millisAt(phase), bootProfile.phaseMillis(phase));
+    else
+      snprintf(row, sizeof(row), "%-11s     -", BootPhaseNames[i]);
+
+    canvas->setTextColor(phase == BootFirstFrame || phase == BootRadio ? UX_COLOR_ACCENT2 : TFT_SILVER);
+    canvas->drawString(row, 4 * m, entryYOffset + i * rowHeight);
+  }
+}
+
 void drawMainWindow()
 {
   canvas->fillSprite(BG_COLOR);
@@ -546,7 +543,10 @@ void drawMainWindow()
     drawUserPresenceWindow();
     break;
   case SettingsTabIndex:
-    drawSettingsWindow();
+    if (showBootProfile)
+      drawBootProfileWindow();
+    else
+      drawSettingsWindow();
     break;
   }
 
@@ -568,240 +568,278 @@ bool sdCardInit()
   return sdInit;
 }
 
-void readConfigFromSd()
+// mounts the card while setup() draws the first frame, setup() waits for it before opening the chat logs
+void sdMountTask(void *pvParameters)
 {
-  M5Cardputer.update();
+  if (!sdInit)
+    sdCardInit();
+  markBootPhase(BootSdMount);
 
-  if (!sdInit && !sdCardInit())
-  {
-    return;
-  }
+  xTaskNotifyGive(setupTaskHandle);
+  vTaskDelete(NULL);
+}
 
-  File configFile = SD.open(SettingsFilename, FILE_READ);
-  if (!configFile)
+void wakeUi()
+{
+  xEventGroupSetBits(uiEvents, UiQueuedEvent);
+}
+
+void refreshUi()
+{
+  xEventGroupSetBits(uiEvents, UiRefreshEvent);
+}
+
+void refreshTimerCallback(TimerHandle_t timer)
+{
+  refreshUi();
+}
+
+void wakeStorageTask()
+{
+  if (storageTaskHandle != NULL)
+    xTaskNotifyGive(storageTaskHandle);
+}
+
+void storageTask(void *pvParameters)
+{
+  // the only task that touches the card once setup() is done, others queue writes and log reads for it
+  while (1)
   {
-    log_w("config file not found: %s", SettingsFilename.c_str());
-    return;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(StorageFlushMillis / 4));
+    while (processStorage(millis()))
+      ;
   }
+}
 
-  log_w("reading config file: %s", SettingsFilename.c_str());
+const char *ChatLogDirectory = "/LoRaChat";
+const char *ScreenshotIndexFilename = "/LoRaChat/screenshot.idx";
 
-  while (configFile.available())
+// the SD card behind the storage queue, only the storage task uses it once setup() is done
+class SdStorage : public StorageSink
+{
+public:
+  // chat logs stay open for the session to read anywhere and append at the end
+  bool open(uint8_t file, const char *path)
   {
-    String line = configFile.readStringUntil('\n');
-    String name = line.substring(0, line.indexOf('='));
-    String value = line.substring(line.indexOf('=') + 1);
+    paths[file] = path;
+    files[file] = SD.open(path, "a+", true);
+    return files[file];
+  }
 
-    name.trim();
-    name.toLowerCase();
-    value.trim();
-    value.toLowerCase();
+  void setPath(uint8_t file, const String &path) { paths[file] = path; }
 
-    if (name == "username")
-    {
-      username = value.substring(0, MaxUsernameLength);
-      log_w("username: %s", username);
-    }
-    else if (name == "brightness")
-    {
-      brightness = value.toInt();
-      log_w("brightness: %s", String(brightness));
-    }
-    else if (name == "pingmode")
-    {
-      pingMode = (value == "true" || value == "1" || value == "on");
-      log_w("pingMode: %s", String(pingMode));
-    }
-    else if (name == "repeatmode")
+  // the next screenshot number is kept on the card, only probed for if it was never saved
+  void beginScreenshots()
+  {
+    File indexFile = SD.open(ScreenshotIndexFilename, FILE_READ);
+    if (indexFile)
     {
-      repeatMode = (value == "true" || value == "1" || value == "on");
-      log_w("repeatMode: %s", String(repeatMode));
+      screenshotIndex = indexFile.parseInt();
+      indexFile.close();
+      return;
     }
-    else if (name == "espnowmode")
+
+    while (SD.exists(screenshotPath(screenshotIndex)))
+      screenshotIndex++;
+  }
+
+  bool replace(uint8_t file) override
+  {
+    files[file].close();
+    if (file == StorageScreenshot)
     {
-      espNowMode = (value == "true" || value == "1" || value == "on");
-      log_w("espNowMode: %s", String(espNowMode));
+      paths[file] = screenshotPath(screenshotIndex++);
+      File indexFile = SD.open(ScreenshotIndexFilename, FILE_WRITE);
+      if (indexFile)
+      {
+        indexFile.print(screenshotIndex);
+        indexFile.close();
+      }
+      log_w("saving screenshot to %s", paths[file].c_str());
     }
+    files[file] = SD.open(paths[file], FILE_WRITE);
+    return files[file];
   }
 
-  configFile.close();
-}
-
-bool writeConfigToSd()
-{
-  if (!sdInit && !sdCardInit())
+  bool append(uint8_t file, const uint8_t *data, size_t length) override
   {
-    log_w("cannot initialize SD card");
-    return false;
+    return files[file] && files[file].write(data, length) == length;
   }
 
-  File configFile = SD.open(SettingsFilename, FILE_WRITE);
-  if (!configFile)
+  bool sync(uint8_t file) override
   {
-    return false;
+    if (!files[file])
+      return false;
+    files[file].flush();
+    return true;
   }
 
-  log_w("writing config file: %s", SettingsFilename.c_str());
-
-  char configLine[100];
-
-  sprintf(configLine, "username=%s", username.c_str());
-  log_w("writing line: %s", configLine);
-  configFile.println(configLine);
-
-  sprintf(configLine, "brightness=%s", String(brightness).c_str());
-  log_w("writing line: %s", configLine);
-  configFile.println(configLine);
+  bool read(uint8_t file, size_t offset, void *data, size_t length) override
+  {
+    return files[file] && files[file].seek(offset) && files[file].read((uint8_t *)data, length) == length;
+  }
 
-  sprintf(configLine, "pingMode=%s", pingMode ? "on" : "off");
-  log_w("writing line: %s", configLine);
-  configFile.println(configLine);
+  size_t size(uint8_t file) override { return files[file] ? files[file].size() : 0; }
 
-  sprintf(configLine, "repeatMode=%s", repeatMode ? "on" : "off");
-  log_w("writing line: %s", configLine);
-  configFile.println(configLine);
+private:
+  static String screenshotPath(int index) { return "/screenshot." + String(index) + ".bmp"; }
 
-  sprintf(configLine, "espNowMode=%s", espNowMode ? "on" : "off");
-  log_w("writing line: %s", configLine);
-  configFile.println(configLine);
+  File files[StorageFileCount];
+  String paths[StorageFileCount];
+  int screenshotIndex = 0;
+};
 
-  configFile.flush();
-  configFile.close();
-  return true;
-}
+SdStorage sdStorage;
+QueuedLogFile chatLogFiles[ChatTabCount];
+QueuedLogFile chatIndexFiles[ChatTabCount];
 
-void createFrame(int channel, const String &messageText, uint8_t *frameData, size_t &frameDataLength)
+// puts the mounted card behind the storage queue and opens the chat logs
+void storageInit()
 {
-  // Ensure the data array has enough space
-  // if (length < sizeof(message) + strlen(message.text) + 1) {
-  //   std::cerr << "Error: Insufficient space to create the message." << std::endl;
-  //   return;
-  // }
-  log_w("creating frame: |%d|%d|%s|%s|", channel, messageNonce, username, messageText);
-  frameDataLength = 0;
-
-  frameData[0] = (messageNonce & 0x3F) | ((channel & 0x03) << 6);
-  frameDataLength += 1;
+  if (!sdInit && !sdCardInit())
+    return;
 
-  size_t usernameByteLength = std::min(username.length() + 1, (unsigned int)MaxUsernameLength + 1);
-  memcpy(frameData + frameDataLength, username.c_str(), usernameByteLength);
-  frameDataLength += usernameByteLength;
+  storage = &sdStorage;
+  storageWake = wakeStorageTask;
+  storageQueue.setWake(wakeStorageTask);
+  sdStorage.setPath(StorageConfig, SettingsFilename);
 
-  size_t messageTextByteLength = std::min(messageText.length() + 1, (unsigned int)MaxMessageLength + 1);
-  if (messageTextByteLength > 1)
+  SD.mkdir(ChatLogDirectory);
+  sdStorage.beginScreenshots();
+  for (uint8_t i = 0; i < ChatTabCount; i++)
   {
-  memcpy(frameData + frameDataLength, messageText.c_str(), messageTextByteLength);
-  frameDataLength += messageTextByteLength;
+    char logPath[32], indexPath[32];
+    snprintf(logPath, sizeof(logPath), "%s/chat%c.log", ChatLogDirectory, 'A' + i);
+    snprintf(indexPath, sizeof(indexPath), "%s/chat%c.idx", ChatLogDirectory, 'A' + i);
+
+    chatLogFiles[i].begin(&sdStorage, &storageQueue, StorageChatLog + i);
+    chatIndexFiles[i].begin(&sdStorage, &storageQueue, StorageChatIndex + i);
+    if (sdStorage.open(StorageChatLog + i, logPath) && sdStorage.open(StorageChatIndex + i, indexPath) &&
+        beginChatLog(i, &chatLogFiles[i], &chatIndexFiles[i]))
+      log_w("chat log %s: %u messages, %u recovered", logPath, chatTab[i].log.size(), chatTab[i].log.recoveredCount());
+    else
+      log_e("cannot open chat log %s", logPath);
   }
 }
 
-void parseFrame(const uint8_t *frameData, size_t frameDataLength, Message &message)
+Config currentConfig()
 {
-  if (frameDataLength < (1 + MinUsernameLength + 1) || frameDataLength > (1 + MaxUsernameLength + 1 + MaxMessageLength + 1)) // TODO: test
-    return;
-
-  size_t frameBytesRead = 0;
-
-  message.nonce = (frameData[0] & 0x3F);
-  message.channel = ((frameData[0] >> 6) & 0x03);
-  frameBytesRead += 1;
-
-  message.username = String((const char *)(frameData + frameBytesRead), MaxUsernameLength).c_str();
-  frameBytesRead += message.username.length() + 1;
-
-  size_t messageLength = frameDataLength - frameBytesRead;
-  message.text = String((const char *)(frameData + frameBytesRead), messageLength).c_str();
+  Config config;
+  copyToBuffer(config.username, sizeof(config.username), username.c_str(), username.length());
+  config.brightness = brightness;
+  config.dutyCyclePercent = dutyCyclePercent;
+  config.set(ConfigFlags::PingMode, pingMode);
+  config.set(ConfigFlags::RelayMode, relayMode);
+  config.set(ConfigFlags::AckMode, ackMode);
+  config.set(ConfigFlags::EspNowMode, espNowMode);
+  config.set(ConfigFlags::Compression, compressionMode);
+  return config;
+}
 
-  log_w("parsed frame: |%d|%d|%s|%s|", message.channel, message.nonce, message.username, message.text.c_str());
+void applyConfig(const Config &config)
+{
+  username = config.username;
+  brightness = config.brightness;
+  dutyCyclePercent = config.dutyCyclePercent;
+  pingMode = config.has(ConfigFlags::PingMode);
+  relayMode = config.has(ConfigFlags::RelayMode);
+  ackMode = config.has(ConfigFlags::AckMode);
+  espNowMode = config.has(ConfigFlags::EspNowMode);
+  compressionMode = config.has(ConfigFlags::Compression);
 }
 
-bool sendMessage(int channel, const String &messageText, Message &sentMessage)
+bool readConfigFromNvs(Config &config)
 {
-  uint8_t frameData[201]; // TODO: correct max size
-  size_t frameDataLength;
-  createFrame(channel, messageText, frameData, frameDataLength);
+  Preferences preferences;
+  if (!preferences.begin(PreferencesNamespace, true))
+    return false;
 
-  log_w("sending frame: %s", getHexString(frameData, frameDataLength).c_str());
+  uint8_t blob[64];
+  size_t length = preferences.getBytesLength(ConfigKey);
+  bool isRead = length > 0 && length <= sizeof(blob) && preferences.getBytes(ConfigKey, blob, length) == length &&
+                unpackConfig(blob, length, config);
+  preferences.end();
+  return isRead;
+}
 
-  int result;
-  if (!espNowMode && (result = lora.SendFrame(loraConfig, frameData, frameDataLength)) == 0 ||
-      espNowMode && (result = esp_now_send(espNowBroadcastAddress, frameData, frameDataLength)) == ESP_OK)
-  {
-    sentMessage.channel = channel;
-    sentMessage.nonce = messageNonce++;
-    sentMessage.username = "";
-    sentMessage.text = chatTab[activeTabIndex].messageBuffer;
-    sentMessage.isEspNow = espNowMode;
-    sentMessage.rssi = 0;
+bool writeConfigToNvs(const Config &config)
+{
+  Preferences preferences;
+  if (!preferences.begin(PreferencesNamespace, false))
+    return false;
 
-    lastTx = millis();
-    updateDelay = 0;
+  uint8_t blob[ConfigBlobLength];
+  size_t length = packConfig(config, blob);
+  bool isWritten = preferences.putBytes(ConfigKey, blob, length) == length;
+  preferences.end();
+  return isWritten;
+}
 
-    return true;
-  }
-  else
+// the text file from the SD card, read a chunk at a time into a single line buffer
+bool importConfigFromSd(Config &config)
+{
+  File configFile = SD.open(SettingsFilename, FILE_READ);
+  if (!configFile)
   {
-    if (espNowMode)
-      log_e("error sending esp-now frame: %s", esp_err_to_name(result));
-    else
-      log_e("error sending LoRa frame: %d", result);
+    log_w("config file not found: %s", SettingsFilename.c_str());
+    return false;
   }
 
-  return false;
+  ConfigParser parser;
+  char chunk[64];
+  size_t settings = 0;
+  int length;
+  while ((length = configFile.read((uint8_t *)chunk, sizeof(chunk))) > 0)
+    settings += parser.feed(chunk, length, config);
+  settings += parser.finish(config);
+  configFile.close();
+
+  log_w("imported %u settings from %s", settings, SettingsFilename.c_str());
+  return settings > 0;
 }
 
-void receiveMessage(const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow)
+// NVS first, the SD card file only when NVS has no settings yet
+void loadConfig()
 {
-  log_w("received frame: %s", getHexString(frameData, frameDataLength).c_str());
-
-  Message message;
-  parseFrame(frameData, frameDataLength, message);
-  message.isEspNow = isEspNow;
-  message.rssi = rssi;
-  lastRx = millis();
-  updateDelay = 0;
-
-  // TODO: check nonce, replay for basic meshing
-
-  if (recordPresence(message) && !repeatMode && millis() - lastTx > 1000)
+  Config config;
+  if (readConfigFromNvs(config))
   {
-    log_w("new presence, sending response ping");
-    Message sentMessage;
-    sendMessage(PING_CHANNEL, "", sentMessage);
+    log_w("config read from NVS");
   }
-
-  if (message.text.isEmpty())
-    return;
-
-  chatTab[message.channel].messages.push_back(message);
-  receivedMessage = true;
-
-  if (repeatMode)
+  else if ((sdInit || sdCardInit()) && importConfigFromSd(config))
   {
-    String response = String("name: " + String(message.username) + ", msg: " + String(message.text) + ", rssi: " + String(rssi));
-    Message sentMessage;
-    if (sendMessage(message.channel, response, sentMessage))
-    {
-      chatTab[activeTabIndex].messages.push_back(sentMessage);
-    }
+    writeConfigToNvs(config);
   }
+  applyConfig(config);
 }
 
-void pingTask(void *pvParameters)
+// export for the storage task to write, false if there is no card or no room
+bool exportConfigToSd(const Config &config)
 {
-  // send out a ping every so often during inactivity to keep presence for other users
-  Message sentMessage;
-  sendMessage(PING_CHANNEL, PING_MESSAGE, sentMessage);
+  char text[256];
+  size_t length = formatConfig(config, text, sizeof(text));
+  if (storage == NULL || length == 0 || !storageQueue.write(StorageConfig, text, length, true, millis()))
+    return false;
+
+  log_w("exporting config to %s", SettingsFilename.c_str());
+  wakeStorageTask();
+  return true;
+}
 
+void wakeTxTask()
+{
+  if (txTaskHandle != NULL)
+    xTaskNotifyGive(txTaskHandle);
+}
+
+void txTask(void *pvParameters)
+{
+  // the only task that sends, so a slow UART or a paced burst of fragments never stalls typing or receiving
   while (1)
   {
-    unsigned long pingInterval = espNowMode ? ESP_NOW_PING_INTERVAL_MS : LORA_PING_INTERVAL_MS;
-    if (pingMode && millis() - lastTx > pingInterval)
-    {
-      sendMessage(PING_CHANNEL, PING_MESSAGE, sentMessage);
-    }
-
-    delay(1000);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    while (processTxQueue())
+      ;
   }
 }
 
@@ -812,8 +850,9 @@ void espNowOnReceive(const uint8_t *mac, const uint8_t *data, int dataLength)
   wifi_promiscuous_pkt_t *promiscuous_pkt = (wifi_promiscuous_pkt_t *)(data - sizeof(wifi_pkt_rx_ctrl_t) - sizeof(espnow_frame_format_t));
   wifi_pkt_rx_ctrl_t *rx_ctrl = &promiscuous_pkt->rx_ctrl;
 
-  log_w("esp-now frame received, rssi: %d", rx_ctrl->rssi);
-  receiveMessage(data, dataLength, rx_ctrl->rssi, true);
+  // runs in the WiFi task, hand the raw frame off to the UI task
+  if (!queueReceivedFrame(data, dataLength, rx_ctrl->rssi, true))
+    log_w("esp-now receive queue full, dropping frame");
 }
 
 void espNowInit()
@@ -847,6 +886,7 @@ void espNowInit()
 
   esp_now_register_recv_cb(espNowOnReceive);
 
+  transport = &espNowTransport;
   isEspNowInit = true;
 }
 
@@ -870,8 +910,9 @@ void loraReceiveTask(void *pvParameters)
   {
     if (lora.RecieveFrame(&loraFrame) == 0)
     {
-      log_w("lora frame received, rssi: %d", loraFrame.rssi);
-      receiveMessage(loraFrame.recv_data, loraFrame.recv_data_len, loraFrame.rssi, false);
+      log_d("lora frame received, rssi: %d", loraFrame.rssi);
+      if (!queueReceivedFrame(loraFrame.recv_data, loraFrame.recv_data_len, loraFrame.rssi, false))
+        log_w("LoRa receive queue full, dropping frame");
     }
 
     delay(1);
@@ -893,6 +934,7 @@ void loraInit()
   lora.InitLoRaSetting(loraConfig);
   xTaskCreateUniversal(loraReceiveTask, "loraReceiveTask", 8192, NULL, 1, &loraReceiveTaskHandle, APP_CPU_NUM);
 
+  transport = &loraTransport;
   isLoraInit = true;
 }
 
@@ -912,44 +954,99 @@ void loraDeinit()
   isLoraInit = false;
 }
 
-bool updateStringFromInput(Keyboard_Class::KeysState keyState, String &str, int maxLength = 255, bool alphaNumericOnly = false)
+// transmit task, between frames: tears down the radio in use and brings up the one espNowMode asks for
+void swapRadio()
 {
-  bool updated = false;
+  if (transport != NULL && transport->isEspNow() == espNowMode)
+    return; // toggled back before the swap
 
-  for (auto i : keyState.word)
+  if (espNowMode)
   {
-    if (str.length() >= maxLength)
-    {
-      log_e("max length reached (%d): [%s]!+[%s]", maxLength, str.c_str(), String(i).c_str());
-    }
-    else if (alphaNumericOnly && !std::isalnum(i))
-    {
-      log_e("non-alphanumeric character: [%s]!+[%s]", str.c_str(), String(i).c_str());
-    }
-    else
-    {
-      str += i;
-      updated = true;
-    }
+    loraDeinit();
+    espNowInit();
   }
+  else
+  {
+    espNowDeinit();
+    loraInit();
+  }
+}
+
+// brings up the radio from the saved setting while setup() carries on, the UART handshake with the
+// LoRa module or the WiFi start takes longer than the rest of setup()
+void radioBootTask(void *pvParameters)
+{
+  if (espNowMode)
+    espNowInit();
+  else
+    loraInit();
+
+  // nothing is sent before there is a radio, messages queued meanwhile wait for it
+  txWake = wakeTxTask;
+  transportSwap = swapRadio;
+  xTaskCreateUniversal(txTask, "txTask", 8192, NULL, 2, &txTaskHandle, APP_CPU_NUM);
+  isRadioBooting = false;
+  markBootPhase(BootRadio);
+  wakeUi(); // starts beaconing
 
-  if (keyState.del && str.length() > 0)
+  vTaskDelete(NULL);
+}
+
+bool updateStringFromInput(const KeyEvent &key, String &str, int maxLength = 255, bool alphaNumericOnly = false)
+{
+  if (key.kind == KeyDel && str.length() > 0)
   {
     str.remove(str.length() - 1);
-    updated = true;
+    return true;
+  }
+
+  if (key.kind != KeyChar)
+  {
+    return false;
+  }
+
+  if (str.length() >= maxLength)
+  {
+    log_e("max length reached (%d): [%s]!+[%c]", maxLength, str.c_str(), key.c);
+    return false;
   }
 
-  return updated;
+  if (alphaNumericOnly && !std::isalnum(key.c))
+  {
+    log_e("non-alphanumeric character: [%s]!+[%c]", str.c_str(), key.c);
+    return false;
+  }
+
+  str += key.c;
+  return true;
 }
 
-void handleChatTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawFlags)
+void handleChatTabInput(const KeyEvent &key, uint8_t &redrawFlags)
 {
-  if (updateStringFromInput(keyState, chatTab[activeTabIndex].messageBuffer))
+  // fn + up/down scrolls a line, fn + left/right a page, drawChatWindow() clamps viewIndex
+  if (key.fn)
+  {
+    char c = key.kind == KeyChar ? key.c : '\0';
+    int &viewIndex = chatTab[activeTabIndex].viewIndex;
+    if (c == ';' || c == '.')
+    {
+      viewIndex = std::max(0, viewIndex + (c == ';' ? 1 : -1));
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    else if (c == ',' || c == '/')
+    {
+      viewIndex = std::max(0, viewIndex + (c == ',' ? ChatScrollPageLines : -ChatScrollPageLines));
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    return;
+  }
+
+  if (updateStringFromInput(key, chatTab[activeTabIndex].messageBuffer, MaxMessageLength))
   {
     redrawFlags |= RedrawFlags::MainWindow;
   }
 
-  if (keyState.enter)
+  if (key.kind == KeyEnter)
   {
     // log_w(chatTab[activeTabIndex].messageBuffer.c_str());
 
@@ -961,32 +1058,43 @@ void handleChatTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawFlags
       return;
     }
 
-    Message sentMessage;
-    if (sendMessage(activeTabIndex, chatTab[activeTabIndex].messageBuffer, sentMessage))
-    {
-      chatTab[activeTabIndex].messages.push_back(sentMessage);
-    }
-    else
+    // sent by the transmit task, history is appended by the UI task once it is
+    const String &messageBuffer = chatTab[activeTabIndex].messageBuffer;
+    if (!queueMessage(TxChat, activeTabIndex, messageBuffer.c_str(), messageBuffer.length()))
     {
-      sentMessage.text = "send failed";
-      chatTab[activeTabIndex].messages.push_back(sentMessage);
+      log_w("tx queue full, keeping message");
+      return;
     }
 
     chatTab[activeTabIndex].messageBuffer.clear();
+    chatTab[activeTabIndex].viewIndex = 0; // back to the newest messages
     redrawFlags |= RedrawFlags::MainWindow;
   }
 }
 
-void handleSettingsTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawFlags)
+void handleSettingsTabInput(const KeyEvent &key, uint8_t &redrawFlags)
 {
-  if (M5Cardputer.Keyboard.isKeyPressed(';'))
+  char c = key.kind == KeyChar ? key.c : '\0';
+
+  // the boot times cover the settings until closed
+  if (showBootProfile)
+  {
+    if (key.kind == KeyEnter || key.kind == KeyDel)
+    {
+      showBootProfile = false;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    return;
+  }
+
+  if (c == ';')
   {
     activeSettingIndex = (activeSettingIndex == 0)
                              ? SettingsCount - 1
                              : activeSettingIndex - 1;
     redrawFlags |= RedrawFlags::MainWindow;
   }
-  if (M5Cardputer.Keyboard.isKeyPressed('.'))
+  if (c == '.')
   {
     activeSettingIndex = (activeSettingIndex + 1) % SettingsCount;
     redrawFlags |= RedrawFlags::MainWindow;
@@ -995,99 +1103,111 @@ void handleSettingsTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawF
   switch (activeSettingIndex)
   {
   case Settings::Username:
-    if (updateStringFromInput(keyState, username, MaxUsernameLength, true))
+    if (updateStringFromInput(key, username, MaxUsernameLength, true))
     {
       redrawFlags |= RedrawFlags::SystemBar | RedrawFlags::MainWindow;
     }
     break;
   case Settings::Brightness:
-    for (auto c : keyState.word)
+    if (c == ',' || c == '/')
     {
-      if (c == ',' || c == '/')
-      {
-        brightness = (c == ',')
-                         ? max(0, brightness - 10)
-                         : min(100, brightness + 10);
-        M5Cardputer.Display.setBrightness(brightness);
-        redrawFlags |= RedrawFlags::MainWindow;
-        break;
-      }
+      brightness = (c == ',')
+                       ? max(0, brightness - 10)
+                       : min(100, brightness + 10);
+      M5Cardputer.Display.setBrightness(brightness);
+      redrawFlags |= RedrawFlags::MainWindow;
     }
     break;
   case Settings::PingMode:
-    for (auto c : keyState.word)
+    if (c == ',' || c == '/')
     {
-      if (c == ',' || c == '/')
-      {
-        pingMode = !pingMode;
-        redrawFlags |= RedrawFlags::MainWindow;
-      }
+      pingMode = !pingMode;
+      redrawFlags |= RedrawFlags::MainWindow;
     }
-    if (keyState.enter)
+    if (key.kind == KeyEnter)
     {
       pingMode = !pingMode;
       redrawFlags |= RedrawFlags::MainWindow;
     }
     break;
-  case Settings::RepeatMode:
-    for (auto c : keyState.word)
+  case Settings::RelayMode:
+    if (c == ',' || c == '/')
     {
-      if (c == ',' || c == '/')
-      {
-        repeatMode = !repeatMode;
-        redrawFlags |= RedrawFlags::MainWindow;
-      }
-      break;
+      relayMode = !relayMode;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    if (key.kind == KeyEnter)
+    {
+      relayMode = !relayMode;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    break;
+  case Settings::AckMode:
+    if (c == ',' || c == '/')
+    {
+      ackMode = !ackMode;
+      redrawFlags |= RedrawFlags::MainWindow;
     }
-    if (keyState.enter)
+    if (key.kind == KeyEnter)
     {
-      repeatMode = !repeatMode;
+      ackMode = !ackMode;
       redrawFlags |= RedrawFlags::MainWindow;
     }
     break;
   case Settings::EspNowMode:
-    for (auto c : keyState.word)
+    // not while the radio from the saved setting is still coming up
+    if ((c == ',' || c == '/') && !isRadioBooting)
     {
-      if (c == ',' || c == '/')
-      {
-        espNowMode = !espNowMode;
-
-        if (espNowMode)
-        {
-          loraDeinit();
-          espNowInit();
-        }
-        else
-        {
-          espNowDeinit();
-          loraInit();
-        }
-
-        lastRx = lastTx = 0;
-        maxRssi = -1000;
-        redrawFlags |= RedrawFlags::MainWindow | RedrawFlags::SystemBar;
-      }
+      espNowMode = !espNowMode;
+      requestTransportSwap(); // see swapRadio()
+
+      lastRx = lastTx = 0;
+      maxRssi = -1000;
+      redrawFlags |= RedrawFlags::MainWindow | RedrawFlags::SystemBar;
+    }
+    break;
+  case Settings::Compression:
+    if (c == ',' || c == '/')
+    {
+      compressionMode = !compressionMode;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    if (key.kind == KeyEnter)
+    {
+      compressionMode = !compressionMode;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    break;
+  case Settings::DutyCycle:
+    if (c == ',' || c == '/')
+    {
+      // step through the options, from a value read from the config to the nearest one
+      uint8_t option = 0;
+      while (option < DutyCycleOptionCount - 1 && DutyCycleOptions[option] < dutyCyclePercent)
+        option++;
+      if (c == ',')
+        option = (option == 0) ? 0 : option - 1;
+      else if (DutyCycleOptions[option] <= dutyCyclePercent)
+        option = std::min(option + 1, DutyCycleOptionCount - 1);
+      dutyCyclePercent = DutyCycleOptions[option];
+      airtimeBudget.configure(dutyCyclePercent, millis());
+      redrawFlags |= RedrawFlags::MainWindow | RedrawFlags::SystemBar;
     }
     break;
   case Settings::WriteConfig:
-    if (keyState.enter)
+    if (key.kind == KeyEnter)
     {
-      if (!sdInit)
-        break;
-
-      switch (sdWriteStage)
+      switch (configWriteStage)
       {
       case 0:
-        sdWriteStage++;
-        if (SD.exists(SettingsFilename))
-          break;
-      case 1:
-        sdWriteStage = (writeConfigToSd())
-                           ? sdWriteStage + 1
-                           : sdWriteStage + 2;
+      {
+        // NVS is what boot reads, the SD card gets a copy to edit or carry to another device
+        Config config = currentConfig();
+        configWriteStage = writeConfigToNvs(config) && (!sdInit || exportConfigToSd(config)) ? 2 : 3;
         break;
+      }
       default:
-        sdWriteStage = 0;
+        configWriteStage = 0;
         break;
       }
 
@@ -1095,7 +1215,7 @@ void handleSettingsTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawF
     }
     break;
   case Settings::LoRaSettings:
-    if (keyState.enter)
+    if (key.kind == KeyEnter)
     {
       switch (loraWriteStage)
       {
@@ -1118,11 +1238,18 @@ void handleSettingsTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawF
       redrawFlags |= RedrawFlags::MainWindow;
     }
     break;
+  case Settings::BootTimes:
+    if (key.kind == KeyEnter)
+    {
+      showBootProfile = true;
+      redrawFlags |= RedrawFlags::MainWindow;
+    }
+    break;
   }
 
   if (activeSettingIndex != Settings::WriteConfig)
   {
-    sdWriteStage = 0;
+    configWriteStage = 0;
   }
 
   if (activeSettingIndex != Settings::LoRaSettings)
@@ -1131,67 +1258,133 @@ void handleSettingsTabInput(Keyboard_Class::KeysState keyState, uint8_t &redrawF
   }
 }
 
-void keyboardInputTask(void *pvParameters)
+void handleKeyEvent(const KeyEvent &key, uint8_t &redrawFlags)
 {
-  const unsigned long debounceDelay = 200;
-  unsigned long lastKeyPressMillis = 0;
+  // need to see again with display off
+  if (brightness <= 30 && !(key.kind == KeyChar && key.c == ','))
+  {
+    brightness = 50;
+    M5Cardputer.Display.setBrightness(brightness);
+    redrawFlags |= RedrawFlags::MainWindow;
+  }
 
+  if (activeTabIndex == SettingsTabIndex)
+  {
+    handleSettingsTabInput(key, redrawFlags);
+  }
+  else if (activeTabIndex == UserInfoTabIndex)
+  {
+    // TODO? what sort of input would be useful here?
+  }
+  else
+  {
+    handleChatTabInput(key, redrawFlags);
+  }
+
+  if (key.kind == KeyTab)
+  {
+    activeTabIndex = (activeTabIndex + 1) % TabCount;
+    showBootProfile = false;
+    refreshUi();
+    redrawFlags |= RedrawFlags::TabBar | RedrawFlags::MainWindow;
+  }
+}
+
+// a KeyEvent for each key newly down in the last scan, with the modifiers held in that scan
+void queueKeyEvents(uint64_t newlyPressed, unsigned long now)
+{
+  Keyboard_Class::KeysState keyState = M5Cardputer.Keyboard.keysState();
+  for (const Point2D_t &point : M5Cardputer.Keyboard.keyList())
+  {
+    if (!(newlyPressed & (1ULL << keyIndex(point.x, point.y))))
+      continue;
+
+    KeyValue_t value = M5Cardputer.Keyboard.getKeyValue(point);
+    KeyEvent key;
+    key.millis = now;
+    key.c = '\0';
+    key.fn = keyState.fn;
+    switch ((uint8_t)value.value_first)
+    {
+    case KEY_BACKSPACE:
+      key.kind = KeyDel;
+      break;
+    case KEY_ENTER:
+      key.kind = KeyEnter;
+      break;
+    case KEY_TAB:
+      key.kind = KeyTab;
+      break;
+    case KEY_FN:
+    case KEY_LEFT_SHIFT:
+    case KEY_LEFT_CTRL:
+    case KEY_LEFT_ALT:
+    case KEY_OPT:
+      continue; // modifiers only change the keys pressed with them
+    default:
+      key.kind = KeyChar;
+      key.c = keyState.shift || keyState.ctrl || M5Cardputer.Keyboard.capslocked() ? value.value_second : value.value_first;
+      break;
+    }
+
+    if (!keyEventQueue.push(key))
+      log_w("key event queue full, dropping key");
+  }
+}
+
+// scans the keyboard often while it is in use and rarely when it isn't, see KeyScanner
+void keyboardScanTask(void *pvParameters)
+{
   while (1)
   {
+    unsigned long scanStartMicros = micros();
     M5Cardputer.update();
-    if (M5Cardputer.Keyboard.isChange() && M5Cardputer.Keyboard.isPressed())
-    {
-      uint8_t redrawFlags = RedrawFlags::None;
-      if (millis() - lastKeyPressMillis >= debounceDelay)
-      {
-        lastKeyPressMillis = millis();
-
-        // need to see again with display off
-        if (brightness <= 30 && !M5Cardputer.Keyboard.isKeyPressed(','))
-        {
-          brightness = 50;
-          M5Cardputer.Display.setBrightness(brightness);
-          redrawFlags |= RedrawFlags::MainWindow;
-        }
-
-        Keyboard_Class::KeysState keyState = M5Cardputer.Keyboard.keysState();
-
-        if (activeTabIndex == SettingsTabIndex)
-        {
-          handleSettingsTabInput(keyState, redrawFlags);
-        }
-        else if (activeTabIndex == UserInfoTabIndex)
-        {
-          // TODO? what sort of input would be useful here?
-        }
-        else
-        {
-          handleChatTabInput(keyState, redrawFlags);
-        }
-
-        if (keyState.tab)
-        {
-          activeTabIndex = (activeTabIndex + 1) % TabCount;
-          updateDelay = 0;
-          redrawFlags |= RedrawFlags::TabBar | RedrawFlags::MainWindow;
-        }
-      }
 
-      keyboardRedrawFlags = redrawFlags;
+    uint64_t pressed = 0;
+    for (const Point2D_t &point : M5Cardputer.Keyboard.keyList())
+      pressed |= 1ULL << keyIndex(point.x, point.y);
+
+    uint64_t newlyPressed = keyScanner.update(pressed, millis());
+    if (newlyPressed != 0)
+    {
+      queueKeyEvents(newlyPressed, millis());
+      xEventGroupSetBits(uiEvents, UiKeyEvent);
     }
 
-    if (M5Cardputer.BtnA.isPressed())
+    // once per press, the button is debounced by M5Unified
+    if (M5Cardputer.BtnA.wasPressed() && storage != NULL)
     {
-      saveScreenshot();
+      screenshotRequested = true;
+      xEventGroupSetBits(uiEvents, UiScreenshotEvent);
     }
+
+    keyScanMicros += micros() - scanStartMicros;
+    vTaskDelay(pdMS_TO_TICKS(keyScanner.scanDelay(millis())));
   }
 }
 
 void setup()
 {
+  markBootPhase(BootSetup);
   USBSerial.begin(115200);
   auto cfg = M5.config();
   M5Cardputer.begin(cfg, true);
+  markBootPhase(BootBoard);
+  loadConfig();
+  markBootPhase(BootConfig);
+
+  uiEvents = xEventGroupCreate();
+  uiWake = wakeUi;
+  uiRefresh = refreshUi;
+  refreshTimer = xTimerCreate("refreshTimer", pdMS_TO_TICKS(RefreshMillis), pdFALSE, NULL, refreshTimerCallback);
+
+  // the radio and the SD card are the slowest to come up and need no display, both run on the other core
+  // while the first frame is drawn here
+  airtimeBudget.configure(dutyCyclePercent, millis());
+  setupTaskHandle = xTaskGetCurrentTaskHandle();
+  isRadioBooting = true;
+  xTaskCreateUniversal(radioBootTask, "radioBootTask", 8192, NULL, 1, NULL, PRO_CPU_NUM);
+  xTaskCreateUniversal(sdMountTask, "sdMountTask", 4096, NULL, 1, NULL, PRO_CPU_NUM);
 
   M5Cardputer.Display.init();
   M5Cardputer.Display.setRotation(1);
@@ -1203,49 +1396,61 @@ void setup()
   canvasSystemBar->createSprite(sw, sh);
   canvasTabBar = new M5Canvas(&M5Cardputer.Display);
   canvasTabBar->createSprite(tw, th);
+  markBootPhase(BootDisplay);
 
-  chatTab[0] = {0, {}, "", 0};
-  chatTab[1] = {1, {}, "", 0};
-  chatTab[2] = {2, {}, "", 0};
+  initChatTabs();
   activeTabIndex = 0;
   activeSettingIndex = 0;
 
-  readConfigFromSd();
-
   drawSystemBar();
   drawTabBar();
   drawMainWindow();
-
-  if (espNowMode)
-    espNowInit();
-  else
-    loraInit();
-
-  xTaskCreateUniversal(pingTask, "pingTask", 8192, NULL, 1, NULL, APP_CPU_NUM);
-  xTaskCreateUniversal(keyboardInputTask, "keyboardInputTask", 8192, NULL, 1, NULL, APP_CPU_NUM);
+  markBootPhase(BootFirstFrame);
+
+  // chat history is the UI task's, so the logs are opened here once the card is mounted, frames
+  // received meanwhile wait in the receive queues until loop() runs
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  storageInit();
+  xTaskCreateUniversal(storageTask, "storageTask", 8192, NULL, 1, &storageTaskHandle, APP_CPU_NUM);
+  markBootPhase(BootStorage);
+  if (storage != NULL)
+    drawMainWindow(); // with the messages read back from the log
+
+  xTaskCreateUniversal(keyboardScanTask, "keyboardScanTask", 8192, NULL, 2, NULL, APP_CPU_NUM);
+  xTimerStart(refreshTimer, 0);
+  markBootPhase(BootInput);
 }
 
 void loop()
 {
+  // sleeps until input, a frame, the refresh timer or the next relay, retransmit or beacon is due
+  unsigned long waitMillis = screenshot.isActive() ? ScreenshotPollMillis : processWaitMillis(millis(), MaxUiWaitMillis);
+  EventBits_t events = xEventGroupWaitBits(uiEvents, UiEvents, pdTRUE, pdFALSE, pdMS_TO_TICKS(waitMillis));
   uint8_t redrawFlags = RedrawFlags::None;
 
-  if (keyboardRedrawFlags)
+  // every key pressed since the last wake-up, in order
+  unsigned long keyMillis[KeyEventQueueCapacity];
+  size_t keyCount = 0;
+  KeyEvent key;
+  while (keyEventQueue.pop(key))
   {
-    redrawFlags |= keyboardRedrawFlags;
-    keyboardRedrawFlags = RedrawFlags::None;
+    handleKeyEvent(key, redrawFlags);
+    if (keyCount < KeyEventQueueCapacity)
+      keyMillis[keyCount++] = key.millis;
   }
 
+  processQueuedMessages();
+
   if (receivedMessage)
   {
     redrawFlags |= RedrawFlags::MainWindow;
     receivedMessage = false;
   }
 
-  // redraw occasionally for system bar updates and user info tab
-  if (millis() > updateDelay)
+  // system bar updates and user info tab, every few seconds or sooner after a frame went out or came in
+  if (events & UiRefreshEvent)
   {
-    bool redraw = false;
-    updateDelay = millis() + 5000;
+    unsigned long refreshMillis = RefreshMillis;
 
     int newBatteryPct = M5Cardputer.Power.getBatteryLevel();
     if (newBatteryPct != batteryPct)
@@ -1254,7 +1459,7 @@ void loop()
       redrawFlags |= RedrawFlags::SystemBar;
     }
 
-    int newRssi = getPresenceRssi();
+    int newRssi = getPresenceRssi(espNowMode);
     if (newRssi != maxRssi)
     {
       maxRssi = newRssi;
@@ -1263,16 +1468,42 @@ void loop()
 
     if (millis() - lastRx < RxTxShowDelay * 2 || millis() - lastTx < RxTxShowDelay * 2)
     {
-      updateDelay = millis() + RxTxShowDelay / 2;
+      refreshMillis = RxTxShowDelay / 2;
       redrawFlags |= RedrawFlags::SystemBar;
     }
 
+    if (millis() - lastMemoryStats > MemoryStatsInterval)
+    {
+      lastMemoryStats = millis();
+      logMemoryStats();
+      logInputStats();
+    }
+
     // redraw every second to update last seen times
     if (activeTabIndex == UserInfoTabIndex)
     {
-      updateDelay = millis() + 1000;
+      refreshMillis = std::min(refreshMillis, UserInfoRefreshMillis);
       redrawFlags |= RedrawFlags::MainWindow;
     }
+
+    xTimerChangePeriod(refreshTimer, pdMS_TO_TICKS(refreshMillis), 0);
+  }
+
+  // the canvases hold still while a screenshot is read out of them, a row at a time as the storage queue takes them
+  if (screenshotRequested && !screenshot.isActive())
+  {
+    screenshot.begin(w, h);
+    screenshotRequested = false;
+  }
+  if (screenshot.isActive())
+  {
+    heldRedrawFlags |= redrawFlags;
+    redrawFlags = RedrawFlags::None;
+    if (screenshot.poll(storageQueue, millis(), readScreenRow))
+    {
+      redrawFlags = heldRedrawFlags;
+      heldRedrawFlags = RedrawFlags::None;
+    }
   }
 
   if (redrawFlags & RedrawFlags::TabBar)
@@ -1282,5 +1513,10 @@ void loop()
   if (redrawFlags & RedrawFlags::MainWindow)
     drawMainWindow();
 
-  delay(10);
+  // press to glyph, once what the keys changed is on the screen
+  if (redrawFlags != RedrawFlags::None)
+  {
+    for (size_t i = 0; i < keyCount; i++)
+      keyLatency.add(millis() - keyMillis[i]);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,228 @@
+#pragma once
+
+// fixed capacity chat history, entries live in a ring and their text in a preallocated byte arena
+//
+// both are allocated once by init() and never grow. Text is stored NUL-terminated and contiguous,
+// when it doesn't fit at the end of the arena it wraps to the start. Appending evicts the oldest
+// entries until there is room, each eviction is O(1) since the oldest text is always at the arena head.
+// Older messages read back from the chat log are prepended while there is room, without evicting.
+
+#include <Arduino.h>
+
+#include "common.h"
+
+struct HistoryEntry
+{
+  uint32_t id; // one more than the entry before it, stable while the entry is in the history
+  uint16_t sequence : 14;
+  uint16_t channel : 2;
+  uint8_t deliveryState; // see DeliveryState
+  bool isEspNow;
+  int16_t rssi;
+  char username[MaxUsernameLength + 1]; // empty for own messages
+  uint16_t textOffset;
+  uint16_t textLength;
+};
+
+class MessageHistory
+{
+public:
+  ~MessageHistory()
+  {
+    delete[] entries;
+    delete[] arena;
+  }
+
+  bool init(uint16_t maxMessages, uint16_t arenaBytes)
+  {
+    if (entries != NULL)
+      return false;
+
+    entries = new HistoryEntry[maxMessages];
+    arena = new char[arenaBytes];
+    entryCapacity = maxMessages;
+    arenaCapacity = arenaBytes;
+    clear();
+    return true;
+  }
+
+  void clear()
+  {
+    entryHead = entryCount = 0;
+    arenaHead = arenaTail = 0;
+  }
+
+  // copies the message in, returns NULL if the text can never fit in the arena
+  const HistoryEntry *append(const Message &message)
+  {
+    size_t textLength = strnlen(message.text, sizeof(message.text));
+    size_t bytes = textLength + 1;
+    if (entries == NULL || bytes > arenaCapacity)
+      return NULL;
+
+    if (entryCount == entryCapacity)
+      evictOldest();
+
+    uint16_t offset;
+    while (!reserve(bytes, offset))
+      evictOldest();
+
+    memcpy(arena + offset, message.text, textLength);
+    arena[offset + textLength] = '\0';
+    arenaTail = offset + bytes;
+
+    HistoryEntry &entry = entries[(entryHead + entryCount) % entryCapacity];
+    setEntry(entry, nextId++, message, offset, textLength);
+    entryCount++;
+
+    return &entry;
+  }
+
+  // copies an older message in before the oldest entry, returns NULL if the history or arena is full
+  const HistoryEntry *prepend(const Message &message)
+  {
+    if (entries == NULL || entryCount == entryCapacity)
+      return NULL;
+    if (entryCount == 0)
+      return append(message);
+
+    size_t textLength = strnlen(message.text, sizeof(message.text));
+    size_t bytes = textLength + 1;
+    uint16_t offset;
+    if (!reserveBefore(bytes, offset))
+      return NULL;
+
+    memcpy(arena + offset, message.text, textLength);
+    arena[offset + textLength] = '\0';
+    arenaHead = offset;
+
+    uint32_t id = at(0).id - 1;
+    entryHead = (entryHead + entryCapacity - 1) % entryCapacity;
+    entryCount++;
+    setEntry(entries[entryHead], id, message, offset, textLength);
+    return &entries[entryHead];
+  }
+
+  size_t size() const { return entryCount; }
+  bool isEmpty() const { return entryCount == 0; }
+
+  // 0 is the oldest entry
+  const HistoryEntry &at(size_t index) const { return entries[(entryHead + index) % entryCapacity]; }
+  const HistoryEntry &newest() const { return at(entryCount - 1); }
+  const char *text(const HistoryEntry &entry) const { return arena + entry.textOffset; }
+
+  // entry by id, NULL once it has been evicted
+  HistoryEntry *find(uint32_t id)
+  {
+    if (entryCount == 0 || id < at(0).id || id > newest().id)
+      return NULL;
+    return &entries[(entryHead + (id - at(0).id)) % entryCapacity];
+  }
+
+  size_t memoryBytes() const { return entryCapacity * sizeof(HistoryEntry) + arenaCapacity; }
+  size_t arenaBytesUsed() const
+  {
+    if (entryCount == 0)
+      return 0;
+    return arenaTail > arenaHead ? arenaTail - arenaHead : arenaCapacity - arenaHead + arenaTail;
+  }
+  uint16_t capacity() const { return entryCapacity; }
+  uint32_t evictedCount() const { return evicted; }
+
+private:
+  void setEntry(HistoryEntry &entry, uint32_t id, const Message &message, uint16_t offset, size_t textLength)
+  {
+    entry.id = id;
+    entry.sequence = message.sequence;
+    entry.deliveryState = message.deliveryState;
+    entry.channel = message.channel;
+    entry.isEspNow = message.isEspNow;
+    entry.rssi = message.rssi;
+    memcpy(entry.username, message.username, sizeof(entry.username));
+    entry.username[MaxUsernameLength] = '\0';
+    entry.textOffset = offset;
+    entry.textLength = textLength;
+  }
+
+  void evictOldest()
+  {
+    entryHead = (entryHead + 1) % entryCapacity;
+    entryCount--;
+    evicted++;
+
+    if (entryCount == 0)
+      arenaHead = arenaTail = 0;
+    else
+      arenaHead = at(0).textOffset;
+  }
+
+  // find a contiguous run of bytes after the newest text, used region is [arenaHead, arenaTail)
+  // when arenaTail > arenaHead, otherwise it wraps and is [arenaHead, end) + [0, arenaTail)
+  bool reserve(size_t bytes, uint16_t &offset)
+  {
+    if (entryCount == 0)
+    {
+      offset = 0;
+      return true;
+    }
+
+    if (arenaTail > arenaHead)
+    {
+      if ((size_t)(arenaCapacity - arenaTail) >= bytes)
+      {
+        offset = arenaTail;
+        return true;
+      }
+      if (arenaHead >= bytes)
+      {
+        offset = 0; // wrap, the unused end of the arena is reclaimed when the head wraps too
+        return true;
+      }
+      return false;
+    }
+
+    if ((size_t)(arenaHead - arenaTail) >= bytes)
+    {
+      offset = arenaTail;
+      return true;
+    }
+    return false;
+  }
+
+  // a contiguous run of bytes before the oldest text, the mirror of reserve()
+  bool reserveBefore(size_t bytes, uint16_t &offset)
+  {
+    if (arenaTail > arenaHead)
+    {
+      if (arenaHead >= bytes)
+      {
+        offset = arenaHead - bytes;
+        return true;
+      }
+      if ((size_t)(arenaCapacity - arenaTail) >= bytes)
+      {
+        offset = arenaCapacity - bytes; // wrap, the unused start of the arena is reclaimed with the oldest entry
+        return true;
+      }
+      return false;
+    }
+
+    if ((size_t)(arenaHead - arenaTail) >= bytes)
+    {
+      offset = arenaHead - bytes;
+      return true;
+    }
+    return false;
+  }
+
+  HistoryEntry *entries = NULL;
+  char *arena = NULL;
+  uint16_t entryCapacity = 0;
+  uint16_t arenaCapacity = 0;
+  uint16_t entryHead = 0;
+  uint16_t entryCount = 0;
+  uint16_t arenaHead = 0;
+  uint16_t arenaTail = 0;
+  uint32_t nextId = 1UL << 31; // leaves room for ids of prepended entries below the first
+  uint32_t evicted = 0;
+};
@@ -0,0 +1,127 @@
+// Minimal stand-in for the Arduino core so the chat stack (chat.h, transport.h, ...) can be
+// built for [env:native] and run on a plain Linux box. Only what the shared headers use is here.
+#pragma once
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+typedef uint8_t byte;
+
+// simulated clock, advanced by delay() or directly by the host harness
+unsigned long hostMillis = 0;
+
+inline unsigned long millis() { return hostMillis; }
+inline unsigned long micros() { return hostMillis * 1000; }
+inline void delay(unsigned long ms) { hostMillis += ms; }
+
+inline long random(long howBig) { return howBig <= 0 ? 0 : rand() % howBig; }
+inline long random(long howSmall, long howBig) { return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall); }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+// 0 = none, 1 = error, 2 = warning, 3 = info, 4 = debug
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL 1
+#endif
+
+#define HOST_LOG(level, tag, format, ...)                        \
+  do                                                             \
+  {                                                              \
+    if (HOST_LOG_LEVEL >= level)                                 \
+      fprintf(stderr, "[" tag "] " format "\n", ##__VA_ARGS__); \
+  } while (0)
+
+#define log_e(format, ...) HOST_LOG(1, "E", format, ##__VA_ARGS__)
+#define log_w(format, ...) HOST_LOG(2, "W", format, ##__VA_ARGS__)
+#define log_i(format, ...) HOST_LOG(3, "I", format, ##__VA_ARGS__)
+#define log_d(format, ...) HOST_LOG(4, "D", format, ##__VA_ARGS__)
+
+// subset of the Arduino String API, backed by std::string
+class String
+{
+public:
+  String() {}
+  String(const char *cstr) : str(cstr ? cstr : "") {}
+  String(const char *cstr, unsigned int length) : str(cstr, length) {}
+  String(const std::string &s) : str(s) {}
+  explicit String(char c) : str(1, c) {}
+  explicit String(int value) : str(std::to_string(value)) {}
+  explicit String(unsigned int value) : str(std::to_string(value)) {}
+  explicit String(long value) : str(std::to_string(value)) {}
+  explicit String(unsigned long value) : str(std::to_string(value)) {}
+
+  unsigned int length() const { return str.length(); }
+  const char *c_str() const { return str.c_str(); }
+  bool isEmpty() const { return str.empty(); }
+  void clear() { str.clear(); }
+
+  char operator[](unsigned int index) const { return index < str.length() ? str[index] : 0; }
+  const char *begin() const { return str.data(); }
+  const char *end() const { return str.data() + str.length(); }
+
+  int indexOf(char c) const
+  {
+    size_t index = str.find(c);
+    return index == std::string::npos ? -1 : (int)index;
+  }
+
+  String substring(unsigned int left) const { return left >= str.length() ? String() : String(str.substr(left)); }
+  String substring(unsigned int left, unsigned int right) const
+  {
+    if (left > right)
+      std::swap(left, right);
+    if (left >= str.length())
+      return String();
+    return String(str.substr(left, right - left));
+  }
+
+  void remove(unsigned int index) { str.erase(std::min<size_t>(index, str.length())); }
+  long toInt() const { return atol(str.c_str()); }
+
+  void trim()
+  {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    size_t last = str.find_last_not_of(" \t\r\n");
+    str = (first == std::string::npos) ? std::string() : str.substr(first, last - first + 1);
+  }
+
+  void toLowerCase()
+  {
+    for (auto &c : str)
+      c = tolower(c);
+  }
+
+  String &operator+=(const String &rhs)
+  {
+    str += rhs.str;
+    return *this;
+  }
+  String &operator+=(const char *rhs)
+  {
+    str += rhs;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    str += c;
+    return *this;
+  }
+
+  friend String operator+(const String &lhs, const String &rhs) { return String(lhs.str + rhs.str); }
+  friend String operator+(const String &lhs, const char *rhs) { return String(lhs.str + rhs); }
+  friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs.str); }
+  friend bool operator==(const String &lhs, const String &rhs) { return lhs.str == rhs.str; }
+  friend bool operator==(const String &lhs, const char *rhs) { return lhs.str == rhs; }
+  friend bool operator!=(const String &lhs, const String &rhs) { return lhs.str != rhs.str; }
+
+private:
+  std::string str;
+};
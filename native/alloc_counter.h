@@ -0,0 +1,23 @@
+#pragma once
+
+// counts heap allocations made through operator new, so benchmarks can report allocations per operation
+
+#include <new>
+#include <stdlib.h>
+
+size_t allocationCount = 0;
+
+void *operator new(size_t size)
+{
+  allocationCount++;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
@@ -0,0 +1,40 @@
+#pragma once
+
+// timing helpers for the host benchmarks
+
+#include <chrono>
+
+#include "alloc_counter.h"
+
+// keeps the optimizer from discarding benchmark results
+volatile size_t benchSink = 0;
+
+struct BenchResult
+{
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+template <typename F>
+BenchResult runBench(size_t iterations, F op)
+{
+  // warm up caches and any lazily initialized state
+  for (size_t i = 0; i < iterations / 10 + 1; i++)
+    op(i);
+
+  size_t allocationsBefore = allocationCount;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    op(i);
+  auto end = std::chrono::steady_clock::now();
+
+  BenchResult result;
+  result.nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  result.allocsPerOp = (double)(allocationCount - allocationsBefore) / iterations;
+  return result;
+}
+
+void printBench(const char *name, const BenchResult &result)
+{
+  printf("  %-28s %9.1f ns/op %6.2f allocs/op\n", name, result.nsPerOp, result.allocsPerOp);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+// chat log boot and scroll back cost against log length
+//
+// channel A's log is filled with 1k to 100k corpus messages in memory files, then opened as at boot:
+// file reads and time to open it and load the last screenful, and history memory, should not grow with
+// the log. Scrolling back loads pages until the history is full, checked against the corpus order.
+// Last, a record logged without its index entry (a reset between the two writes) is recovered.
+
+#include <chrono>
+#include <vector>
+
+#include "chat_corpus.h"
+
+// log file in memory, counts reads as the SD card would see them
+class MemoryLogFile : public LogFile
+{
+public:
+  size_t size() override { return bytes.size(); }
+
+  bool read(size_t offset, void *data, size_t length) override
+  {
+    reads++;
+    if (offset + length > bytes.size())
+      return false;
+    memcpy(data, bytes.data() + offset, length);
+    return true;
+  }
+
+  bool append(const void *data, size_t length) override
+  {
+    bytes.insert(bytes.end(), (const uint8_t *)data, (const uint8_t *)data + length);
+    return true;
+  }
+
+  std::vector<uint8_t> bytes;
+  size_t reads = 0;
+};
+
+MemoryLogFile chatLogBenchLog, chatLogBenchIndex;
+
+Message chatLogBenchMessage(size_t i)
+{
+  Message message = {};
+  message.channel = 0;
+  message.isEspNow = false;
+  message.rssi = -60 - (int)(i % 40);
+  copyToBuffer(message.username, sizeof(message.username), i % 3 == 0 ? "" : "bob", i % 3 == 0 ? 0 : 3);
+  const char *text = ChatCorpus[i % ChatCorpusCount];
+  copyToBuffer(message.text, sizeof(message.text), text, strlen(text));
+  return message;
+}
+
+void fillChatLogBench(size_t messageCount)
+{
+  chatLogBenchLog.bytes.clear();
+  chatLogBenchIndex.bytes.clear();
+  ChatLog log;
+  log.begin(&chatLogBenchLog, &chatLogBenchIndex);
+  for (size_t i = 0; i < messageCount; i++)
+    log.append(chatLogBenchMessage(i));
+}
+
+// the history holds the newest messages of the log in order
+bool isChatLogTail(const ChatTab &tab, size_t messageCount)
+{
+  for (size_t i = 0; i < tab.history.size(); i++)
+  {
+    size_t message = messageCount - tab.history.size() + i;
+    if (strcmp(tab.history.text(tab.history.at(i)), ChatCorpus[message % ChatCorpusCount]) != 0 ||
+        (tab.history.at(i).username[0] == '\0') != (message % 3 == 0))
+      return false;
+  }
+  return true;
+}
+
+int runChatLogBench()
+{
+  printf("== bench-chat-log ==\n");
+  printf("  channel A with %u history entries, boot opens the log and loads the last %zu messages\n",
+         ChatTabHistoryMessages[0], ChatLogPageMessages);
+  printf("   messages |  log bytes | boot reads  boot us | scroll back reads | history bytes\n");
+
+  int failures = 0;
+  ChatTab &tab = chatTab[0];
+  size_t bootReads[3];
+  const size_t messageCounts[] = {1000, 10000, 100000};
+  for (size_t i = 0; i < 3; i++)
+  {
+    size_t messageCount = messageCounts[i];
+    fillChatLogBench(messageCount);
+    chatLogBenchLog.reads = chatLogBenchIndex.reads = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    bool isOpen = beginChatLog(0, &chatLogBenchLog, &chatLogBenchIndex);
+    auto end = std::chrono::steady_clock::now();
+    bootReads[i] = chatLogBenchLog.reads + chatLogBenchIndex.reads;
+    failures += !isOpen || tab.history.size() != ChatLogPageMessages || !isChatLogTail(tab, messageCount);
+
+    // scroll back a page at a time, as drawChatWindow() does near the oldest line
+    while (loadOlderMessages(tab, ChatLogPageMessages) > 0)
+      ;
+    size_t scrollReads = chatLogBenchLog.reads + chatLogBenchIndex.reads - bootReads[i];
+    failures += !isChatLogTail(tab, messageCount);
+
+    printf("  %9zu | %10zu | %10zu %8.1f | %17zu | %13zu\n", messageCount, chatLogBenchLog.bytes.size(), bootReads[i],
+           std::chrono::duration<double, std::micro>(end - start).count(), scrollReads, tab.history.memoryBytes());
+  }
+  failures += bootReads[0] != bootReads[2];
+
+  // the last message logged without its index entry, then one more appended after recovery
+  fillChatLogBench(100);
+  chatLogBenchIndex.bytes.resize(chatLogBenchIndex.bytes.size() - LogIndexEntryLength);
+  beginChatLog(0, &chatLogBenchLog, &chatLogBenchIndex);
+  uint32_t recovered = tab.log.recoveredCount();
+  appendToHistory(chatLogBenchMessage(100));
+  beginChatLog(0, &chatLogBenchLog, &chatLogBenchIndex);
+  bool isRecovered = recovered == 1 && tab.log.size() == 101 && isChatLogTail(tab, 101);
+  printf("  unindexed record after a reset: %s\n", isRecovered ? "recovered" : "lost");
+  failures += !isRecovered;
+
+  tab.log.end();
+  tab.history.clear();
+  return failures;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// frame codec benchmark, compares the zero allocation codec in frame.h with the original String based one
+
+#include "bench.h"
+#include "chat_corpus.h"
+
+struct LegacyMessage
+{
+  uint8_t nonce : 6;
+  uint8_t channel : 2;
+  String username;
+  String text;
+};
+
+void legacyCreateFrame(int channel, uint8_t nonce, const String &username, const String &messageText, uint8_t *frameData, size_t &frameDataLength)
+{
+  frameDataLength = 0;
+
+  frameData[0] = (nonce & 0x3F) | ((channel & 0x03) << 6);
+  frameDataLength += 1;
+
+  size_t usernameByteLength = std::min(username.length() + 1, (unsigned int)MaxUsernameLength + 1);
+  memcpy(frameData + frameDataLength, username.c_str(), usernameByteLength);
+  frameDataLength += usernameByteLength;
+
+  size_t messageTextByteLength = std::min(messageText.length() + 1, (unsigned int)MaxMessageLength + 1);
+  if (messageTextByteLength > 1)
+  {
+    memcpy(frameData + frameDataLength, messageText.c_str(), messageTextByteLength);
+    frameDataLength += messageTextByteLength;
+  }
+}
+
+void legacyParseFrame(const uint8_t *frameData, size_t frameDataLength, LegacyMessage &message)
+{
+  if (frameDataLength < (1 + MinUsernameLength + 1) || frameDataLength > (1 + MaxUsernameLength + 1 + MaxMessageLength + 1))
+    return;
+
+  size_t frameBytesRead = 0;
+
+  message.nonce = (frameData[0] & 0x3F);
+  message.channel = ((frameData[0] >> 6) & 0x03);
+  frameBytesRead += 1;
+
+  message.username = String((const char *)(frameData + frameBytesRead), MaxUsernameLength).c_str();
+  frameBytesRead += message.username.length() + 1;
+
+  size_t messageLength = frameDataLength - frameBytesRead;
+  message.text = String((const char *)(frameData + frameBytesRead), messageLength).c_str();
+}
+
+int runCodecBench()
+{
+  printf("== bench-codec ==\n");
+
+  const size_t iterations = 200000;
+  const String benchUsername = "chngme";
+
+  // the legacy encoder took Strings, so the caller had to build one per message
+  BenchResult legacyEncode = runBench(iterations, [&](size_t i) {
+    uint8_t frameData[MaxFrameLength];
+    size_t frameDataLength;
+    String text = ChatCorpus[i % ChatCorpusCount];
+    legacyCreateFrame(i % 3, i, benchUsername, text, frameData, frameDataLength);
+    benchSink += frameDataLength;
+  });
+
+  BenchResult encode = runBench(iterations, [&](size_t i) {
+    uint8_t frameData[MaxFrameLength];
+    FrameView frame = {};
+    frame.channel = i % 3;
+    frame.nonce = i;
+    frame.flags = (i % FullNameInterval == 0) ? FrameFlags::FullName : 0;
+    frame.senderHash = usernameHash(benchUsername.c_str(), benchUsername.length());
+    frame.username = benchUsername.c_str();
+    frame.usernameLength = benchUsername.length();
+    frame.text = ChatCorpus[i % ChatCorpusCount];
+    frame.textLength = strlen(frame.text);
+    benchSink += encodeFrame(frameData, sizeof(frameData), frame);
+  });
+
+  // pre-encode the corpus for the decoders, legacy decoder only understands v1
+  static uint8_t frames[ChatCorpusCount][MaxFrameLength];
+  static size_t frameLengths[ChatCorpusCount];
+  for (size_t i = 0; i < ChatCorpusCount; i++)
+    frameLengths[i] = encodeFrameV1(frames[i], MaxFrameLength, 0, i, "chngme", 6, ChatCorpus[i], strlen(ChatCorpus[i]));
+
+  BenchResult legacyDecode = runBench(iterations, [&](size_t i) {
+    LegacyMessage message;
+    legacyParseFrame(frames[i % ChatCorpusCount], frameLengths[i % ChatCorpusCount], message);
+    benchSink += message.text.length();
+  });
+
+  BenchResult decode = runBench(iterations, [&](size_t i) {
+    FrameView frame;
+    decodeFrame(frames[i % ChatCorpusCount], frameLengths[i % ChatCorpusCount], frame);
+    benchSink += frame.textLength;
+  });
+
+  printBench("legacy createFrame", legacyEncode);
+  printBench("encodeFrame", encode);
+  printBench("legacy parseFrame", legacyDecode);
+  printBench("decodeFrame", decode);
+  printf("  note: host String is std::string backed, short string optimization up to 15 chars\n");
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// compression ratio and cost of text_compression.h over the chat corpus
+
+#include "airtime.h"
+#include "bench.h"
+#include "chat_corpus.h"
+
+int runCompressionBench()
+{
+  printf("== bench-compression ==\n");
+
+  LoRaModulation modulation = loraModulationFromAirDataRate(0b10000);
+  size_t rawBytes = 0, compressedBytes = 0, roundTripFailures = 0;
+  unsigned long rawAirtime = 0, compressedAirtime = 0;
+
+  for (size_t i = 0; i < ChatCorpusCount; i++)
+  {
+    const char *text = ChatCorpus[i];
+    size_t textLength = strlen(text);
+
+    uint8_t compressed[MaxMessageLength * 2];
+    size_t compressedLength = compressText(text, textLength, compressed, sizeof(compressed));
+
+    char decompressed[MaxMessageLength];
+    size_t decompressedLength;
+    if (!decompressText(compressed, compressedLength, decompressed, sizeof(decompressed), decompressedLength) ||
+        decompressedLength != textLength || memcmp(decompressed, text, textLength) != 0)
+    {
+      roundTripFailures++;
+    }
+
+    // the frame falls back to raw text when compression doesn't help
+    size_t sentLength = std::min(compressedLength, textLength);
+    rawBytes += textLength;
+    compressedBytes += sentLength;
+    rawAirtime += loraAirtimeMicros(modulation, V2HeaderLength + textLength);
+    compressedAirtime += loraAirtimeMicros(modulation, V2HeaderLength + sentLength);
+  }
+
+  printf("  %zu messages, %zu -> %zu text bytes, ratio %.2f, %zu round trip failures\n",
+         ChatCorpusCount, rawBytes, compressedBytes, (double)compressedBytes / rawBytes, roundTripFailures);
+  printf("  v2 frame airtime at SF%d BW%dkHz: %.1f -> %.1f ms/msg\n", modulation.spreadingFactor, modulation.bandwidthKHz,
+         rawAirtime / 1000.0 / ChatCorpusCount, compressedAirtime / 1000.0 / ChatCorpusCount);
+
+  const size_t iterations = 200000;
+
+  BenchResult encode = runBench(iterations, [&](size_t i) {
+    const char *text = ChatCorpus[i % ChatCorpusCount];
+    uint8_t compressed[MaxMessageLength];
+    benchSink += compressText(text, strlen(text), compressed, sizeof(compressed));
+  });
+
+  static uint8_t compressedCorpus[ChatCorpusCount][MaxMessageLength];
+  static size_t compressedLengths[ChatCorpusCount];
+  for (size_t i = 0; i < ChatCorpusCount; i++)
+    compressedLengths[i] = compressText(ChatCorpus[i], strlen(ChatCorpus[i]), compressedCorpus[i], MaxMessageLength);
+
+  BenchResult decode = runBench(iterations, [&](size_t i) {
+    char decompressed[MaxMessageLength];
+    size_t decompressedLength;
+    decompressText(compressedCorpus[i % ChatCorpusCount], compressedLengths[i % ChatCorpusCount], decompressed, sizeof(decompressed), decompressedLength);
+    benchSink += decompressedLength;
+  });
+
+  printBench("compressText", encode);
+  printBench("decompressText", decode);
+
+  return roundTripFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// config benchmark, compares the original String based reading of the SD card text file with the
+// in place ConfigParser and with unpacking the NVS blob boot now reads, and checks they agree
+
+#include "bench.h"
+#include "config.h"
+
+const char *const ConfigBenchText = "username=Alice\n"
+                                    "brightness=55\n"
+                                    "pingMode=on\n"
+                                    "repeatMode=true\n"
+                                    "ackMode=off\n"
+                                    "espNowMode=off\n"
+                                    "compression=on\n"
+                                    "dutyCycle=1\n";
+
+// readConfigFromSd() as it was, a line at a time as configFile.readStringUntil('\n') returned them
+void legacyReadConfig(const char *text, Config &config)
+{
+  String remaining = text;
+  while (remaining.length() > 0)
+  {
+    int newline = remaining.indexOf('\n');
+    String line = newline < 0 ? remaining : remaining.substring(0, newline);
+    remaining = newline < 0 ? String() : remaining.substring(newline + 1);
+
+    String name = line.substring(0, line.indexOf('='));
+    String value = line.substring(line.indexOf('=') + 1);
+    name.trim();
+    name.toLowerCase();
+    value.trim();
+    value.toLowerCase();
+
+    bool isOn = value == "true" || value == "1" || value == "on";
+    if (name == "username")
+      copyToBuffer(config.username, sizeof(config.username), value.c_str(), value.length());
+    else if (name == "brightness")
+      config.brightness = value.toInt();
+    else if (name == "pingmode")
+      config.set(ConfigFlags::PingMode, isOn);
+    else if (name == "relaymode" || name == "repeatmode")
+      config.set(ConfigFlags::RelayMode, isOn);
+    else if (name == "ackmode")
+      config.set(ConfigFlags::AckMode, isOn);
+    else if (name == "espnowmode")
+      config.set(ConfigFlags::EspNowMode, isOn);
+    else if (name == "compression")
+      config.set(ConfigFlags::Compression, isOn);
+    else if (name == "dutycycle")
+      config.dutyCyclePercent = value == "off" ? 100 : std::max(1, std::min(100, (int)value.toInt()));
+  }
+}
+
+bool isSameConfig(const Config &a, const Config &b)
+{
+  return strcmp(a.username, b.username) == 0 && a.brightness == b.brightness && a.dutyCyclePercent == b.dutyCyclePercent &&
+         a.flags == b.flags;
+}
+
+int runConfigBench()
+{
+  printf("== bench-config ==\n");
+
+  Config legacy, parsed, unpacked;
+  legacyReadConfig(ConfigBenchText, legacy);
+  ConfigParser parser;
+  size_t textLength = strlen(ConfigBenchText);
+  for (size_t offset = 0; offset < textLength; offset += 5) // in odd sized chunks, as read from the card
+    parser.feed(ConfigBenchText + offset, std::min((size_t)5, textLength - offset), parsed);
+  parser.finish(parsed);
+
+  uint8_t blob[ConfigBlobLength];
+  size_t blobLength = packConfig(parsed, blob);
+  bool isUnpacked = unpackConfig(blob, blobLength, unpacked);
+
+  char exported[256];
+  Config reimported;
+  size_t exportedLength = formatConfig(parsed, exported, sizeof(exported));
+  ConfigParser reimportParser;
+  reimportParser.feed(exported, exportedLength, reimported);
+
+  // a blob from before the flags byte existed keeps the default flags
+  Config older;
+  uint8_t olderBlob[ConfigBlobLength - 1];
+  memcpy(olderBlob, blob, sizeof(olderBlob));
+  olderBlob[1] = sizeof(olderBlob);
+  bool isOlderRead = unpackConfig(olderBlob, sizeof(olderBlob), older) && older.brightness == 55 && older.flags == Config().flags;
+
+  bool isAgreed = isSameConfig(legacy, parsed) && isUnpacked && isSameConfig(parsed, unpacked) && isSameConfig(parsed, reimported);
+  printf("  parsers agree, blob and export round trip: %s, older blob: %s\n", isAgreed ? "yes" : "no", isOlderRead ? "read" : "rejected");
+
+  BenchResult legacyResult = runBench(20000, [](size_t) {
+    Config config;
+    legacyReadConfig(ConfigBenchText, config);
+    benchSink += config.brightness;
+  });
+  BenchResult parserResult = runBench(20000, [](size_t) {
+    Config config;
+    ConfigParser parser;
+    parser.feed(ConfigBenchText, strlen(ConfigBenchText), config);
+    parser.finish(config);
+    benchSink += config.brightness;
+  });
+  BenchResult blobResult = runBench(20000, [&](size_t) {
+    Config config;
+    unpackConfig(blob, blobLength, config);
+    benchSink += config.brightness;
+  });
+  printBench("String lines (legacy)", legacyResult);
+  printBench("ConfigParser", parserResult);
+  printBench("NVS blob unpack", blobResult);
+  printf("  blob %zu bytes, text file %zu bytes\n", blobLength, textLength);
+
+  return !isAgreed || !isOlderRead || parserResult.allocsPerOp > 0 || blobResult.allocsPerOp > 0;
+}
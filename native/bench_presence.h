@@ -0,0 +1,117 @@
+#pragma once
+
+// presence benchmark, compares the original vector of String usernames with PresenceTable when many
+// users are in range, and checks the incremental max rssi against a full scan
+
+#include "bench.h"
+
+struct LegacyPresence
+{
+  String username;
+  bool isEspNow;
+  int rssi;
+  unsigned long lastSeenMillis;
+  uint16_t usernameHash;
+};
+
+bool legacyRecordPresence(std::vector<LegacyPresence> &users, uint16_t senderHash, const String &name, int rssi, bool isEspNow, unsigned long now)
+{
+  for (size_t i = 0; i < users.size(); i++)
+  {
+    if (users[i].usernameHash == senderHash && users[i].isEspNow == isEspNow)
+    {
+      if (users[i].username != name)
+        users[i].username = name;
+      users[i].rssi = rssi;
+
+      bool beenAWhile = now - users[i].lastSeenMillis > PRESENCE_TIMEOUT_MS;
+      users[i].lastSeenMillis = now;
+      return beenAWhile;
+    }
+  }
+
+  users.push_back({name, isEspNow, rssi, now, senderHash});
+  return true;
+}
+
+int legacyPresenceRssi(const std::vector<LegacyPresence> &users, bool isEspNow, unsigned long now)
+{
+  int maxRssiAllUsers = NoPresenceRssi;
+  for (auto user : users)
+    if (user.isEspNow == isEspNow && user.rssi > maxRssiAllUsers && now - user.lastSeenMillis < PRESENCE_TIMEOUT_MS)
+      maxRssiAllUsers = user.rssi;
+  return maxRssiAllUsers;
+}
+
+int runPresenceBench()
+{
+  printf("== bench-presence ==\n");
+
+  const size_t iterations = 200000;
+  const size_t userCount = 24; // fits the table, so both keep every user
+  char names[userCount][MaxUsernameLength + 1];
+  uint16_t hashes[userCount];
+  for (size_t i = 0; i < userCount; i++)
+  {
+    snprintf(names[i], sizeof(names[i]), "node%u", (unsigned)i);
+    hashes[i] = usernameHash(names[i], strlen(names[i]));
+  }
+
+  // users heard at random, some drop out for longer than the timeout
+  int result = 0;
+  std::vector<LegacyPresence> legacyUsers;
+  PresenceTable table(PRESENCE_TIMEOUT_MS);
+  unsigned long now = 0;
+  randomSeed(9);
+  for (size_t i = 0; i < 20000; i++)
+  {
+    now += random(0, 2000);
+    size_t user = random(0, i % 5000 < 2500 ? userCount : userCount / 3);
+    bool isEspNow = user % 4 == 0;
+    int rssi = -40 - random(0, 80);
+
+    bool isRenewed;
+    table.touch(hashes[user], isEspNow, rssi, now, isRenewed);
+    bool legacyIsRenewed = legacyRecordPresence(legacyUsers, hashes[user], names[user], rssi, isEspNow, now);
+    table.expire(now);
+
+    for (int transport = 0; transport < 2; transport++)
+    {
+      if (table.getMaxRssi(transport) != legacyPresenceRssi(legacyUsers, transport, now) || isRenewed != legacyIsRenewed)
+      {
+        printf("  FAIL: step %zu, %s max rssi %d, expected %d\n", i, transport ? "ESP-NOW" : "LoRa", table.getMaxRssi(transport), legacyPresenceRssi(legacyUsers, transport, now));
+        result = 1;
+        break;
+      }
+    }
+    if (result)
+      break;
+  }
+
+  // per received frame, then the 5 s system bar update
+  String frameName;
+  BenchResult legacyRecord = runBench(iterations, [&](size_t i) {
+    size_t user = i % userCount;
+    frameName = names[user];
+    benchSink += legacyRecordPresence(legacyUsers, hashes[user], frameName, -60, user % 4 == 0, now + i);
+  });
+  BenchResult record = runBench(iterations, [&](size_t i) {
+    size_t user = i % userCount;
+    bool isRenewed;
+    benchSink += table.touch(hashes[user], user % 4 == 0, -60, now + i, isRenewed).rssi;
+  });
+  BenchResult legacyRssi = runBench(iterations, [&](size_t i) { benchSink += legacyPresenceRssi(legacyUsers, i & 1, now); });
+  BenchResult rssi = runBench(iterations, [&](size_t i) {
+    table.expire(now);
+    benchSink += table.getMaxRssi(i & 1);
+  });
+
+  printf("  %zu users\n", userCount);
+  printBench("legacy recordPresence", legacyRecord);
+  printBench("PresenceTable::touch", record);
+  printBench("legacy getPresenceRssi", legacyRssi);
+  printBench("getPresenceRssi", rssi);
+  printf("  table: %zu bytes fixed\n", sizeof(PresenceTable));
+
+  return result;
+}
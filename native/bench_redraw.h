@@ -0,0 +1,218 @@
+#pragma once
+
+// chat window redraw benchmark with a full tab, compares the original String based wrap of every
+// message on every redraw with the cached layout in chat_layout.h. Drawing is stubbed, only the
+// work to produce the visible lines is timed.
+
+#include "bench.h"
+#include "chat_corpus.h"
+
+// message as the original drawChatWindow copied it, by value
+struct LegacyChatMessage
+{
+  uint8_t nonce : 6;
+  uint8_t channel : 2;
+  String username;
+  bool isEspNow;
+  int rssi;
+  String text;
+};
+
+std::vector<String> legacyGetMessageLines(const String &message, int lineWidth)
+{
+  std::vector<String> messageLines;
+  String currentLine;
+  String word;
+
+  for (char c : message)
+  {
+    if (std::isspace(c))
+    {
+      if (currentLine.length() + word.length() <= (size_t)lineWidth)
+      {
+        currentLine += (currentLine.isEmpty() ? "" : " ") + word;
+        word.clear();
+      }
+      else
+      {
+        messageLines.push_back(currentLine);
+        currentLine.clear();
+
+        currentLine += word;
+        word.clear();
+      }
+    }
+    else
+    {
+      word += c;
+    }
+  }
+
+  if (!currentLine.isEmpty() || !word.isEmpty())
+  {
+    currentLine += (currentLine.isEmpty() ? "" : " ") + word;
+    messageLines.push_back(currentLine);
+  }
+
+  return messageLines;
+}
+
+// original loop: every message is copied and wrapped, the inner loop stops once the window is full
+size_t legacyRedraw(const std::vector<LegacyChatMessage> &messages, int rowCount, int messageWidth)
+{
+  size_t chars = 0;
+  int linesDrawn = 0;
+
+  for (int i = messages.size() - 1; i >= 0; i--)
+  {
+    LegacyChatMessage message = messages[i];
+    if (message.isEspNow)
+      continue;
+
+    String messageText = message.username.isEmpty() ? message.text : message.username + message.text;
+    std::vector<String> lines = legacyGetMessageLines(messageText, messageWidth);
+    for (int j = lines.size() - 1; j >= 0; j--)
+    {
+      chars += lines[j].length();
+      linesDrawn++;
+
+      if (linesDrawn >= rowCount)
+        break;
+    }
+  }
+
+  return chars;
+}
+
+size_t cachedRedraw(const MessageHistory &history, MessageLayoutCache &layout, int rowCount, uint32_t scrollLines = 0)
+{
+  size_t chars = 0;
+  layout.index(history, false);
+  layoutVisibleLines(history, layout, false, rowCount, scrollLines,
+                     [&](const HistoryEntry &, uint8_t, const char *, uint16_t lineLength, int) { chars += lineLength; });
+  return chars;
+}
+
+void fillBenchMessage(size_t i, Message &message)
+{
+  message.sequence = i;
+  message.deliveryState = NotTracked;
+  message.channel = 0;
+  message.isEspNow = false;
+  message.rssi = -80;
+  copyToBuffer(message.username, sizeof(message.username), i % 3 == 0 ? "" : (i % 3 == 1 ? "alice" : "bob"), i % 3 == 0 ? 0 : (i % 3 == 1 ? 5 : 3));
+  copyToBuffer(message.text, sizeof(message.text), ChatCorpus[i % ChatCorpusCount], strlen(ChatCorpus[i % ChatCorpusCount]));
+}
+
+int runRedrawBench()
+{
+  printf("== bench-redraw ==\n");
+
+  // Cardputer chat window with the default font
+  const int rowCount = 8;
+  const int messageWidth = 26;
+  const size_t messageCount = 1000;
+  const size_t iterations = 2000;
+
+  std::vector<LegacyChatMessage> legacyMessages;
+  MessageHistory history;
+  MessageLayoutCache layout;
+  history.init(messageCount, 48 * 1024);
+  layout.init(messageCount);
+  layout.setLineWidth(messageWidth);
+
+  Message message;
+  for (size_t i = 0; i < messageCount; i++)
+  {
+    fillBenchMessage(i, message);
+    history.append(message);
+    legacyMessages.push_back({(uint8_t)(message.sequence & 0x3F), (uint8_t)message.channel, message.username, message.isEspNow, message.rssi, message.text});
+  }
+
+  // every wrapped line must fit, the username tag shortens the first line
+  int result = 0;
+  for (size_t i = 0; i < history.size(); i++)
+  {
+    const HistoryEntry &entry = history.at(i);
+    const MessageLayout &entryLayout = layout.get(history, entry);
+    const char *text = history.text(entry);
+    for (uint8_t j = 0; j < entryLayout.lineCount && j < MaxCachedLines; j++)
+    {
+      uint16_t lineEnd = (j + 1 < entryLayout.lineCount) ? entryLayout.lineStarts[j + 1] : entry.textLength;
+      uint16_t width = j == 0 ? layout.firstLineWidth(entry) : messageWidth;
+      if (lineLength(text, entryLayout.lineStarts[j], lineEnd) > width)
+      {
+        printf("  FAIL: line %u of \"%s\" is wider than %u\n", j, text, width);
+        result = 1;
+      }
+    }
+  }
+
+  // a new message arrives before each redraw
+  BenchResult legacy = runBench(iterations, [&](size_t i) {
+    fillBenchMessage(messageCount + i, message);
+    legacyMessages[i % messageCount] = {(uint8_t)(message.sequence & 0x3F), (uint8_t)message.channel, message.username, message.isEspNow, message.rssi, message.text};
+    benchSink += legacyRedraw(legacyMessages, rowCount, messageWidth);
+  });
+
+  uint32_t wrapsBefore = layout.wraps();
+  BenchResult cached = runBench(iterations, [&](size_t i) {
+    fillBenchMessage(messageCount + i, message);
+    history.append(message);
+    benchSink += cachedRedraw(history, layout, rowCount);
+  });
+  double wrapsPerRedraw = (double)(layout.wraps() - wrapsBefore) / (iterations + iterations / 10 + 1);
+
+  // width change, every message is wrapped again to rebuild the line index
+  BenchResult resized = runBench(iterations, [&](size_t i) {
+    layout.setLineWidth(messageWidth - (i & 1));
+    benchSink += cachedRedraw(history, layout, rowCount);
+  });
+
+  // scrolling one window at a time from the bottom visits every line once, in order
+  layout.setLineWidth(messageWidth);
+  layout.index(history, false);
+  uint32_t lineCount = layout.lineCount(history);
+  std::vector<String> scrolledLines(lineCount);
+  for (uint32_t scroll = 0; scroll < lineCount; scroll += rowCount)
+  {
+    layoutVisibleLines(history, layout, false, rowCount, scroll,
+                       [&](const HistoryEntry &, uint8_t, const char *line, uint16_t lineLength, int row) {
+                         scrolledLines[lineCount - 1 - scroll - row] = String(line, lineLength);
+                       });
+  }
+  size_t line = 0;
+  for (size_t i = 0; i < history.size() && result == 0; i++)
+  {
+    const HistoryEntry &entry = history.at(i);
+    const MessageLayout &entryLayout = layout.get(history, entry);
+    const char *text = history.text(entry);
+    for (uint8_t j = 0; j < entryLayout.lineCount; j++, line++)
+    {
+      uint16_t lineEnd = (j + 1 < entryLayout.lineCount) ? entryLayout.lineStarts[j + 1] : entry.textLength;
+      if (scrolledLines[line] != String(text + entryLayout.lineStarts[j], lineLength(text, entryLayout.lineStarts[j], lineEnd)))
+      {
+        printf("  FAIL: line %zu scrolled as \"%s\"\n", line, scrolledLines[line].c_str());
+        result = 1;
+        break;
+      }
+    }
+  }
+
+  // a scroll step anywhere in the history, no wrapping once the index is built
+  wrapsBefore = layout.wraps();
+  BenchResult scrolled = runBench(iterations, [&](size_t i) {
+    benchSink += cachedRedraw(history, layout, rowCount, (i * 7) % lineCount);
+  });
+  uint32_t scrollWraps = layout.wraps() - wrapsBefore;
+
+  printf("  %zu messages, %d rows, %d columns, %u lines\n", messageCount, rowCount, messageWidth, lineCount);
+  printBench("legacy redraw", legacy);
+  printBench("cached redraw", cached);
+  printBench("cached redraw, width changed", resized);
+  printBench("cached redraw, scrolled", scrolled);
+  printf("  %.2f messages wrapped per redraw after a new message, %u while scrolling\n", wrapsPerRedraw, scrollWraps);
+  printf("  layout cache: %zu bytes for %zu messages\n", messageCount * sizeof(MessageLayout), messageCount);
+
+  return result;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// screenshot streamed through the storage queue
+//
+// a 240x135 test pattern is written as the UI task does, a poll per loop with the storage task
+// flushing when woken or on its timer. Checks the BMP on the card pixel for pixel, that a chat log
+// record always finds room while the shot streams, and how much memory and how many loops it takes.
+
+#include "bench_storage.h"
+#include "screenshot.h"
+
+const int ScreenshotBenchWidth = 240;
+const int ScreenshotBenchHeight = 135;
+
+uint16_t screenshotBenchPixel(int x, int y) { return (uint16_t)(x * 31 + y * 2053); }
+
+void readScreenshotBenchRow(int y, uint16_t *pixels)
+{
+  for (int x = 0; x < ScreenshotBenchWidth; x++)
+    pixels[x] = screenshotBenchPixel(x, y);
+}
+
+int runScreenshotBench()
+{
+  printf("== bench-screenshot ==\n");
+
+  benchStorage.clear();
+  storage = &benchStorage;
+  ScreenshotWriter writer;
+  writer.begin(ScreenshotBenchWidth, ScreenshotBenchHeight);
+
+  size_t loops = 0;
+  bool isChatBlocked = false;
+  while (writer.isActive())
+  {
+    writer.poll(storageQueue, hostMillis, readScreenshotBenchRow);
+    loops++;
+
+    // a chat message arriving mid shot, as ChatLog::append() would queue it
+    uint8_t record[LogRecordHeaderLength + MaxUsernameLength + MaxMessageLength] = {};
+    isChatBlocked |= !storageQueue.write(StorageChatLog, record, sizeof(record), false, hostMillis);
+
+    delay(10); // UI loop
+    processStorage(hostMillis);
+  }
+  delay(StorageFlushMillis);
+  processStorage(hostMillis);
+
+  const std::vector<uint8_t> &bmp = benchStorage.files[StorageScreenshot];
+  size_t expectedBytes = BmpHeaderLength + ScreenshotBenchWidth * ScreenshotBenchHeight * 2;
+  bool isIntact = bmp.size() == expectedBytes && bmp[0] == 'B' && bmp[1] == 'M' && bmp[10] == BmpHeaderLength;
+  for (int y = 0; y < ScreenshotBenchHeight && isIntact; y++)
+  {
+    for (int x = 0; x < ScreenshotBenchWidth && isIntact; x++)
+    {
+      size_t offset = BmpHeaderLength + (y * ScreenshotBenchWidth + x) * 2;
+      isIntact = (bmp[offset] | bmp[offset + 1] << 8) == screenshotBenchPixel(x, y);
+    }
+  }
+
+  printf("  %dx%d BMP, %zu bytes: %s\n", ScreenshotBenchWidth, ScreenshotBenchHeight, bmp.size(), isIntact ? "intact" : "corrupt");
+  printf("  queued over %zu UI loops, %zu writer bytes against %d for a frame, chat records %s\n", loops, writer.memoryBytes(),
+         ScreenshotBenchWidth * ScreenshotBenchHeight * 2, isChatBlocked ? "blocked" : "never blocked");
+
+  storage = NULL;
+  return !isIntact || isChatBlocked;
+}
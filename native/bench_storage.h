@@ -0,0 +1,138 @@
+#pragma once
+
+// write-behind storage queue against writing each chat log record to the card as it comes
+//
+// channel A is logged through the storage queue into a card in memory that counts writes and syncs,
+// with the storage task's timer every StorageFlushMillis / 4, at several message rates. Writing in
+// place, as the chat log did, costs a write and a sync per record and per index entry. Then the log
+// is read back: the card must hold every record, and a page requested for the UI task must come back
+// through processStorage() and be prepended in order.
+
+#include <vector>
+
+#include "bench.h"
+
+class MemoryStorage : public StorageSink
+{
+public:
+  bool replace(uint8_t file) override
+  {
+    files[file].clear();
+    return true;
+  }
+
+  bool append(uint8_t file, const uint8_t *data, size_t length) override
+  {
+    files[file].insert(files[file].end(), data, data + length);
+    cardWrites++;
+    return true;
+  }
+
+  bool sync(uint8_t) override
+  {
+    syncs++;
+    return true;
+  }
+
+  bool read(uint8_t file, size_t offset, void *data, size_t length) override
+  {
+    if (offset + length > files[file].size())
+      return false;
+    memcpy(data, files[file].data() + offset, length);
+    return true;
+  }
+
+  size_t size(uint8_t file) override { return files[file].size(); }
+
+  void clear()
+  {
+    for (auto &file : files)
+      file.clear();
+    cardWrites = syncs = 0;
+  }
+
+  std::vector<uint8_t> files[StorageFileCount];
+  size_t cardWrites = 0;
+  size_t syncs = 0;
+};
+
+MemoryStorage benchStorage;
+QueuedLogFile benchStorageLog, benchStorageIndex;
+
+// logs messageCount messages one every intervalMillis, returns card writes plus syncs per message
+double runStorageRate(size_t messageCount, unsigned long intervalMillis)
+{
+  benchStorage.clear();
+  storage = &benchStorage;
+  benchStorageLog.begin(&benchStorage, &storageQueue, StorageChatLog);
+  benchStorageIndex.begin(&benchStorage, &storageQueue, StorageChatIndex);
+  beginChatLog(0, &benchStorageLog, &benchStorageIndex);
+
+  unsigned long nextTimerMillis = hostMillis;
+  for (size_t i = 0; i < messageCount; i++)
+  {
+    appendToHistory(chatLogBenchMessage(i));
+    for (unsigned long waited = 0; waited < intervalMillis; waited++)
+    {
+      delay(1);
+      if (hostMillis >= nextTimerMillis)
+      {
+        nextTimerMillis += StorageFlushMillis / 4;
+        processStorage(hostMillis);
+      }
+    }
+  }
+  delay(StorageFlushMillis);
+  processStorage(hostMillis);
+
+  return (double)(benchStorage.cardWrites + benchStorage.syncs) / messageCount;
+}
+
+int runStorageBench()
+{
+  printf("== bench-storage ==\n");
+  printf("  %zu byte buffers, flushed at %zu bytes or after %lu ms, %zu byte sectors\n", StorageBufferBytes,
+         StorageHighWaterBytes, StorageFlushMillis, StorageSectorBytes);
+  printf("  message every | card ops/message in place | write-behind\n");
+
+  int failures = 0;
+  const size_t MessageCount = 500;
+  const unsigned long intervals[] = {2000, 200, 20};
+  for (unsigned long interval : intervals)
+  {
+    double ops = runStorageRate(MessageCount, interval);
+    printf("  %10lu ms | %25.1f | %12.2f\n", interval, 4.0, ops);
+    failures += ops > 4.0;
+  }
+
+  // the card holds the log, in order, and a page read back comes through the UI task's queue
+  ChatTab &tab = chatTab[0];
+  bool isLogged = tab.log.size() == MessageCount;
+  beginChatLog(0, &benchStorageLog, &benchStorageIndex);
+  isLogged = isLogged && isChatLogTail(tab, MessageCount);
+  size_t bootSize = tab.history.size();
+  requestOlderMessages(tab);
+  processStorage(hostMillis);
+  processQueuedMessages();
+  bool isLoaded = tab.history.size() == bootSize + ChatLogPageMessages && isChatLogTail(tab, MessageCount);
+  printf("  log on the card: %s, page read back through the storage task: %s\n", isLogged ? "complete" : "missing records",
+         isLoaded ? "prepended" : "missing");
+  failures += !isLogged || !isLoaded;
+
+  BenchResult write = runBench(100000, [](size_t) {
+    uint8_t record[40] = {};
+    if (!storageQueue.write(StorageChatLog, record, sizeof(record), false, hostMillis))
+      storageQueue.flush(benchStorage);
+  });
+  printBench("queued write (40 bytes)", write);
+
+  StorageStats stats = storageQueue.getStats();
+  printf("  %u writes, %u flushes, %u card writes, %zu bytes pending at most\n", stats.writes, stats.flushes, stats.cardWrites,
+         stats.maxPending);
+
+  storageQueue.flush(benchStorage);
+  storage = NULL;
+  tab.log.end();
+  tab.history.clear();
+  return failures;
+}
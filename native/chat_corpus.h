@@ -0,0 +1,48 @@
+#pragma once
+
+// short chat lines used by the host benchmarks and simulations, roughly what gets typed on a Cardputer
+
+const char *const ChatCorpus[] = {
+    "hi",
+    "hello",
+    "hey is anyone out there?",
+    "yes I can hear you",
+    "where are you right now",
+    "at the park near the lake",
+    "ok",
+    "lol",
+    "what is the signal like on your end",
+    "rssi is around -90 here",
+    "going to walk up the hill and try again",
+    "can you see my messages?",
+    "yep, loud and clear",
+    "nice, this is working really well",
+    "brb",
+    "thanks!",
+    "how far away are you now",
+    "about 2 km I think",
+    "that is pretty good for these little antennas",
+    "let me know when you get there",
+    "on my way",
+    "the battery is getting low",
+    "meet at the coffee shop in ten minutes?",
+    "sounds good, see you there",
+    "did you get the last message",
+    "no, can you send it again please",
+    "testing one two three",
+    "I am going to switch to channel B",
+    "ok switching now",
+    "good morning everyone",
+    "good night",
+    "is the ping mode on for you",
+    "I think the repeater is down",
+    "it was working this morning",
+    "try restarting it",
+    "done, should be back now",
+    "yes it is back",
+    "great, thank you",
+    "the weather is nice today",
+    "see you later",
+};
+
+const size_t ChatCorpusCount = sizeof(ChatCorpus) / sizeof(ChatCorpus[0]);
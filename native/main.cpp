@@ -0,0 +1,348 @@
+// host harness for the chat stack, built by [env:native]
+// usage: program [scenario], with no scenario all of them are run
+
+#include <Arduino.h>
+
+#include "chat.h"
+
+#include "bench_chat_log.h"
+#include "bench_codec.h"
+#include "bench_config.h"
+#include "bench_compression.h"
+#include "bench_presence.h"
+#include "bench_redraw.h"
+#include "bench_storage.h"
+#include "bench_screenshot.h"
+#include "report_wire.h"
+#include "sim_aggregation.h"
+#include "sim_beacon.h"
+#include "sim_duty_cycle.h"
+#include "sim_key_scan.h"
+#include "sim_response.h"
+#include "sim_relay.h"
+#include "sim_ui_wake.h"
+
+LoopbackTransport loopback;
+
+void printChatTab(const ChatTab &tab)
+{
+  for (size_t i = 0; i < tab.history.size(); i++)
+  {
+    const HistoryEntry &message = tab.history.at(i);
+    printf("  [%c] %-8s %s\n", 'A' + tab.channel, message.username[0] == '\0' ? "(me)" : message.username, tab.history.text(message));
+  }
+}
+
+// what the UI and transmit tasks do between frames on the device
+size_t processHostQueues()
+{
+  while (processTxQueue())
+    ;
+  size_t processed = processQueuedMessages();
+  while (processTxQueue())
+    ;
+  return processed;
+}
+
+// two users share the loopback: frames sent as one user are received as the other
+int runLoopback()
+{
+  printf("== loopback ==\n");
+
+  transport = &loopback;
+  for (uint8_t i = 0; i < ChatTabCount; i++)
+    chatTab[i].history.clear();
+  presence.clear();
+  duplicateFilter.clear();
+
+  username = "alice";
+  queuePing(TxPing);
+  queueMessage(TxChat, 0, "hello from the host", strlen("hello from the host"));
+  queueMessage(TxChat, 2, "channel C works too", strlen("channel C works too"));
+  processHostQueues(); // sent together as one radio frame
+
+  username = "bob";
+  delay(2000);
+  // every frame arrives twice, as if retransmitted or relayed, the copies must be dropped
+  size_t delivered = loopback.poll([](const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow) {
+    queueReceivedFrame(frameData, frameDataLength, rssi, isEspNow);
+    queueReceivedFrame(frameData, frameDataLength, rssi, isEspNow);
+  });
+  processHostQueues();
+
+  printf("delivered %zu frames, %zu queued in reply\n", delivered, loopback.pending());
+  for (uint8_t i = 0; i < ChatTabCount; i++)
+    printChatTab(chatTab[i]);
+  presence.forEachByRecency([](const Presence &p) {
+    printf("  presence: %s rssi %d\n", p.username, p.rssi);
+    return true;
+  });
+  printf("  chat history: %zu bytes preallocated\n", chatHistoryMemoryBytes());
+  printf("  duplicates dropped: %u\n", duplicateFilter.duplicates());
+
+  // each message once as sent and once as received, alice seen once and every copy dropped
+  auto isExchanged = [](const ChatTab &tab, const char *text) {
+    return tab.history.size() == 2 && tab.history.at(0).username[0] == '\0' && strcmp(tab.history.text(tab.history.at(0)), text) == 0 &&
+           strcmp(tab.history.at(1).username, "alice") == 0 && strcmp(tab.history.text(tab.history.at(1)), text) == 0;
+  };
+  const Presence *alice = presence.find(usernameHash("alice", 5), false);
+  int failures = !isExchanged(chatTab[0], "hello from the host") || !chatTab[1].history.isEmpty() ||
+                 !isExchanged(chatTab[2], "channel C works too");
+  failures += presence.size() != 1 || alice == NULL || strcmp(alice->username, "alice") != 0;
+  failures += duplicateFilter.duplicates() != 3;
+  return failures;
+}
+
+const char *deliveryStateName(uint8_t state)
+{
+  const char *names[] = {"not tracked", "sending", "delivered", "partly delivered", "not delivered"};
+  return state < sizeof(names) / sizeof(names[0]) ? names[state] : "?";
+}
+
+// newest own message, the loopback users share one history
+const HistoryEntry *newestOwnMessage(const MessageHistory &history)
+{
+  for (size_t i = history.size(); i-- > 0;)
+    if (history.at(i).username[0] == '\0')
+      return &history.at(i);
+  return NULL;
+}
+
+// alice sends in ack mode, bob acks in a ping once the ack delay is up, then a second message goes
+// unheard and is retransmitted until it runs out of tries
+int runAckLoopback()
+{
+  printf("== loopback-ack ==\n");
+
+  auto deliver = [](bool isLost) {
+    if (isLost)
+      loopback.poll([](const uint8_t *, size_t, int, bool) {});
+    else
+      loopback.poll([](const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow) {
+        queueReceivedFrame(frameData, frameDataLength, rssi, isEspNow);
+      });
+    processHostQueues();
+  };
+  auto send = [](const char *text) {
+    queueMessage(TxChat, 0, text, strlen(text));
+  };
+
+  transport = &loopback;
+  chatTab[0].history.clear();
+  presence.clear();
+  ackMode = true;
+
+  // bob is seen first, so alice expects one ack
+  username = "bob";
+  queuePing(TxPing);
+  while (processTxQueue())
+    ;
+  username = "alice";
+  deliver(false);
+
+  send("did you get this?");
+  processHostQueues();
+  printf("  sent, %zu unacked\n", ackTracker.size());
+
+  username = "bob";
+  deliver(false); // bob receives and queues an ack
+  delay(LoRaAckTiming.maxAckDelayMillis);
+  processHostQueues(); // ack ping
+  username = "alice";
+  delay(250);
+  deliver(false);
+  const HistoryEntry *acked = newestOwnMessage(chatTab[0].history);
+  printf("  \"%s\": %s, %zu unacked\n", chatTab[0].history.text(*acked), deliveryStateName(acked->deliveryState), ackTracker.size());
+
+  send("anyone there?");
+  int sends = 0;
+  processHostQueues();
+  for (int i = 0; i < 1000 && newestOwnMessage(chatTab[0].history)->deliveryState == Sending; i++)
+  {
+    sends += loopback.pending();
+    deliver(true);
+    delay(100);
+  }
+  const HistoryEntry *lost = newestOwnMessage(chatTab[0].history);
+  printf("  \"%s\": %s after %d sends\n", chatTab[0].history.text(*lost), deliveryStateName(lost->deliveryState), sends);
+
+  // the first is acked by bob, the second sent once and retransmitted until it gives up
+  int failures = acked->deliveryState != Delivered || lost->deliveryState != NotDelivered || sends != 1 + MaxRetransmits;
+  ackMode = false;
+  return failures;
+}
+
+std::vector<ReceivedFrame> capturedFrames;
+
+// alice sends a long message over small MTUs, bob gets the fragments in reverse order
+int runFragmentLoopback()
+{
+  printf("== loopback-fragments ==\n");
+
+  const char *text = "Fragments take consecutive sequence numbers, so duplicates, relays and acks work per fragment. "
+                     "Each is filled with as much compressed text as fits the MTU, and the receiver puts them back "
+                     "together in any order, or drop them after a timeout.";
+
+  transport = &loopback;
+  loopback.frameTimeMillis = 250;
+  int failures = 0;
+  const size_t mtus[] = {200, 64, 32};
+  for (size_t mtu : mtus)
+  {
+    loopback.maxFrameLength = mtu;
+    chatTab[0].history.clear();
+    capturedFrames.clear();
+
+    username = "alice";
+    radioReadyMillis = hostMillis;
+    unsigned long startMillis = hostMillis;
+    if (!sendMessage(currentSender(), 0, text))
+    {
+      printf("  mtu %3zu: send failed\n", mtu);
+      failures++;
+      continue;
+    }
+    flushFrames();
+
+    // reported once the last fragment is sent
+    Message sentMessage;
+    bool isReported = sentMessageQueue.pop(sentMessage) && strcmp(sentMessage.text, text) == 0;
+    failures += !isReported;
+
+    // the transmit task sends the fragments one frame time apart
+    size_t bytes = 0;
+    unsigned long lastMillis = radioReadyMillis - loopback.frameTimeMillis;
+    loopback.poll([](const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow) {
+      ReceivedFrame frame;
+      memcpy(frame.data, frameData, frameDataLength);
+      frame.length = frameDataLength;
+      frame.rssi = rssi;
+      frame.isEspNow = isEspNow;
+      capturedFrames.push_back(frame);
+    });
+    for (const ReceivedFrame &frame : capturedFrames)
+      bytes += frame.length;
+
+    username = "bob";
+    for (size_t i = capturedFrames.size(); i-- > 0;)
+      receiveMessage(capturedFrames[i].data, capturedFrames[i].length, capturedFrames[i].rssi, capturedFrames[i].isEspNow);
+
+    const HistoryEntry *received = chatTab[0].history.isEmpty() ? NULL : &chatTab[0].history.newest();
+    bool isIntact = received != NULL && strcmp(chatTab[0].history.text(*received), text) == 0;
+    failures += !isIntact;
+    printf("  mtu %3zu: %zu chars in %2zu fragments, %3zu bytes, burst %4lu ms, %s\n", mtu, strlen(text), capturedFrames.size(), bytes,
+           lastMillis - startMillis, !isIntact ? "FAILED" : isReported ? "reassembled" : "not reported");
+  }
+
+  loopback.maxFrameLength = MAX_FRAME_LENGTH;
+  loopback.frameTimeMillis = 0;
+  return failures;
+}
+
+std::string txOrder;
+
+// a presence ping, an ack ping and a burst of chat messages are queued while the radio is busy, the
+// transmit task sends chat first and the rest after, the pings only once each
+int runTxQueue()
+{
+  printf("== tx-queue ==\n");
+
+  transport = &loopback;
+  loopback.clear();
+  loopback.frameTimeMillis = 400;
+  txQueue.clear();
+  chatTab[0].history.clear();
+  username = "alice";
+  compressionMode = false; // plain text to read back the order
+  aggregationMode = false; // a radio frame each
+  radioReadyMillis = hostMillis + 1000;
+
+  unsigned long startMillis = hostMillis;
+  queuePing(TxPing);
+  queuePing(TxPing); // already queued, skipped
+  queuePing(TxAck);
+  const char *texts[] = {"one", "two", "three"};
+  for (const char *text : texts)
+    queueMessage(TxChat, 0, text, strlen(text));
+  printf("  queued 3 messages and 2 pings in %lu ms\n", hostMillis - startMillis);
+
+  txOrder.clear();
+  while (processTxQueue())
+  {
+    loopback.poll([](const uint8_t *frameData, size_t frameDataLength, int, bool) {
+      FrameView frame;
+      if (decodeFrame(frameData, frameDataLength, frame))
+        txOrder += frame.channel == PING_CHANNEL ? "ping " : std::string(frame.text, frame.textLength) + " ";
+    });
+  }
+  printf("  sent in order: %s\n", txOrder.c_str());
+  printf("  radio busy until %lu ms\n", radioReadyMillis - startMillis);
+
+  for (uint8_t p = 0; p < TxPriorityCount; p++)
+  {
+    TxQueueStats stats = txQueue.getStats((TxPriority)p);
+    printf("  %-4s: %u queued, %u dropped, max depth %u, mean %lu ms, max %u ms in queue\n", TxPriorityNames[p], stats.queued, stats.dropped,
+           stats.maxDepth, stats.queued ? (unsigned long)(stats.totalQueueMillis / stats.queued) : 0UL, stats.maxQueueMillis);
+  }
+
+  processQueuedMessages(); // sent messages into the history
+  int failures = chatTab[0].history.size() != 3 || txOrder != "one two three ping ping ";
+  loopback.frameTimeMillis = 0;
+  compressionMode = true;
+  aggregationMode = true;
+  return failures;
+}
+
+struct Scenario
+{
+  const char *name;
+  int (*run)();
+};
+
+const Scenario scenarios[] = {
+    {"loopback", runLoopback},
+    {"loopback-ack", runAckLoopback},
+    {"loopback-fragments", runFragmentLoopback},
+    {"tx-queue", runTxQueue},
+    {"bench-codec", runCodecBench},
+    {"report-wire", runWireReport},
+    {"bench-compression", runCompressionBench},
+    {"bench-redraw", runRedrawBench},
+    {"bench-presence", runPresenceBench},
+    {"bench-chat-log", runChatLogBench},
+    {"bench-storage", runStorageBench},
+    {"bench-screenshot", runScreenshotBench},
+    {"bench-config", runConfigBench},
+    {"sim-relay", runRelaySim},
+    {"sim-duty-cycle", runDutyCycleSim},
+    {"sim-beacon", runBeaconSim},
+    {"sim-response", runResponseSim},
+    {"sim-aggregation", runAggregationSim},
+    {"sim-ui-wake", runUiWakeSim},
+    {"sim-key-scan", runKeyScanSim},
+};
+
+int main(int argc, char **argv)
+{
+  initChatTabs();
+
+  int result = 0;
+  bool found = false;
+
+  for (const Scenario &scenario : scenarios)
+  {
+    if (argc > 1 && strcmp(argv[1], scenario.name) != 0)
+      continue;
+
+    found = true;
+    result |= scenario.run();
+  }
+
+  if (!found)
+  {
+    fprintf(stderr, "unknown scenario: %s\n", argv[1]);
+    return 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// v1 vs v2 frame size and airtime over the chat corpus
+
+#include "airtime.h"
+#include "chat_corpus.h"
+
+int runWireReport()
+{
+  printf("== report-wire ==\n");
+
+  const char *reportUsername = "chngme";
+  const size_t reportUsernameLength = strlen(reportUsername);
+
+  // E220 defaults, BW125K_SF9
+  LoRaModulation modulation = loraModulationFromAirDataRate(0b10000);
+
+  size_t v1Bytes = 0, v2Bytes = 0;
+  unsigned long v1Airtime = 0, v2Airtime = 0;
+  uint8_t frameData[MaxFrameLength];
+
+  for (size_t i = 0; i < ChatCorpusCount; i++)
+  {
+    const char *text = ChatCorpus[i];
+    size_t v1Length = encodeFrameV1(frameData, sizeof(frameData), 0, i, reportUsername, reportUsernameLength, text, strlen(text));
+
+    FrameView frame = {};
+    frame.nonce = i;
+    frame.sequence = i;
+    frame.flags = FrameFlags::Sequence | ((i % FullNameInterval == 0) ? FrameFlags::FullName : 0);
+    frame.senderHash = usernameHash(reportUsername, reportUsernameLength);
+    frame.username = reportUsername;
+    frame.usernameLength = reportUsernameLength;
+    frame.text = text;
+    frame.textLength = strlen(text);
+    size_t v2Length = encodeFrame(frameData, sizeof(frameData), frame);
+
+    v1Bytes += v1Length;
+    v2Bytes += v2Length;
+    v1Airtime += loraAirtimeMicros(modulation, v1Length);
+    v2Airtime += loraAirtimeMicros(modulation, v2Length);
+  }
+
+  printf("  SF%d BW%dkHz, username \"%s\", full name every %d frames, %zu messages\n",
+         modulation.spreadingFactor, modulation.bandwidthKHz, reportUsername, FullNameInterval, ChatCorpusCount);
+  printf("  v1: %5.1f bytes/msg %6.1f ms airtime/msg %5.1f ms uart/msg\n",
+         (double)v1Bytes / ChatCorpusCount, v1Airtime / 1000.0 / ChatCorpusCount, e220UartMicros(v1Bytes) / 1000.0 / ChatCorpusCount);
+  printf("  v2: %5.1f bytes/msg %6.1f ms airtime/msg %5.1f ms uart/msg\n",
+         (double)v2Bytes / ChatCorpusCount, v2Airtime / 1000.0 / ChatCorpusCount, e220UartMicros(v2Bytes) / 1000.0 / ChatCorpusCount);
+  printf("  saved %.1f bytes/msg, %.1f ms airtime/msg (%.1f%%)\n",
+         (double)(v1Bytes - v2Bytes) / ChatCorpusCount, ((double)v1Airtime - v2Airtime) / 1000.0 / ChatCorpusCount,
+         100.0 * ((double)v1Airtime - v2Airtime) / v1Airtime);
+
+  return 0;
+}
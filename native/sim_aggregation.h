@@ -0,0 +1,119 @@
+#pragma once
+
+// frame aggregation throughput under burst load
+//
+// one node runs the transmit path from chat.h over an E220 at SF9 BW125: every frame pays the UART at
+// 9600 baud and LoRa time on air for its length, preamble and header included. Short chat lines are
+// typed faster than the radio can send them (held and retried when the transmit queue is full, like
+// the keyboard does) with pending acks and a beacon in the mix. Compares a radio frame per message
+// with aggregation, in messages delivered per second, for both E220 subpacket sizes in use.
+
+#include "aggregate.h"
+#include "airtime.h"
+#include "chat_corpus.h"
+
+const unsigned long AggregationSimDurationMillis = 60000;
+const unsigned long AggregationSimTypingMillis = 40; // a chat line every 40 ms, more than the radio carries either way
+
+// loopback with E220 timing
+class E220Loopback : public LoopbackTransport
+{
+public:
+  unsigned long frameMillis(size_t frameDataLength) const override
+  {
+    return (e220UartMicros(frameDataLength) + airtimeMicros(frameDataLength)) / 1000 + 1;
+  }
+
+  unsigned long airtimeMicros(size_t frameDataLength) const override
+  {
+    return loraAirtimeMicros(loraModulationFromAirDataRate(0b10000), frameDataLength);
+  }
+};
+
+E220Loopback aggregationSimRadio;
+size_t aggregationSimMessages, aggregationSimRadioFrames;
+
+void countAggregationSimFrame(const uint8_t *frameData, size_t frameDataLength)
+{
+  FrameView frame;
+  if (decodeFrame(frameData, frameDataLength, frame) && frame.channel != PING_CHANNEL)
+    aggregationSimMessages++;
+}
+
+double runAggregation(bool isAggregated, size_t mtu)
+{
+  randomSeed(1);
+  transport = &aggregationSimRadio;
+  aggregationSimRadio.clear();
+  aggregationSimRadio.maxFrameLength = mtu;
+  aggregationMode = isAggregated;
+  txQueue.clear();
+  username = "alice";
+  radioReadyMillis = hostMillis;
+  aggregationSimMessages = aggregationSimRadioFrames = 0;
+
+  unsigned long startMillis = hostMillis;
+  unsigned long nextTypedMillis = startMillis;
+  size_t typed = 0;
+  bool isHeld = false;
+  while (hostMillis - startMillis < AggregationSimDurationMillis)
+  {
+    if (!isHeld && hostMillis >= nextTypedMillis)
+    {
+      isHeld = true;
+      typed++;
+      nextTypedMillis += AggregationSimTypingMillis;
+    }
+    if (isHeld)
+    {
+      const char *text = ChatCorpus[typed % ChatCorpusCount];
+      isHeld = !queueMessage(TxChat, typed % ChatTabCount, text, strlen(text));
+    }
+    if (typed % 10 == 0)
+      pendingAcks.add(0x1234, typed, hostMillis); // other users' messages to ack
+    if (typed % 50 == 0)
+      queuePing(TxPing);
+
+    // the transmit task sends a request, the frame before it is on air meanwhile
+    processTxQueue();
+    processQueuedMessages();
+    if (txQueue.size(TxChat) == 0)
+      delay(10);
+
+    aggregationSimRadio.poll([](const uint8_t *frameData, size_t frameDataLength, int, bool) {
+      aggregationSimRadioFrames++;
+      if (!forEachAggregatedFrame(frameData, frameDataLength, countAggregationSimFrame))
+        countAggregationSimFrame(frameData, frameDataLength);
+    });
+  }
+
+  while (processTxQueue())
+    ;
+  aggregationSimRadio.clear();
+  return aggregationSimMessages * 1000.0 / AggregationSimDurationMillis;
+}
+
+int runAggregationSim()
+{
+  printf("== sim-aggregation ==\n");
+  printf("  E220 SF9 BW125 over UART at 9600 baud, a chat line typed every %lu ms for %lu s\n", AggregationSimTypingMillis,
+         AggregationSimDurationMillis / 1000);
+  printf("    mtu | one per frame | aggregated    | gain\n");
+
+  int failures = 0;
+  const size_t mtus[] = {200, 64};
+  for (size_t mtu : mtus)
+  {
+    double single = runAggregation(false, mtu);
+    size_t singleFrames = aggregationSimRadioFrames;
+    double aggregated = runAggregation(true, mtu);
+    printf("    %3zu | %5.2f msg/s   | %5.2f msg/s   | %4.2fx, %.1f messages per radio frame\n", mtu, single, aggregated,
+           aggregated / single, (double)aggregationSimMessages / aggregationSimRadioFrames);
+    failures += aggregated <= single || singleFrames == 0;
+  }
+
+  aggregationMode = true;
+  aggregationSimRadio.maxFrameLength = MAX_FRAME_LENGTH;
+  transport = NULL;
+  return failures;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// presence beacon simulation
+//
+// nodes in range of each other join one by one over the first two minutes and send a chat message
+// every 2-10 minutes. Compares the old fixed ping (every base interval without another frame of ours)
+// with the beacon scheduler from beacon.h: frames per minute on the channel, and how often a node's
+// presence would have expired at its neighbours (gap between its frames over the presence timeout).
+
+#include "beacon.h"
+
+const unsigned long BeaconSimBaseMillis = 60000; // LoRa ping interval
+const unsigned long BeaconSimDurationMillis = 60 * 60 * 1000;
+const unsigned long BeaconSimTickMillis = 100;
+
+struct BeaconSimResult
+{
+  double pingsPerMinute;
+  double framesPerMinute;
+  unsigned long longestGapMillis;
+  unsigned long timeoutMillis;
+  size_t expiries;
+};
+
+BeaconSimResult runBeaconNodes(size_t nodeCount, bool isAdaptive)
+{
+  randomSeed(nodeCount);
+  std::vector<BeaconScheduler> beacons(nodeCount);
+  std::vector<unsigned long> joinMillis(nodeCount), lastFrameMillis(nodeCount), nextChatMillis(nodeCount);
+  for (size_t i = 0; i < nodeCount; i++)
+  {
+    joinMillis[i] = random(0, 120000);
+    nextChatMillis[i] = joinMillis[i] + random(120000, 600000);
+  }
+
+  BeaconSimResult result = {};
+  size_t pings = 0, frames = 0, joined = 0;
+  for (unsigned long now = 0; now < BeaconSimDurationMillis; now += BeaconSimTickMillis)
+  {
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+      if (now == joinMillis[i] - joinMillis[i] % BeaconSimTickMillis)
+      {
+        // a new node resets everyone already there, as receiveMessage() does on its first frame
+        beacons[i].begin(BeaconSimBaseMillis, now);
+        lastFrameMillis[i] = now;
+        joined++;
+        for (size_t j = 0; j < nodeCount; j++)
+          if (j != i && now > joinMillis[j])
+            beacons[j].reset(now);
+      }
+      if (now < joinMillis[i])
+        continue;
+
+      bool isSent = false;
+      if (now >= nextChatMillis[i])
+      {
+        isSent = true;
+        frames++;
+        nextChatMillis[i] = now + random(120000, 600000);
+      }
+      else if (isAdaptive)
+      {
+        beacons[i].setNeighbours(joined - 1);
+        if (beacons[i].poll(now, lastFrameMillis[i]))
+        {
+          isSent = true;
+          pings++;
+        }
+      }
+      else if (now - lastFrameMillis[i] > BeaconSimBaseMillis)
+      {
+        isSent = true;
+        pings++;
+      }
+
+      if (isSent)
+      {
+        unsigned long gap = now - lastFrameMillis[i];
+        unsigned long timeout = std::max(BeaconSimBaseMillis * 3, isAdaptive ? beacons[i].presenceTimeoutMillis() : 0);
+        result.longestGapMillis = std::max(result.longestGapMillis, gap);
+        result.timeoutMillis = std::max(result.timeoutMillis, timeout);
+        result.expiries += gap > timeout;
+        lastFrameMillis[i] = now;
+      }
+    }
+  }
+
+  double minutes = BeaconSimDurationMillis / 60000.0;
+  result.pingsPerMinute = pings / minutes;
+  result.framesPerMinute = (pings + frames) / minutes;
+  return result;
+}
+
+int runBeaconSim()
+{
+  printf("== sim-beacon ==\n");
+  printf("  %lu min, all nodes in range, %lu s base interval, a chat message per node every 2-10 min\n",
+         BeaconSimDurationMillis / 60000, BeaconSimBaseMillis / 1000);
+  printf("  nodes |     fixed ping      |          beacon\n");
+  printf("        | pings/min frame/min | pings/min frame/min  gap/timeout  expired\n");
+
+  int failures = 0;
+  const size_t nodeCounts[] = {3, 10, 30};
+  for (size_t nodeCount : nodeCounts)
+  {
+    BeaconSimResult fixed = runBeaconNodes(nodeCount, false);
+    BeaconSimResult adaptive = runBeaconNodes(nodeCount, true);
+    printf("  %5zu | %9.1f %9.1f | %9.1f %9.1f  %4lu/%-4lu s  %7zu\n", nodeCount, fixed.pingsPerMinute, fixed.framesPerMinute,
+           adaptive.pingsPerMinute, adaptive.framesPerMinute, adaptive.longestGapMillis / 1000, adaptive.timeoutMillis / 1000,
+           adaptive.expiries);
+    failures += adaptive.expiries > 0;
+  }
+
+  return failures;
+}
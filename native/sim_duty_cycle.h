@@ -0,0 +1,134 @@
+#pragma once
+
+// duty-cycle budget simulation
+//
+// one node runs the transmit path from chat.h for two hours of simulated time: a presence ping every
+// minute, response pings to new users now and then, a busy quarter hour of chat followed by a message
+// every few minutes. Frames take 300 ms on air, about a short frame at SF9 BW125. Compares no limit with
+// 10% and 1% budgets: airtime in the busiest hour, how long chat waited and how many pings were dropped.
+
+#include <deque>
+
+#include "chat_corpus.h"
+
+const unsigned long DutyCycleSimDurationMillis = 2 * DutyCycleWindowMillis;
+const unsigned long DutyCycleSimFrameMillis = 300;
+
+struct DutyCycleSimResult
+{
+  double busiestHourPercent;
+  size_t chatQueued;
+  size_t chatSent;
+  unsigned long maxChatWaitMillis;
+  size_t pingsSent;
+  uint32_t pingsDropped;
+};
+
+std::deque<unsigned long> dutyCycleSimSends;
+
+// notes when each frame goes out, polling only later would shift some frames by a loop
+class DutyCycleSimRadio : public LoopbackTransport
+{
+public:
+  int send(const uint8_t *frameData, size_t frameDataLength) override
+  {
+    dutyCycleSimSends.push_back(hostMillis);
+    return LoopbackTransport::send(frameData, frameDataLength);
+  }
+};
+
+DutyCycleSimRadio dutyCycleSimRadio;
+
+DutyCycleSimResult runDutyCycle(uint8_t dutyCyclePercent)
+{
+  randomSeed(dutyCyclePercent);
+  transport = &dutyCycleSimRadio;
+  dutyCycleSimRadio.clear();
+  dutyCycleSimRadio.frameTimeMillis = DutyCycleSimFrameMillis;
+  txQueue.clear();
+  for (uint8_t i = 0; i < ChatTabCount; i++)
+    chatTab[i].history.clear();
+  username = "alice";
+  airtimeBudget.clear();
+  airtimeBudget.configure(dutyCyclePercent, hostMillis);
+
+  DutyCycleSimResult result = {};
+  dutyCycleSimSends.clear();
+  unsigned long busiestHourMillis = 0;
+  unsigned long startMillis = hostMillis;
+  unsigned long nextPingMillis = 0, nextResponseMillis = random(0, 600000), nextChatMillis = 60000;
+  size_t unqueuedChat = 0; // typed but held back by a full queue, like the keyboard keeps it
+
+  while (hostMillis - startMillis < DutyCycleSimDurationMillis)
+  {
+    unsigned long now = hostMillis - startMillis;
+    if (now >= nextPingMillis)
+    {
+      queuePing(TxPing);
+      nextPingMillis = now + 60000;
+    }
+    if (now >= nextResponseMillis)
+    {
+      queuePing(TxPing);
+      nextResponseMillis = now + random(60000, 600000);
+    }
+    if (now >= nextChatMillis)
+    {
+      unqueuedChat++;
+      result.chatQueued++;
+      bool isBusy = now < 15 * 60000;
+      nextChatMillis = now + (isBusy ? random(2000, 6000) : random(60000, 300000));
+    }
+    while (unqueuedChat > 0)
+    {
+      const char *text = ChatCorpus[result.chatQueued % ChatCorpusCount];
+      if (!queueMessage(TxChat, 0, text, strlen(text)))
+        break;
+      unqueuedChat--;
+    }
+
+    while (processTxQueue())
+      ;
+    processQueuedMessages(); // sent messages into the history
+
+    dutyCycleSimRadio.poll([](const uint8_t *, size_t, int, bool) {});
+    while (!dutyCycleSimSends.empty() && dutyCycleSimSends.front() + DutyCycleWindowMillis <= hostMillis)
+      dutyCycleSimSends.pop_front();
+    busiestHourMillis = std::max(busiestHourMillis, (unsigned long)dutyCycleSimSends.size() * DutyCycleSimFrameMillis);
+
+    delay(100);
+  }
+
+  TxQueueStats chatStats = txQueue.getStats(TxChat);
+  TxQueueStats pingStats = txQueue.getStats(TxPing);
+  result.busiestHourPercent = 100.0 * busiestHourMillis / DutyCycleWindowMillis;
+  result.chatSent = chatStats.queued - chatStats.depth;
+  result.maxChatWaitMillis = chatStats.maxQueueMillis;
+  result.pingsSent = pingStats.queued - pingStats.depth - airtimeBudget.dropped;
+  result.pingsDropped = airtimeBudget.dropped;
+  return result;
+}
+
+int runDutyCycleSim()
+{
+  printf("== sim-duty-cycle ==\n");
+  printf("  %lu min, %lu ms frames, ping every minute, 15 min of busy chat then a message every 1-5 min\n",
+         DutyCycleSimDurationMillis / 60000, DutyCycleSimFrameMillis);
+  printf("  duty | busiest hour | chat sent  max wait | pings sent dropped\n");
+
+  int failures = 0;
+  const uint8_t dutyCycles[] = {100, 10, 1};
+  for (uint8_t dutyCycle : dutyCycles)
+  {
+    DutyCycleSimResult result = runDutyCycle(dutyCycle);
+    printf("  %3u%% | %10.2f%% | %4zu/%-4zu %6lu s | %10zu %7u\n", dutyCycle, result.busiestHourPercent, result.chatSent,
+           result.chatQueued, result.maxChatWaitMillis / 1000, result.pingsSent, result.pingsDropped);
+
+    // no rolling hour may go over the duty cycle
+    failures += result.busiestHourPercent > dutyCycle;
+  }
+
+  airtimeBudget.clear();
+  transport = NULL;
+  return failures;
+}
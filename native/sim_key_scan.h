@@ -0,0 +1,156 @@
+#pragma once
+
+// keyboard scanning simulation
+//
+// 200 characters typed at 5, 10 and 15 per second, each key held 40-90 ms with contact bounce on some
+// presses and releases, fast typing rolls over into the next key before the last is up. Compares the old
+// keyboardInputTask (scanning in a loop, taking the keys down on a change at most every 200 ms) with
+// KeyScanner from key_events.h: characters delivered, press to scan delay and scans per second over the
+// typing and a minute idle after it. Then taps of MinKeyPressMillis, each after the scan has gone idle,
+// at every phase of the idle scan: none may be missed.
+
+#include "key_events.h"
+
+const size_t KeyScanSimChars = 200;
+const unsigned long KeyScanSimIdleMillis = 60000;
+const unsigned long KeyScanSimOldDebounceMillis = 200;
+const unsigned long KeyScanSimOldScanMillis = 1; // a tight loop on the device, every ms here
+
+struct KeyScanSimPress
+{
+  uint8_t key;
+  unsigned long downMillis;
+  unsigned long upMillis;
+  bool isBouncyDown; // contact opens again for a ms just after going down
+  bool isBouncyUp;   // closes again for a ms just after going up
+};
+
+uint64_t keysDownAt(const std::vector<KeyScanSimPress> &presses, unsigned long now)
+{
+  uint64_t down = 0;
+  for (const KeyScanSimPress &press : presses)
+  {
+    bool isDown = now >= press.downMillis && now < press.upMillis;
+    if (press.isBouncyDown && now == press.downMillis + 1)
+      isDown = false;
+    if (press.isBouncyUp && now == press.upMillis + 1)
+      isDown = true;
+    if (isDown)
+      down |= 1ULL << press.key;
+  }
+  return down;
+}
+
+std::vector<KeyScanSimPress> typeKeys(unsigned long charsPerSecond)
+{
+  randomSeed(charsPerSecond);
+  std::vector<KeyScanSimPress> presses;
+  unsigned long now = 1000;
+  for (size_t i = 0; i < KeyScanSimChars; i++)
+  {
+    KeyScanSimPress press;
+    press.key = random(0, KeyCount);
+    press.downMillis = now;
+    press.upMillis = now + random(40, 90);
+    press.isBouncyDown = random(0, 4) == 0;
+    press.isBouncyUp = random(0, 4) == 0;
+
+    // the same key again has to come up first, a double letter takes at least 30 ms
+    for (KeyScanSimPress &earlier : presses)
+      if (earlier.key == press.key)
+        earlier.upMillis = std::min(earlier.upMillis, now - 2 * KeyDebounceMillis);
+    presses.push_back(press);
+
+    unsigned long meanGap = 1000 / charsPerSecond;
+    now += random(meanGap / 2, meanGap * 3 / 2);
+  }
+  return presses;
+}
+
+int runKeyScanSim()
+{
+  printf("== sim-key-scan ==\n");
+  printf("  %zu chars, keys held 40-90 ms, bounce on a quarter of edges, then %lu s idle\n", KeyScanSimChars,
+         KeyScanSimIdleMillis / 1000);
+  printf("  chars/s |     old: taken  |  KeyScanner: delivered  in order  delay mean/max  scans/s\n");
+
+  int failures = 0;
+  const unsigned long speeds[] = {5, 10, 15};
+  for (unsigned long charsPerSecond : speeds)
+  {
+    std::vector<KeyScanSimPress> presses = typeKeys(charsPerSecond);
+    unsigned long endMillis = presses.back().upMillis + KeyScanSimIdleMillis;
+
+    // old: on a change with keys down, every key down is taken, unless within the debounce delay
+    size_t oldDelivered = 0;
+    uint64_t lastDown = 0;
+    unsigned long lastPressMillis = 0;
+    for (unsigned long now = 0; now < endMillis; now += KeyScanSimOldScanMillis)
+    {
+      uint64_t down = keysDownAt(presses, now);
+      if (down != lastDown && down != 0 && now - lastPressMillis >= KeyScanSimOldDebounceMillis)
+      {
+        lastPressMillis = now;
+        for (uint8_t i = 0; i < KeyCount; i++)
+          oldDelivered += (down >> i) & 1;
+      }
+      lastDown = down;
+    }
+
+    // KeyScanner: each newly pressed key is an event
+    KeyScanner scanner;
+    std::vector<uint8_t> delivered;
+    unsigned long totalDelay = 0, maxDelay = 0;
+    for (unsigned long now = 0; now < endMillis; now += scanner.scanDelay(now))
+    {
+      uint64_t newlyPressed = scanner.update(keysDownAt(presses, now), now);
+      for (uint8_t i = 0; i < KeyCount; i++)
+      {
+        if (!((newlyPressed >> i) & 1))
+          continue;
+        // the latest press of that key that is down by now
+        for (size_t p = presses.size(); p-- > 0;)
+        {
+          if (presses[p].key == i && presses[p].downMillis <= now)
+          {
+            totalDelay += now - presses[p].downMillis;
+            maxDelay = std::max(maxDelay, now - presses[p].downMillis);
+            break;
+          }
+        }
+        delivered.push_back(i);
+      }
+    }
+
+    bool isInOrder = delivered.size() == presses.size();
+    for (size_t i = 0; isInOrder && i < presses.size(); i++)
+      isInOrder = delivered[i] == presses[i].key;
+    failures += !isInOrder;
+
+    printf("  %7lu | %9zu/%-5zu | %15zu/%-5zu %8s  %6.1f/%-3lu ms  %7.1f\n", charsPerSecond, oldDelivered, presses.size(),
+           delivered.size(), presses.size(), isInOrder ? "yes" : "no", delivered.empty() ? 0.0 : (double)totalDelay / delivered.size(),
+           maxDelay, scanner.scans() * 1000.0 / endMillis);
+  }
+
+  // a tap after each idle spell, a ms later each time so the taps fall at every point between two scans
+  std::vector<KeyScanSimPress> taps;
+  unsigned long tapMillis = 0;
+  for (unsigned long i = 0; i < IdleScanMillis; i++)
+  {
+    tapMillis += KeyIdleMillis + 1000 + 1;
+    taps.push_back({(uint8_t)(i % KeyCount), tapMillis, tapMillis + MinKeyPressMillis, false, false});
+  }
+
+  KeyScanner scanner;
+  size_t caught = 0;
+  for (unsigned long now = 0; now < tapMillis + 1000; now += scanner.scanDelay(now))
+  {
+    uint64_t newlyPressed = scanner.update(keysDownAt(taps, now), now);
+    for (uint8_t i = 0; i < KeyCount; i++)
+      caught += (newlyPressed >> i) & 1;
+  }
+  failures += caught != taps.size();
+  printf("  %lu ms taps after %lu s idle: %zu/%zu caught\n", MinKeyPressMillis, KeyIdleMillis / 1000, caught, taps.size());
+
+  return failures;
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+// multi-node LoRa relay simulation
+//
+// nodes are placed at random in a square, each in range of the nodes within RelaySimRange. A frame is
+// received if no other frame audible at the receiver overlaps it and the receiver isn't sending (no
+// capture effect, no listen before talk). Nodes send chat messages at random and run the relay code from
+// relay.h and duplicate_filter.h on what they receive. Compares no relaying, flooding (relay everything
+// after a short random wait) and relay mode (rssi weighted wait, cancelled when overheard).
+
+#include <map>
+#include <math.h>
+
+#include "airtime.h"
+#include "chat_corpus.h"
+
+const double RelaySimArea = 4000;  // meters, side of the square
+const double RelaySimRange = 1500; // meters
+const unsigned long RelaySimDurationMillis = 30 * 60 * 1000;
+const unsigned long RelaySimTickMillis = 5;
+
+enum RelaySimMode
+{
+  NoRelay,
+  Flood,
+  Relay
+};
+
+struct RelaySimNode
+{
+  double x, y;
+  uint16_t senderHash;
+  uint16_t sequence;
+  unsigned long nextMessageMillis;
+  unsigned long sendingUntilMillis;
+  DuplicateFilter duplicates;
+  RelayQueue relays;
+};
+
+struct RelaySimFrame
+{
+  uint8_t node;
+  unsigned long startMillis;
+  unsigned long endMillis;
+  uint8_t data[MaxFrameLength];
+  uint8_t length;
+};
+
+struct RelaySimResult
+{
+  double deliveryRatio; // of receivers reachable from the sender over any number of hops
+  double reachableRatio;
+  double framesPerMessage;
+  double channelUtilisation; // mean fraction of time a node hears (or sends) a frame, overlaps counted twice
+};
+
+class RelaySim
+{
+public:
+  RelaySim(size_t nodeCount, unsigned long seed) : nodes(nodeCount)
+  {
+    randomSeed(seed);
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+      nodes[i].x = random(0, (long)RelaySimArea);
+      nodes[i].y = random(0, (long)RelaySimArea);
+    }
+
+    inRange.assign(nodeCount, std::vector<bool>(nodeCount, false));
+    rssi.assign(nodeCount, std::vector<int>(nodeCount, 0));
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+      for (size_t j = 0; j < nodeCount; j++)
+      {
+        double distance = std::max(1.0, hypot(nodes[i].x - nodes[j].x, nodes[i].y - nodes[j].y));
+        inRange[i][j] = i != j && distance <= RelaySimRange;
+        // -40 dBm at 1 m down to RelayWeakRssi at the edge of range
+        rssi[i][j] = -40 + (int)((RelayWeakRssi + 40) * log(distance) / log(RelaySimRange));
+      }
+    }
+
+    // which nodes can reach each other over any number of hops
+    reachable.assign(nodeCount, std::vector<bool>(nodeCount, false));
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+      std::vector<size_t> queue(1, i);
+      reachable[i][i] = true;
+      for (size_t q = 0; q < queue.size(); q++)
+        for (size_t j = 0; j < nodeCount; j++)
+          if (inRange[queue[q]][j] && !reachable[i][j])
+          {
+            reachable[i][j] = true;
+            queue.push_back(j);
+          }
+    }
+  }
+
+  RelaySimResult run(RelaySimMode mode, unsigned long seed)
+  {
+    randomSeed(seed);
+    this->mode = mode;
+    frames.clear();
+    sentFrames = 0;
+    delivered.clear();
+    messageSenders.clear();
+    std::vector<unsigned long> busyMillis(nodes.size(), 0);
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      RelaySimNode &node = nodes[i];
+      node.senderHash = i;
+      node.sequence = 0;
+      node.nextMessageMillis = random(0, 120000);
+      node.sendingUntilMillis = 0;
+      node.duplicates.clear();
+      node.relays.clear();
+    }
+
+    size_t firstActive = 0;
+    for (unsigned long now = 0; now < RelaySimDurationMillis; now += RelaySimTickMillis)
+    {
+      // frames that finished this tick are received
+      for (size_t f = firstActive; f < frames.size(); f++)
+      {
+        RelaySimFrame &frame = frames[f];
+        if (frame.endMillis > now || frame.length == 0)
+          continue;
+
+        busyMillis[frame.node] += frame.endMillis - frame.startMillis;
+        for (size_t r = 0; r < nodes.size(); r++)
+        {
+          if (!inRange[frame.node][r])
+            continue;
+          busyMillis[r] += frame.endMillis - frame.startMillis;
+          if (!isCollided(f, r))
+            receive(r, frame, now);
+        }
+        frame.length = 0; // done
+      }
+      while (firstActive < frames.size() && frames[firstActive].length == 0)
+        firstActive++;
+
+      for (size_t i = 0; i < nodes.size(); i++)
+      {
+        RelaySimNode &node = nodes[i];
+        if (now < node.sendingUntilMillis)
+          continue;
+
+        if (now >= node.nextMessageMillis)
+        {
+          originate(i, now);
+          node.nextMessageMillis = now + random(60000, 180000);
+          continue;
+        }
+
+        node.relays.poll(now, [&](const uint8_t *frameData, size_t frameDataLength) {
+          if (now < node.sendingUntilMillis)
+            return false;
+          send(i, frameData, frameDataLength, now);
+          return true;
+        });
+      }
+    }
+
+    RelaySimResult result;
+    size_t deliveredPairs = 0, reachablePairs = 0, allPairs = 0;
+    for (size_t m = 0; m < messageSenders.size(); m++)
+    {
+      for (size_t r = 0; r < nodes.size(); r++)
+      {
+        if (r == messageSenders[m])
+          continue;
+        allPairs++;
+        if (reachable[messageSenders[m]][r])
+        {
+          reachablePairs++;
+          deliveredPairs += delivered[m][r];
+        }
+      }
+    }
+    unsigned long totalBusy = 0;
+    for (unsigned long busy : busyMillis)
+      totalBusy += busy;
+
+    result.deliveryRatio = reachablePairs ? (double)deliveredPairs / reachablePairs : 0;
+    result.reachableRatio = allPairs ? (double)reachablePairs / allPairs : 0;
+    result.framesPerMessage = messageSenders.empty() ? 0 : (double)sentFrames / messageSenders.size();
+    result.channelUtilisation = (double)totalBusy / nodes.size() / RelaySimDurationMillis;
+    return result;
+  }
+
+private:
+  // overlapped by another frame audible at the receiver, or the receiver was sending
+  bool isCollided(size_t f, size_t r) const
+  {
+    const RelaySimFrame &frame = frames[f];
+    for (size_t g = f; g-- > 0 && frames[g].startMillis + 2000 > frame.startMillis;)
+      if (overlaps(frames[g], frame) && (frames[g].node == r || inRange[frames[g].node][r]))
+        return true;
+    for (size_t g = f + 1; g < frames.size() && frames[g].startMillis < frame.endMillis; g++)
+      if (overlaps(frames[g], frame) && (frames[g].node == r || inRange[frames[g].node][r]))
+        return true;
+    return false;
+  }
+
+  bool overlaps(const RelaySimFrame &a, const RelaySimFrame &b) const
+  {
+    return a.startMillis < b.endMillis && b.startMillis < a.endMillis;
+  }
+
+  void send(size_t i, const uint8_t *frameData, size_t frameDataLength, unsigned long now)
+  {
+    RelaySimFrame frame;
+    frame.node = i;
+    frame.startMillis = now;
+    frame.endMillis = now + (loraAirtimeMicros(modulation, frameDataLength) + 999) / 1000;
+    memcpy(frame.data, frameData, frameDataLength);
+    frame.length = frameDataLength;
+    frames.push_back(frame);
+    nodes[i].sendingUntilMillis = frame.endMillis;
+    sentFrames++;
+  }
+
+  void originate(size_t i, unsigned long now)
+  {
+    RelaySimNode &node = nodes[i];
+    size_t message = messageSenders.size();
+    messageSenders.push_back(i);
+    delivered.push_back(std::vector<uint8_t>(nodes.size(), 0));
+    messageIds[((uint32_t)node.senderHash << 16) | node.sequence] = message;
+
+    const char *text = ChatCorpus[message % ChatCorpusCount];
+    FrameView frame = {};
+    frame.nonce = node.sequence & 0x3F;
+    frame.sequence = node.sequence;
+    frame.flags = FrameFlags::Sequence | FrameFlags::Compressed;
+    frame.senderHash = node.senderHash;
+    frame.text = text;
+    frame.textLength = strlen(text);
+
+    uint8_t frameData[MaxFrameLength];
+    size_t frameDataLength = encodeFrame(frameData, sizeof(frameData), frame);
+    node.sequence = (node.sequence + 1) & SequenceMask;
+    send(i, frameData, frameDataLength, now);
+  }
+
+  // same steps as receiveMessage() in chat.h
+  void receive(size_t r, const RelaySimFrame &received, unsigned long now)
+  {
+    RelaySimNode &node = nodes[r];
+    uint16_t senderHash, sequence;
+    if (!peekFrameSequence(received.data, received.length, senderHash, sequence))
+      return;
+
+    if (node.duplicates.isDuplicate(senderHash, false, sequence))
+    {
+      if (mode == Relay)
+        node.relays.cancel(senderHash, sequence);
+      return;
+    }
+    if (senderHash == node.senderHash)
+      return;
+
+    delivered[messageIds[((uint32_t)senderHash << 16) | sequence]][r] = 1;
+
+    FrameView frame;
+    if (mode == NoRelay || !decodeFrame(received.data, received.length, frame) || frame.hopsLeft == 0)
+      return;
+
+    unsigned long relayDelay = mode == Relay ? relayDelayMillis(rssi[received.node][r], LoRaRelayWindowMillis)
+                                             : random(0, LoRaRelayWindowMillis / 4 + 1);
+    node.relays.schedule(received.data, received.length, senderHash, sequence, now + relayDelay);
+  }
+
+  LoRaModulation modulation = loraModulationFromAirDataRate(0b10000); // E220 default, SF9 BW125
+  RelaySimMode mode;
+  std::vector<RelaySimNode> nodes;
+  std::vector<std::vector<bool>> inRange;
+  std::vector<std::vector<bool>> reachable;
+  std::vector<std::vector<int>> rssi;
+  std::vector<RelaySimFrame> frames;
+  std::vector<std::vector<uint8_t>> delivered; // per message, per receiver
+  std::vector<size_t> messageSenders;
+  std::map<uint32_t, size_t> messageIds; // (sender, sequence) to message
+  size_t sentFrames;
+};
+
+int runRelaySim()
+{
+  printf("== sim-relay ==\n");
+  printf("  %.0f m square, %.0f m range, SF9 BW125, a message per node every 1-3 min, %lu min\n",
+         RelaySimArea, RelaySimRange, RelaySimDurationMillis / 60000);
+  printf("  delivery is to receivers reachable over any number of hops, util is mean channel time busy at a node\n");
+  printf("  nodes reach |   no relay    |        flood         |        relay\n");
+  printf("              | deliv   util  | deliv   util  tx/msg | deliv   util  tx/msg\n");
+
+  const size_t nodeCounts[] = {5, 10, 20, 30, 50};
+  for (size_t nodeCount : nodeCounts)
+  {
+    RelaySim sim(nodeCount, nodeCount);
+    RelaySimResult direct = sim.run(NoRelay, 1);
+    RelaySimResult flood = sim.run(Flood, 1);
+    RelaySimResult relay = sim.run(Relay, 1);
+
+    printf("  %5zu %4.0f%% | %4.0f%% %5.1f%% | %4.0f%% %5.1f%% %6.2f | %4.0f%% %5.1f%% %6.2f\n",
+           nodeCount, 100 * direct.reachableRatio,
+           100 * direct.deliveryRatio, 100 * direct.channelUtilisation,
+           100 * flood.deliveryRatio, 100 * flood.channelUtilisation, flood.framesPerMessage,
+           100 * relay.deliveryRatio, 100 * relay.channelUtilisation, relay.framesPerMessage);
+  }
+
+  return 0;
+}
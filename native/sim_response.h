@@ -0,0 +1,180 @@
+#pragma once
+
+// response ping simulation
+//
+// nodes in range of each other on LoRa, either one node boots among the others or all of them power on
+// within a few seconds. Every node replies to a new neighbour, either at once as receiveMessage() used to
+// (unless it sent a frame in the last second) or through ResponseScheduler. A frame is lost at every
+// receiver if another frame overlaps it (no capture effect, no listen before talk) and a node can't
+// receive while sending. Counts frames sent, frames collided and how many nodes the newcomers heard.
+
+#include "airtime.h"
+#include "beacon.h"
+
+const unsigned long ResponseSimDurationMillis = 10000;
+const unsigned long ResponseSimProcessingMillis = 50; // receive to send at most, UART and task latency
+const size_t ResponseSimPingLength = 12;              // ping with full name
+const size_t ResponseSimTrials = 50;
+
+struct ResponseSimFrame
+{
+  size_t node;
+  unsigned long startMillis;
+  unsigned long endMillis;
+  bool isDone;
+};
+
+struct ResponseSimNode
+{
+  unsigned long bootMillis;
+  unsigned long sendMillis; // next ping, ~0 if none
+  unsigned long sendingUntilMillis;
+  unsigned long lastOwnFrameMillis;
+  ResponseScheduler response;
+};
+
+struct ResponseSimResult
+{
+  double framesSent;
+  double framesCollided;
+  double neighboursHeard; // by each booting node, clean frames from distinct nodes
+};
+
+ResponseSimResult runResponseTrial(size_t nodeCount, bool isGroupBoot, bool isCoalesced, unsigned long seed)
+{
+  randomSeed(seed);
+  const unsigned long NoSend = ~0UL;
+  unsigned long airtimeMillis = (loraAirtimeMicros(loraModulationFromAirDataRate(0b10000), ResponseSimPingLength) + 999) / 1000;
+
+  std::vector<ResponseSimNode> nodes(nodeCount);
+  std::vector<std::vector<bool>> known(nodeCount, std::vector<bool>(nodeCount, !isGroupBoot));
+  std::vector<ResponseSimFrame> frames;
+  for (size_t i = 0; i < nodeCount; i++)
+  {
+    ResponseSimNode &node = nodes[i];
+    bool isBooting = isGroupBoot || i == 0;
+    node.bootMillis = isBooting ? random(0, isGroupBoot ? 3000 : 1) : 0;
+    node.sendMillis = isBooting ? node.bootMillis : NoSend; // boot beacon
+    node.sendingUntilMillis = 0;
+    node.lastOwnFrameMillis = 0;
+    node.response.clear();
+    if (isBooting)
+      for (size_t j = 0; j < nodeCount; j++)
+        known[i][j] = known[j][i] = false;
+  }
+
+  size_t collided = 0;
+  for (unsigned long now = 1; now < ResponseSimDurationMillis; now++)
+  {
+    // frames that ended are received by every node not sending, unless another frame overlapped
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+      ResponseSimFrame &frame = frames[f];
+      if (frame.isDone || frame.endMillis > now)
+        continue;
+      frame.isDone = true;
+
+      bool isCollided = false;
+      for (size_t g = 0; g < frames.size(); g++)
+        if (g != f && frames[g].startMillis < frame.endMillis && frame.startMillis < frames[g].endMillis)
+          isCollided = true;
+      collided += isCollided;
+      if (isCollided)
+        continue;
+
+      for (size_t r = 0; r < nodes.size(); r++)
+      {
+        ResponseSimNode &node = nodes[r];
+        if (r == frame.node || now < node.bootMillis || node.sendingUntilMillis > frame.startMillis)
+          continue;
+
+        if (!known[r][frame.node])
+        {
+          known[r][frame.node] = true;
+          if (isCoalesced)
+          {
+            if (now - node.lastOwnFrameMillis > LoRaResponseWindowMillis || node.lastOwnFrameMillis == 0)
+              node.response.schedule(frame.node, now, LoRaResponseWindowMillis);
+          }
+          else if (now - node.lastOwnFrameMillis > 1000 || node.lastOwnFrameMillis == 0)
+          {
+            node.sendMillis = std::min(node.sendMillis, now + random(0, ResponseSimProcessingMillis));
+          }
+        }
+        else
+        {
+          node.response.overhear(frame.node);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      ResponseSimNode &node = nodes[i];
+      if (now < node.bootMillis || now < node.sendingUntilMillis)
+        continue;
+
+      if (node.response.poll(now, node.lastOwnFrameMillis))
+        node.sendMillis = std::min(node.sendMillis, now + random(0, ResponseSimProcessingMillis));
+
+      if (node.sendMillis <= now)
+      {
+        frames.push_back({i, now, now + airtimeMillis, false});
+        node.sendingUntilMillis = now + airtimeMillis;
+        node.lastOwnFrameMillis = now;
+        node.sendMillis = NoSend;
+      }
+    }
+  }
+
+  ResponseSimResult result = {};
+  size_t bootingNodes = 0, heard = 0;
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    if (!isGroupBoot && i != 0)
+      continue;
+    bootingNodes++;
+    for (size_t j = 0; j < nodes.size(); j++)
+      heard += j != i && known[i][j];
+  }
+  result.framesSent = frames.size();
+  result.framesCollided = collided;
+  result.neighboursHeard = (double)heard / bootingNodes;
+  return result;
+}
+
+int runResponseSim()
+{
+  printf("== sim-response ==\n");
+  printf("  LoRa SF9 BW125, all nodes in range, %zu trials of %lu s, heard is distinct nodes each newcomer got a clean frame from\n",
+         ResponseSimTrials, ResponseSimDurationMillis / 1000);
+  printf("                |   immediate reply    |      coalesced\n");
+  printf("  boot    nodes | sent collided heard  | sent collided heard\n");
+
+  int failures = 0;
+  const size_t nodeCounts[] = {5, 10, 30};
+  for (int isGroupBoot = 0; isGroupBoot <= 1; isGroupBoot++)
+  {
+    for (size_t nodeCount : nodeCounts)
+    {
+      ResponseSimResult sums[2] = {};
+      for (int isCoalesced = 0; isCoalesced <= 1; isCoalesced++)
+      {
+        for (size_t trial = 0; trial < ResponseSimTrials; trial++)
+        {
+          ResponseSimResult result = runResponseTrial(nodeCount, isGroupBoot, isCoalesced, trial + 1);
+          sums[isCoalesced].framesSent += result.framesSent / ResponseSimTrials;
+          sums[isCoalesced].framesCollided += result.framesCollided / ResponseSimTrials;
+          sums[isCoalesced].neighboursHeard += result.neighboursHeard / ResponseSimTrials;
+        }
+      }
+
+      printf("  %-6s %6zu | %4.1f %8.1f %5.1f  | %4.1f %8.1f %5.1f\n", isGroupBoot ? "group" : "single", nodeCount,
+             sums[0].framesSent, sums[0].framesCollided, sums[0].neighboursHeard,
+             sums[1].framesSent, sums[1].framesCollided, sums[1].neighboursHeard);
+      failures += sums[1].framesCollided > sums[0].framesCollided;
+    }
+  }
+
+  return failures;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+// UI task wake-up simulation
+//
+// one node on a loopback with ping, relay and ACK mode on, three neighbours each sending a chat message
+// that asks for acks every 10-40 s. The UI task either polls processQueuedMessages() every 10 ms as loop()
+// used to, or sleeps for processWaitMillis() and is woken early by each received frame as uiWake does on
+// the device. Counts wake-ups and the frames the node sent: relays, acks and beacons should go out the
+// same either way, only without the empty wake-ups in between.
+
+const unsigned long UiWakeSimDurationMillis = 10 * 60 * 1000;
+const unsigned long UiWakeSimPollMillis = 10; // old loop() delay
+const unsigned long UiWakeSimMaxWaitMillis = 1000;
+const size_t UiWakeSimNeighbours = 3;
+
+LoopbackTransport uiWakeLoopback;
+
+struct UiWakeSimResult
+{
+  size_t wakes;
+  unsigned long framesSent;
+  uint32_t relayed;
+};
+
+// a chat frame from neighbour, straight from the sender, asking for acks
+size_t encodeNeighbourFrame(uint8_t *frameData, size_t neighbour, uint16_t sequence)
+{
+  char name[MaxUsernameLength + 1];
+  snprintf(name, sizeof(name), "peer%zu", neighbour);
+  const char *text = "anyone around?";
+
+  FrameView frame = {};
+  frame.flags = FrameFlags::FullName | FrameFlags::Sequence | FrameFlags::Relayed | FrameFlags::AckRequest;
+  frame.channel = 0;
+  frame.sequence = sequence;
+  frame.nonce = sequence & 0x3F;
+  frame.hopsLeft = MaxHops;
+  frame.senderHash = usernameHash(name, strlen(name));
+  frame.username = name;
+  frame.usernameLength = strlen(name);
+  frame.text = text;
+  frame.textLength = strlen(text);
+  return encodeFrame(frameData, MaxFrameLength, frame);
+}
+
+UiWakeSimResult runUiWakeNode(bool isEventDriven)
+{
+  randomSeed(7);
+  transport = &uiWakeLoopback;
+  uiWakeLoopback.clear();
+  txQueue.clear();
+  presence.clear();
+  relayQueue.clear();
+  responsePing.clear();
+  duplicateFilter.clear();
+  beacon = BeaconScheduler();
+  ackTracker = AckTracker();
+  pendingAcks = PendingAcks();
+  chatTab[0].history.clear();
+  username = "alice";
+  relayMode = true;
+  ackMode = true;
+
+  unsigned long startMillis = hostMillis;
+  unsigned long endMillis = startMillis + UiWakeSimDurationMillis;
+  unsigned long nextFrameMillis[UiWakeSimNeighbours];
+  uint16_t sequences[UiWakeSimNeighbours];
+  for (size_t i = 0; i < UiWakeSimNeighbours; i++)
+  {
+    nextFrameMillis[i] = startMillis + random(10000, 40000);
+    sequences[i] = random(0, SequenceMask + 1);
+  }
+
+  UiWakeSimResult result = {};
+  uint32_t relayedBefore = relayQueue.relayed();
+  unsigned long sentBefore = uiWakeLoopback.sentCount;
+  while (hostMillis < endMillis)
+  {
+    // frames from the neighbours that arrived since the last wake-up
+    for (size_t i = 0; i < UiWakeSimNeighbours; i++)
+    {
+      if ((long)(hostMillis - nextFrameMillis[i]) < 0)
+        continue;
+      uint8_t frameData[MaxFrameLength];
+      size_t frameDataLength = encodeNeighbourFrame(frameData, i, sequences[i]);
+      queueReceivedFrame(frameData, frameDataLength, -80, false);
+      sequences[i] = (sequences[i] + 1) & SequenceMask;
+      nextFrameMillis[i] = hostMillis + random(10000, 40000);
+    }
+
+    // what the UI and transmit tasks do when woken
+    processQueuedMessages();
+    while (processTxQueue())
+      ;
+    uiWakeLoopback.poll([](const uint8_t *, size_t, int, bool) {}); // no one hears our frames, acks go unanswered
+    result.wakes++;
+
+    unsigned long waitMillis = UiWakeSimPollMillis;
+    if (isEventDriven)
+    {
+      waitMillis = processWaitMillis(hostMillis, UiWakeSimMaxWaitMillis);
+      for (size_t i = 0; i < UiWakeSimNeighbours; i++)
+        waitMillis = std::min(waitMillis, nextFrameMillis[i] - hostMillis);
+    }
+    delay(std::max(waitMillis, 1UL));
+  }
+
+  result.framesSent = uiWakeLoopback.sentCount - sentBefore;
+  result.relayed = relayQueue.relayed() - relayedBefore;
+  relayMode = false;
+  ackMode = false;
+  return result;
+}
+
+int runUiWakeSim()
+{
+  printf("== sim-ui-wake ==\n");
+  printf("  %lu min, %zu neighbours each sending every 10-40 s, ping, relay and ACK mode on\n",
+         UiWakeSimDurationMillis / 60000, UiWakeSimNeighbours);
+  printf("  loop          wakes/min  frames sent  relayed\n");
+
+  UiWakeSimResult polled = runUiWakeNode(false);
+  UiWakeSimResult woken = runUiWakeNode(true);
+  double minutes = UiWakeSimDurationMillis / 60000.0;
+  printf("  10 ms poll    %9.1f  %11lu  %7u\n", polled.wakes / minutes, polled.framesSent, polled.relayed);
+  printf("  event driven  %9.1f  %11lu  %7u\n", woken.wakes / minutes, woken.framesSent, woken.relayed);
+
+  // the same work, in far fewer wake-ups
+  return woken.relayed != polled.relayed || woken.wakes * 10 > polled.wakes;
+}
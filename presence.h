@@ -0,0 +1,278 @@
+#pragma once
+
+// fixed size table of other users seen, keyed by (username hash, transport)
+//
+// lookups go through an open addressing index, so a received frame costs O(1) no matter how many
+// users are in range. Entries are kept in two lists ordered by last seen: active users, and users
+// whose presence expired. Expiry pops the head of the active list, and a new user takes a free slot,
+// else the longest expired one, else the oldest active one. The best RSSI per transport is updated
+// as frames arrive and only rescanned when the user holding it weakens or expires.
+
+#include <Arduino.h>
+
+#include "ack.h"
+#include "frame.h"
+
+struct Presence
+{
+  char username[MaxUsernameLength + 1]; // "#xxxx" placeholder until the full name arrives
+  bool isEspNow;
+  bool isNameKnown;
+  bool isActive; // seen within the timeout
+  int16_t rssi;
+  uint16_t usernameHash;
+  unsigned long lastSeenMillis;
+  RttEstimator rtt; // round trip to this user, from acks of our frames
+};
+
+const uint8_t PresenceCapacity = 32;
+const int NoPresenceRssi = -1000;
+
+class PresenceTable
+{
+public:
+  PresenceTable(unsigned long timeoutMillis) : timeoutMillis(timeoutMillis) { clear(); }
+
+  void clear()
+  {
+    for (uint8_t i = 0; i < IndexSize; i++)
+      index[i] = NoEntry;
+    for (uint8_t i = 0; i < ListCount; i++)
+      listHead[i] = listTail[i] = NoEntry;
+    for (uint8_t i = 0; i < PresenceCapacity; i++)
+      link(i, FreeList);
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      maxRssiEntry[i] = NoEntry;
+      maxRssi[i] = NoPresenceRssi;
+    }
+    count = 0;
+  }
+
+  Presence *find(uint16_t usernameHash, bool isEspNow)
+  {
+    uint8_t slot = findSlot(usernameHash, isEspNow);
+    return index[slot] == NoEntry ? NULL : &entries[index[slot]];
+  }
+
+  // updates the user's rssi and last seen time, adding them if not seen before
+  // isRenewed is set if the user is new or their presence had expired
+  Presence &touch(uint16_t usernameHash, bool isEspNow, int rssi, unsigned long now, bool &isRenewed)
+  {
+    expire(now);
+
+    uint8_t slot = findSlot(usernameHash, isEspNow);
+    uint8_t i = index[slot];
+    if (i == NoEntry)
+    {
+      i = allocate();
+      slot = findSlot(usernameHash, isEspNow); // allocating may have moved index entries
+      index[slot] = i;
+
+      Presence &presence = entries[i];
+      snprintf(presence.username, sizeof(presence.username), "#%04x", usernameHash);
+      presence.usernameHash = usernameHash;
+      presence.isEspNow = isEspNow;
+      presence.isNameKnown = false;
+      presence.isActive = false;
+      presence.rtt = {};
+      count++;
+    }
+    else
+    {
+      unlink(i);
+    }
+
+    Presence &presence = entries[i];
+    isRenewed = !presence.isActive;
+    link(i, ActiveList);
+    presence.isActive = true;
+    presence.lastSeenMillis = now;
+    presence.rssi = rssi;
+
+    // keep the best rssi, only rescan when the best user got weaker
+    uint8_t transport = isEspNow;
+    if (rssi >= maxRssi[transport])
+    {
+      maxRssi[transport] = rssi;
+      maxRssiEntry[transport] = i;
+    }
+    else if (maxRssiEntry[transport] == i)
+    {
+      rescanMaxRssi(transport);
+    }
+
+    return presence;
+  }
+
+  // moves users not seen within the timeout to the expired list
+  void expire(unsigned long now)
+  {
+    while (listHead[ActiveList] != NoEntry && now - entries[listHead[ActiveList]].lastSeenMillis >= timeoutMillis)
+    {
+      uint8_t i = listHead[ActiveList];
+      unlink(i);
+      link(i, ExpiredList);
+      entries[i].isActive = false;
+
+      uint8_t transport = entries[i].isEspNow;
+      if (maxRssiEntry[transport] == i)
+        rescanMaxRssi(transport);
+    }
+  }
+
+  // best rssi of the active users on a transport, NoPresenceRssi if there are none
+  int getMaxRssi(bool isEspNow) const { return maxRssi[isEspNow]; }
+
+  size_t size() const { return count; }
+
+  // active users on a transport
+  size_t activeCount(bool isEspNow) const
+  {
+    size_t active = 0;
+    for (uint8_t i = listHead[ActiveList]; i != NoEntry; i = following[i])
+      active += entries[i].isEspNow == isEspNow;
+    return active;
+  }
+
+  // users are kept active longer when they beacon less often, see beacon.h
+  void setTimeout(unsigned long timeoutMillis) { this->timeoutMillis = timeoutMillis; }
+  unsigned long timeout() const { return timeoutMillis; }
+
+  // visits users from most to least recently seen, active first, stops when f returns false
+  template <typename F>
+  void forEachByRecency(F f) const
+  {
+    for (uint8_t list = ActiveList; list <= ExpiredList; list++)
+      for (uint8_t i = listTail[list]; i != NoEntry; i = previous[i])
+        if (!f(entries[i]))
+          return;
+  }
+
+private:
+  static const uint8_t NoEntry = 0xFF;
+  static const uint8_t IndexSize = PresenceCapacity * 2; // power of two, at most half full
+  enum List
+  {
+    ActiveList = 0,
+    ExpiredList = 1,
+    FreeList = 2,
+    ListCount = 3
+  };
+
+  uint8_t indexHash(uint16_t usernameHash, bool isEspNow) const
+  {
+    return (uint8_t)((usernameHash ^ (usernameHash >> 8) ^ (isEspNow ? 0xA5 : 0)) & (IndexSize - 1));
+  }
+
+  // slot holding the key, or the empty slot where it would go
+  uint8_t findSlot(uint16_t usernameHash, bool isEspNow) const
+  {
+    uint8_t slot = indexHash(usernameHash, isEspNow);
+    while (index[slot] != NoEntry)
+    {
+      const Presence &presence = entries[index[slot]];
+      if (presence.usernameHash == usernameHash && presence.isEspNow == isEspNow)
+        break;
+      slot = (slot + 1) & (IndexSize - 1);
+    }
+    return slot;
+  }
+
+  // takes a free slot, else reuses the longest expired user, else the least recently seen active user
+  // the returned entry is in no list
+  uint8_t allocate()
+  {
+    uint8_t i = listHead[FreeList];
+    if (i != NoEntry)
+    {
+      unlink(i);
+      return i;
+    }
+
+    i = listHead[ExpiredList] != NoEntry ? listHead[ExpiredList] : listHead[ActiveList];
+    removeFromIndex(i);
+    unlink(i);
+    count--;
+
+    uint8_t transport = entries[i].isEspNow;
+    if (maxRssiEntry[transport] == i)
+      rescanMaxRssi(transport);
+
+    return i;
+  }
+
+  // backward shift deletion keeps probe runs intact without tombstones
+  void removeFromIndex(uint8_t i)
+  {
+    uint8_t slot = findSlot(entries[i].usernameHash, entries[i].isEspNow);
+    index[slot] = NoEntry;
+
+    uint8_t next = (slot + 1) & (IndexSize - 1);
+    while (index[next] != NoEntry)
+    {
+      const Presence &presence = entries[index[next]];
+      uint8_t home = indexHash(presence.usernameHash, presence.isEspNow);
+
+      // move the entry back if the hole is between its home slot and where it is now
+      if (((next - home) & (IndexSize - 1)) >= ((next - slot) & (IndexSize - 1)))
+      {
+        index[slot] = index[next];
+        index[next] = NoEntry;
+        slot = next;
+      }
+      next = (next + 1) & (IndexSize - 1);
+    }
+  }
+
+  void rescanMaxRssi(uint8_t transport)
+  {
+    maxRssi[transport] = NoPresenceRssi;
+    maxRssiEntry[transport] = NoEntry;
+    for (uint8_t i = listHead[ActiveList]; i != NoEntry; i = following[i])
+    {
+      if (entries[i].isEspNow == transport && entries[i].rssi >= maxRssi[transport])
+      {
+        maxRssi[transport] = entries[i].rssi;
+        maxRssiEntry[transport] = i;
+      }
+    }
+  }
+
+  void link(uint8_t i, uint8_t list)
+  {
+    entryList[i] = list;
+    following[i] = NoEntry;
+    previous[i] = listTail[list];
+    if (listTail[list] != NoEntry)
+      following[listTail[list]] = i;
+    else
+      listHead[list] = i;
+    listTail[list] = i;
+  }
+
+  void unlink(uint8_t i)
+  {
+    uint8_t list = entryList[i];
+    if (previous[i] != NoEntry)
+      following[previous[i]] = following[i];
+    else
+      listHead[list] = following[i];
+    if (following[i] != NoEntry)
+      previous[following[i]] = previous[i];
+    else
+      listTail[list] = previous[i];
+  }
+
+  Presence entries[PresenceCapacity];
+  uint8_t index[IndexSize];
+  uint8_t previous[PresenceCapacity];
+  uint8_t following[PresenceCapacity];
+  uint8_t entryList[PresenceCapacity];
+  uint8_t listHead[ListCount];
+  uint8_t listTail[ListCount];
+  uint8_t maxRssiEntry[2]; // per transport, LoRa then ESP-NOW
+  int maxRssi[2];
+  uint8_t count;
+  unsigned long timeoutMillis;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <esp_now.h>
+#include <M5_LoRa_E220_JP.h>
+
+#include "airtime.h"
+#include "transport.h"
+
+class LoRaTransport : public Transport
+{
+public:
+  LoRaTransport(LoRa_E220_JP &lora, LoRaConfigItem_t &config) : lora(lora), config(config) {}
+
+  int send(const uint8_t *frameData, size_t frameDataLength) override
+  {
+    return lora.SendFrame(config, (uint8_t *)frameData, frameDataLength);
+  }
+
+  bool isEspNow() const override { return false; }
+  const char *name() const override { return "LoRa"; }
+  size_t mtu() const override { return e220SubpacketLength(config.subpacket_size); }
+
+  // over the UART to the module, then on air
+  unsigned long frameMillis(size_t frameDataLength) const override
+  {
+    LoRaModulation modulation = loraModulationFromAirDataRate(config.air_data_rate);
+    return (e220UartMicros(frameDataLength) + loraAirtimeMicros(modulation, frameDataLength)) / 1000 + 1;
+  }
+
+  unsigned long airtimeMicros(size_t frameDataLength) const override
+  {
+    return loraAirtimeMicros(loraModulationFromAirDataRate(config.air_data_rate), frameDataLength);
+  }
+
+private:
+  LoRa_E220_JP &lora;
+  LoRaConfigItem_t &config;
+};
+
+class EspNowTransport : public Transport
+{
+public:
+  EspNowTransport(const uint8_t *peerAddress) : peerAddress(peerAddress) {}
+
+  int send(const uint8_t *frameData, size_t frameDataLength) override
+  {
+    return esp_now_send(peerAddress, frameData, frameDataLength);
+  }
+
+  bool isEspNow() const override { return true; }
+  const char *name() const override { return "ESP-NOW"; }
+  size_t mtu() const override { return ESP_NOW_MAX_DATA_LEN; }
+  unsigned long frameMillis(size_t) const override { return 2; } // ~1 Mbps, plus the send callback
+  unsigned long airtimeMicros(size_t frameDataLength) const override { return 8 * frameDataLength; }
+
+private:
+  const uint8_t *peerAddress;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+// relay (mesh) mode, frames from other users are sent on so they reach users out of range of the sender
+//
+// a relay waits before sending: the stronger it received the frame, the longer it waits, so relays far
+// from the sender (the ones that add the most range) tend to go first. Overhearing another copy of the
+// frame while waiting cancels the relay, a neighbour already covered it. Each relay takes one off the
+// frame's hops left (see relayFrame() in frame.h), and the duplicate filter stops frames going in circles.
+
+#include <Arduino.h>
+
+#include "frame.h"
+
+const uint8_t RelayQueueCapacity = 4;
+
+// rssi range the relay wait is spread over, edge of range to right next to the sender
+const int RelayWeakRssi = -120;
+const int RelayStrongRssi = -40;
+
+struct PendingRelay
+{
+  uint8_t data[MaxFrameLength];
+  uint8_t length;
+  uint16_t senderHash;
+  uint16_t sequence;
+  unsigned long dueMillis;
+  bool isPending;
+};
+
+// wait before relaying a frame received at rssi, up to windowMillis plus a quarter of it as jitter
+unsigned long relayDelayMillis(int rssi, unsigned long windowMillis)
+{
+  int strength = std::max(RelayWeakRssi, std::min(RelayStrongRssi, rssi)) - RelayWeakRssi;
+  return windowMillis * strength / (RelayStrongRssi - RelayWeakRssi) + random(0, windowMillis / 4 + 1);
+}
+
+class RelayQueue
+{
+public:
+  // queues the frame to be relayed at dueMillis, false if it can't be relayed or the queue is full
+  bool schedule(const uint8_t *frameData, size_t frameDataLength, uint16_t senderHash, uint16_t sequence, unsigned long dueMillis)
+  {
+    PendingRelay *relay = NULL;
+    for (uint8_t i = 0; i < RelayQueueCapacity && relay == NULL; i++)
+      if (!relays[i].isPending)
+        relay = &relays[i];
+
+    if (relay == NULL)
+    {
+      droppedCount++;
+      return false;
+    }
+
+    relay->length = relayFrame(frameData, frameDataLength, relay->data, sizeof(relay->data));
+    if (relay->length == 0)
+      return false;
+
+    relay->senderHash = senderHash;
+    relay->sequence = sequence;
+    relay->dueMillis = dueMillis;
+    relay->isPending = true;
+    return true;
+  }
+
+  // another copy of the frame was heard, returns true if a pending relay was cancelled
+  bool cancel(uint16_t senderHash, uint16_t sequence)
+  {
+    for (uint8_t i = 0; i < RelayQueueCapacity; i++)
+    {
+      PendingRelay &relay = relays[i];
+      if (relay.isPending && relay.senderHash == senderHash && relay.sequence == sequence)
+      {
+        relay.isPending = false;
+        cancelledCount++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // sends relays that are due, send(data, length) returns true on success, failed sends are dropped
+  template <typename F>
+  size_t poll(unsigned long now, F send)
+  {
+    size_t sent = 0;
+    for (uint8_t i = 0; i < RelayQueueCapacity; i++)
+    {
+      PendingRelay &relay = relays[i];
+      if (!relay.isPending || (long)(now - relay.dueMillis) < 0)
+        continue;
+
+      relay.isPending = false;
+      if (send(relay.data, relay.length))
+      {
+        relayedCount++;
+        sent++;
+      }
+    }
+    return sent;
+  }
+
+  void clear()
+  {
+    for (uint8_t i = 0; i < RelayQueueCapacity; i++)
+      relays[i].isPending = false;
+  }
+
+  // the earliest relay due, false if none is pending
+  bool nextDue(unsigned long &dueMillis) const
+  {
+    bool isPending = false;
+    for (uint8_t i = 0; i < RelayQueueCapacity; i++)
+    {
+      const PendingRelay &relay = relays[i];
+      if (relay.isPending && (!isPending || (long)(relay.dueMillis - dueMillis) < 0))
+      {
+        dueMillis = relay.dueMillis;
+        isPending = true;
+      }
+    }
+    return isPending;
+  }
+
+  uint32_t relayed() const { return relayedCount; }
+  uint32_t cancelled() const { return cancelledCount; }
+  uint32_t dropped() const { return droppedCount; }
+
+private:
+  PendingRelay relays[RelayQueueCapacity] = {};
+  uint32_t relayedCount = 0;
+  uint32_t cancelledCount = 0;
+  uint32_t droppedCount = 0;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+// screenshots streamed to the SD card a row at a time, as 16 bit BMPs
+//
+// the rows are read out of the canvas sprites by the UI task and queued for the storage task, so a
+// shot needs one row of memory instead of a frame, and no task waits on the card. BMP keeps the
+// sprites' RGB565 pixels as they are: a bitfields header and rows stored top down, no encoding.
+
+#include <Arduino.h>
+
+#include "storage.h"
+
+const size_t BmpHeaderLength = 14 + 40 + 12; // file header, info header, RGB565 masks
+const int MaxScreenshotWidth = 240;
+const size_t ScreenshotHeadroomBytes = StorageBufferBytes / 4; // left for chat log records
+
+inline void putLe16(uint8_t *p, uint16_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+inline void putLe32(uint8_t *p, uint32_t value)
+{
+  putLe16(p, value);
+  putLe16(p + 2, value >> 16);
+}
+
+// width must be even so rows need no padding to 4 bytes
+void writeBmpHeader(uint8_t *header, int width, int height)
+{
+  uint32_t imageBytes = width * height * 2;
+  memset(header, 0, BmpHeaderLength);
+
+  header[0] = 'B';
+  header[1] = 'M';
+  putLe32(header + 2, BmpHeaderLength + imageBytes);
+  putLe32(header + 10, BmpHeaderLength); // pixel data offset
+
+  putLe32(header + 14, 40);
+  putLe32(header + 18, width);
+  putLe32(header + 22, -height); // negative, rows are top down
+  putLe16(header + 26, 1);       // planes
+  putLe16(header + 28, 16);      // bits per pixel
+  putLe32(header + 30, 3);       // BI_BITFIELDS
+  putLe32(header + 34, imageBytes);
+
+  putLe32(header + 54, 0xF800); // red
+  putLe32(header + 58, 0x07E0); // green
+  putLe32(header + 62, 0x001F); // blue
+}
+
+class ScreenshotWriter
+{
+public:
+  void begin(int width, int height)
+  {
+    this->width = std::min(width, MaxScreenshotWidth);
+    this->height = height;
+    nextRow = -1; // the header first
+  }
+
+  bool isActive() const { return nextRow < height; }
+
+  // queues as many rows as fit, readRow(y, pixels) fills a row of RGB565 pixels
+  // returns true once the whole shot is queued
+  template <typename ReadRow>
+  bool poll(WriteBehindQueue &queue, unsigned long now, ReadRow readRow)
+  {
+    if (nextRow < 0)
+    {
+      uint8_t header[BmpHeaderLength];
+      writeBmpHeader(header, width, height);
+      if (!queue.write(StorageScreenshot, header, sizeof(header), true, now, ScreenshotHeadroomBytes))
+        return false;
+      nextRow = 0;
+    }
+
+    while (nextRow < height)
+    {
+      readRow(nextRow, row);
+      if (!queue.write(StorageScreenshot, row, width * 2, false, now, ScreenshotHeadroomBytes))
+        return false;
+      nextRow++;
+    }
+    return true;
+  }
+
+  size_t memoryBytes() const { return sizeof(*this); }
+
+private:
+  int width = 0;
+  int height = 0;
+  int nextRow = 0;
+  uint16_t row[MaxScreenshotWidth]; // little endian RGB565 on the device and the host
+};
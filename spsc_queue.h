@@ -0,0 +1,74 @@
+#pragma once
+
+// lock-free single producer, single consumer ring buffer
+// one task (or ISR/callback) may push and one other task may pop, with no locks or allocation
+
+#include <atomic>
+#include <stddef.h>
+
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // producer: returns a free slot to fill in place, or NULL if full, publish it with commitPush()
+  T *beginPush()
+  {
+    size_t currentTail = tail.load(std::memory_order_relaxed);
+    if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+    {
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+    return &slots[currentTail & (Capacity - 1)];
+  }
+
+  void commitPush()
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool push(const T &item)
+  {
+    T *slot = beginPush();
+    if (slot == NULL)
+      return false;
+    *slot = item;
+    commitPush();
+    return true;
+  }
+
+  // consumer: returns the oldest item to read in place, or NULL if empty, release it with commitPop()
+  T *front()
+  {
+    size_t currentHead = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == currentHead)
+      return NULL;
+    return &slots[currentHead & (Capacity - 1)];
+  }
+
+  void commitPop()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool pop(T &item)
+  {
+    T *slot = front();
+    if (slot == NULL)
+      return false;
+    item = std::move(*slot);
+    commitPop();
+    return true;
+  }
+
+  size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+  size_t dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+
+private:
+  T slots[Capacity];
+  std::atomic<size_t> head{0}; // written by consumer
+  std::atomic<size_t> tail{0}; // written by producer
+  std::atomic<size_t> droppedCount{0};
+};
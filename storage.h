@@ -0,0 +1,207 @@
+#pragma once
+
+// SD card writes handed to the storage task, so no other task waits on the card
+//
+// record: |file:8|length:16|data|, the file's high bit (StorageReplace) empties it before the data
+//
+// writers append records to one of two buffers while the storage task writes out the other. It swaps
+// them when the filling one passes the high-water mark or its oldest record has waited
+// StorageFlushMillis, then writes each file's bytes in sector-sized chunks, so a chat message and its
+// index entry cost a share of one card write instead of a write and flush each.
+
+#include <Arduino.h>
+#include <mutex>
+
+const size_t StorageBufferBytes = 4096;
+const size_t StorageHighWaterBytes = 2048;
+const size_t StorageSectorBytes = 512;
+const unsigned long StorageFlushMillis = 1000;
+const size_t StorageRecordHeaderLength = 3;
+const uint8_t StorageReplace = 0x80;
+
+// written in this order each flush, so a chat log record reaches the card before its index entry
+enum StorageFile : uint8_t
+{
+  StorageChatLog = 0,   // one per channel
+  StorageChatIndex = 3, // one per channel
+  StorageConfig = 6,
+  StorageScreenshot = 7,
+  StorageFileCount = 8
+};
+
+// the card, only used by the storage task, or at boot before it starts
+class StorageSink
+{
+public:
+  virtual ~StorageSink() {}
+  virtual bool replace(uint8_t file) = 0; // empties the file, screenshots start a new one instead
+  virtual bool append(uint8_t file, const uint8_t *data, size_t length) = 0;
+  virtual bool sync(uint8_t file) = 0; // after the last append of a flush
+  virtual bool read(uint8_t file, size_t offset, void *data, size_t length) = 0;
+  virtual size_t size(uint8_t file) = 0;
+};
+
+struct StorageStats
+{
+  uint32_t writes;
+  uint32_t dropped; // no room, the writer decides what to do
+  uint32_t flushes;
+  uint32_t cardWrites;
+  uint32_t cardErrors;
+  size_t bytes;
+  size_t maxPending;
+};
+
+class WriteBehindQueue
+{
+public:
+  // called when a write passes the high-water mark, to wake the storage task
+  void setWake(void (*wake)()) { this->wake = wake; }
+
+  // any task, never waits on the card. False if there is no room for the data plus headroom bytes,
+  // bulk writers leave headroom so they never crowd out chat log records
+  bool write(uint8_t file, const void *data, size_t length, bool isReplace, unsigned long now, size_t headroom = 0)
+  {
+    bool isHighWater;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t &bufferUsed = used[filling];
+      if (length > 0xFFFF || bufferUsed + StorageRecordHeaderLength + length + headroom > StorageBufferBytes)
+      {
+        stats.dropped++;
+        return false;
+      }
+
+      uint8_t *record = buffers[filling] + bufferUsed;
+      record[0] = file | (isReplace ? StorageReplace : 0);
+      record[1] = length & 0xFF;
+      record[2] = length >> 8;
+      memcpy(record + StorageRecordHeaderLength, data, length);
+      if (bufferUsed == 0)
+        oldestMillis = now;
+      bufferUsed += StorageRecordHeaderLength + length;
+
+      stats.writes++;
+      stats.bytes += length;
+      stats.maxPending = std::max(stats.maxPending, bufferUsed);
+      isHighWater = bufferUsed >= StorageHighWaterBytes;
+    }
+
+    if (isHighWater && wake != NULL)
+      wake();
+    return true;
+  }
+
+  // storage task: true if the filling buffer should be written out
+  bool isFlushDue(unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used[filling] >= StorageHighWaterBytes || (used[filling] > 0 && now - oldestMillis >= StorageFlushMillis);
+  }
+
+  size_t pending()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used[filling];
+  }
+
+  // storage task: swaps the buffers and writes out the one that was filling, returns the bytes written
+  size_t flush(StorageSink &sink)
+  {
+    uint8_t full;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      full = filling;
+      filling = 1 - filling;
+    }
+
+    const uint8_t *buffer = buffers[full];
+    size_t written = 0;
+    for (uint8_t file = 0; file < StorageFileCount; file++)
+    {
+      size_t chunkUsed = 0;
+      bool isWritten = false;
+      for (size_t offset = 0; offset < used[full];)
+      {
+        uint8_t recordFile = buffer[offset] & ~StorageReplace;
+        bool isReplace = buffer[offset] & StorageReplace;
+        size_t length = buffer[offset + 1] | buffer[offset + 2] << 8;
+        const uint8_t *data = buffer + offset + StorageRecordHeaderLength;
+        offset += StorageRecordHeaderLength + length;
+        if (recordFile != file)
+          continue;
+
+        if (isReplace)
+        {
+          writeChunk(sink, file, chunkUsed);
+          countCard(sink.replace(file));
+        }
+
+        // fill sectors, data that starts on a sector boundary goes straight from the buffer
+        while (length > 0)
+        {
+          if (chunkUsed == 0 && length >= StorageSectorBytes)
+          {
+            countCard(sink.append(file, data, StorageSectorBytes));
+            data += StorageSectorBytes;
+            length -= StorageSectorBytes;
+            written += StorageSectorBytes;
+            continue;
+          }
+
+          size_t copied = std::min(length, StorageSectorBytes - chunkUsed);
+          memcpy(chunk + chunkUsed, data, copied);
+          chunkUsed += copied;
+          data += copied;
+          length -= copied;
+          written += copied;
+          if (chunkUsed == StorageSectorBytes)
+            writeChunk(sink, file, chunkUsed);
+        }
+        isWritten = true;
+      }
+
+      writeChunk(sink, file, chunkUsed);
+      if (isWritten)
+        countCard(sink.sync(file));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      used[full] = 0;
+      stats.flushes++;
+    }
+    return written;
+  }
+
+  StorageStats getStats()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+private:
+  void writeChunk(StorageSink &sink, uint8_t file, size_t &chunkUsed)
+  {
+    if (chunkUsed == 0)
+      return;
+    countCard(sink.append(file, chunk, chunkUsed));
+    chunkUsed = 0;
+  }
+
+  void countCard(bool isOk)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.cardWrites++;
+    stats.cardErrors += !isOk;
+  }
+
+  std::mutex mutex;
+  uint8_t buffers[2][StorageBufferBytes];
+  size_t used[2] = {0, 0};
+  uint8_t filling = 0;
+  unsigned long oldestMillis = 0;
+  uint8_t chunk[StorageSectorBytes]; // storage task only
+  void (*wake)() = NULL;
+  StorageStats stats = {};
+};
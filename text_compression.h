@@ -0,0 +1,165 @@
+#pragma once
+
+// short text compression for chat lines, SMAZ style static codebook
+//
+// encoded bytes:
+//   0x20-0x7E literal printable ASCII
+//   0x80-0xFF codebook entry (byte - 0x80)
+//   0x01      escape, the next byte is a literal (control chars, DEL and non-ASCII)
+
+#include <Arduino.h>
+
+const uint8_t CompressionEscape = 0x01;
+const uint8_t CompressionCodeBase = 0x80;
+
+// tuned on short English chat lines, longest match wins so order doesn't matter
+const char *const CompressionCodebook[] = {
+    " the", " you", " to", " and", " is", " it", " in", " on", " at", " of", " for", " my", " me",
+    " we", " be", " are", " can", " that", " this", " what", " was", " have", " not", " with", " just",
+    " will", " get", " now", " here", " there", " see", " going", " know", " how", " your", " so", " do",
+    " up", " back", " again", " good", " got", " one", " when", " where", " about", " like", " try",
+    " send", " signal", " message", "I ", "ok", "hey", "hello", "yes", "yep", "no", "lol", "thanks",
+    "good", "see", "what", "where", "the", "can", "did", "let", "th", "he", "in", "er", "an", "re",
+    "on", "at", "en", "nd", "ti", "es", "or", "te", "of", "ed", "is", "it", "al", "ar", "st", "to",
+    "nt", "ng", "se", "ha", "as", "ou", "io", "le", "ve", "co", "me", "de", "hi", "ri", "ro", "ic",
+    "ne", "ea", "ra", "ce", "li", "ch", "ll", "be", "ing", "ion", "ent", "ght", "ere", "ould", "ain",
+    "e ", "s ", "t ", "d ", "y ", ", ", "? "};
+
+const uint8_t CompressionCodebookSize = sizeof(CompressionCodebook) / sizeof(CompressionCodebook[0]);
+static_assert(CompressionCodebookSize <= 0x80, "codebook codes must fit in 0x80-0xFF");
+
+// codebook entries grouped by first char, longest first within each group
+struct CompressionIndex
+{
+  uint8_t lengths[CompressionCodebookSize];
+  uint8_t order[CompressionCodebookSize];
+  uint8_t start[0x80 + 1]; // order[start[c]..start[c + 1]) begin with c
+
+  CompressionIndex()
+  {
+    uint8_t counts[0x80] = {0};
+    for (uint8_t i = 0; i < CompressionCodebookSize; i++)
+    {
+      lengths[i] = strlen(CompressionCodebook[i]);
+      counts[(uint8_t)CompressionCodebook[i][0]]++;
+    }
+
+    start[0] = 0;
+    for (int c = 0; c < 0x80; c++)
+      start[c + 1] = start[c] + counts[c];
+
+    uint8_t fill[0x80];
+    memcpy(fill, start, sizeof(fill));
+    for (uint8_t i = 0; i < CompressionCodebookSize; i++)
+    {
+      uint8_t c = CompressionCodebook[i][0];
+      uint8_t j = fill[c]++;
+
+      // insertion sort by length, descending
+      while (j > start[c] && lengths[order[j - 1]] < lengths[i])
+      {
+        order[j] = order[j - 1];
+        j--;
+      }
+      order[j] = i;
+    }
+  }
+};
+
+const CompressionIndex &compressionIndex()
+{
+  static CompressionIndex index;
+  return index;
+}
+
+// returns the compressed length, or 0 if the output doesn't fit in capacity
+size_t compressText(const char *text, size_t textLength, uint8_t *out, size_t capacity)
+{
+  const CompressionIndex &index = compressionIndex();
+  size_t outLength = 0;
+  size_t i = 0;
+
+  while (i < textLength)
+  {
+    uint8_t c = text[i];
+    int match = -1;
+
+    if (c < 0x80)
+    {
+      for (uint8_t k = index.start[c]; k < index.start[c + 1]; k++)
+      {
+        uint8_t code = index.order[k];
+        uint8_t length = index.lengths[code];
+        if (length <= textLength - i && memcmp(text + i, CompressionCodebook[code], length) == 0)
+        {
+          match = code;
+          break;
+        }
+      }
+    }
+
+    if (match >= 0)
+    {
+      if (outLength + 1 > capacity)
+        return 0;
+      out[outLength++] = CompressionCodeBase + match;
+      i += index.lengths[match];
+    }
+    else if (c >= 0x20 && c < 0x7F)
+    {
+      if (outLength + 1 > capacity)
+        return 0;
+      out[outLength++] = c;
+      i++;
+    }
+    else
+    {
+      if (outLength + 2 > capacity)
+        return 0;
+      out[outLength++] = CompressionEscape;
+      out[outLength++] = c;
+      i++;
+    }
+  }
+
+  return outLength;
+}
+
+// returns false on malformed input or if the output doesn't fit in capacity
+bool decompressText(const uint8_t *data, size_t dataLength, char *out, size_t capacity, size_t &outLength)
+{
+  outLength = 0;
+
+  for (size_t i = 0; i < dataLength; i++)
+  {
+    uint8_t b = data[i];
+
+    if (b >= CompressionCodeBase)
+    {
+      uint8_t code = b - CompressionCodeBase;
+      if (code >= CompressionCodebookSize)
+        return false;
+
+      size_t length = compressionIndex().lengths[code];
+      if (outLength + length > capacity)
+        return false;
+      memcpy(out + outLength, CompressionCodebook[code], length);
+      outLength += length;
+    }
+    else
+    {
+      if (b == CompressionEscape)
+      {
+        if (++i >= dataLength)
+          return false;
+        b = data[i];
+      }
+
+      if (outLength + 1 > capacity)
+        return false;
+      out[outLength++] = b;
+    }
+  }
+
+  return true;
+}
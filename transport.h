@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+
+// radio frames never exceed this, ESP-NOW max payload is 250 bytes and the E220 max subpacket is 200
+#define MAX_FRAME_LENGTH 250
+
+// abstraction over the radio, sendMessage() goes through the active transport
+class Transport
+{
+public:
+  virtual ~Transport() {}
+
+  // returns 0 on success, otherwise a transport specific error code
+  virtual int send(const uint8_t *frameData, size_t frameDataLength) = 0;
+  virtual bool isEspNow() const = 0;
+  virtual const char *name() const = 0;
+
+  // largest frame sent as one packet, longer text is split into fragments (see fragment.h)
+  virtual size_t mtu() const = 0;
+  // time the radio is busy with a frame, the gap to leave before sending the next one in a burst
+  virtual unsigned long frameMillis(size_t frameDataLength) const = 0;
+  // time on air of a frame, charged to the duty-cycle budget (see airtime_budget.h)
+  virtual unsigned long airtimeMicros(size_t frameDataLength) const = 0;
+};
+
+// raw frame as it came off the radio, queued for the UI task to parse
+struct ReceivedFrame
+{
+  uint8_t data[MAX_FRAME_LENGTH];
+  uint8_t length;
+  int16_t rssi;
+  bool isEspNow;
+};
+
+typedef void (*ReceiveCallback)(const uint8_t *frameData, size_t frameDataLength, int rssi, bool isEspNow);
+
+// in-process transport, sent frames are queued and handed back to a receive callback on poll()
+class LoopbackTransport : public Transport
+{
+public:
+  static const size_t Capacity = 16;
+
+  LoopbackTransport(bool isEspNow = false, int rssi = -60) : rssi(rssi), espNow(isEspNow) {}
+
+  int send(const uint8_t *frameData, size_t frameDataLength) override
+  {
+    if (frameDataLength > maxFrameLength)
+      return 1;
+    if (count == Capacity)
+      return 2;
+
+    Frame &frame = frames[(head + count) % Capacity];
+    memcpy(frame.data, frameData, frameDataLength);
+    frame.length = frameDataLength;
+    count++;
+    sentCount++;
+    return 0;
+  }
+
+  bool isEspNow() const override { return espNow; }
+  const char *name() const override { return "loopback"; }
+  size_t mtu() const override { return maxFrameLength; }
+  unsigned long frameMillis(size_t) const override { return frameTimeMillis; }
+  unsigned long airtimeMicros(size_t) const override { return frameTimeMillis * 1000; }
+
+  // deliver the frames queued so far, frames sent from the callback wait for the next poll
+  size_t poll(ReceiveCallback onReceive)
+  {
+    size_t delivered = 0;
+    size_t queued = count;
+    while (delivered < queued)
+    {
+      // copy out first so the callback can send (e.g. response pings) without clobbering the slot
+      Frame frame = frames[head];
+      head = (head + 1) % Capacity;
+      count--;
+
+      onReceive(frame.data, frame.length, rssi, espNow);
+      delivered++;
+    }
+    return delivered;
+  }
+
+  size_t pending() const { return count; }
+  void clear() { head = count = 0; }
+
+  unsigned long sentCount = 0;
+  int rssi;
+  size_t maxFrameLength = MAX_FRAME_LENGTH;
+  unsigned long frameTimeMillis = 0;
+
+private:
+  struct Frame
+  {
+    uint8_t data[MAX_FRAME_LENGTH];
+    size_t length;
+  };
+
+  Frame frames[Capacity];
+  size_t head = 0;
+  size_t count = 0;
+  bool espNow;
+};
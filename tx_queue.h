@@ -0,0 +1,165 @@
+#pragma once
+
+// bounded priority queue of frames to send, feeding the transmit task (see processTxQueue() in chat.h)
+//
+// one fixed ring per priority, pops take the oldest item of the highest priority with anything queued.
+// Pushing never blocks on the radio, only briefly on the queue lock, and fails when that priority's ring
+// is full. Depth and time in queue are kept per priority. Messages carry the username and settings they
+// were queued with, the UI task may change them while the transmit task encodes.
+
+#include <Arduino.h>
+
+#include <mutex>
+
+#include "frame.h"
+
+enum TxPriority : uint8_t
+{
+  TxChat = 0, // own messages, their retransmits and relays of other users' messages
+  TxAck = 1,  // pings sent only to carry acks
+  TxPing = 2, // presence pings
+  TxPriorityCount = 3
+};
+
+const char *const TxPriorityNames[TxPriorityCount] = {"chat", "ack", "ping"};
+
+const uint8_t TxQueueCapacity[TxPriorityCount] = {8, 2, 2};
+const uint8_t MaxTxQueueCapacity = 8;
+
+enum TxRequestKind : uint8_t
+{
+  TxMessage, // text encoded by the transmit task, empty for pings
+  TxFrame    // frame sent as is
+};
+
+// who a message is sent as
+struct TxSender
+{
+  char username[MaxUsernameLength + 1];
+  uint16_t hash;
+  uint8_t flags; // FrameFlags::Compressed and AckRequest, for messages with text
+};
+
+struct TxRequest
+{
+  TxRequestKind kind;
+  uint8_t channel;
+  uint8_t length;
+  uint8_t data[MaxMessageLength]; // text or frame
+  TxSender sender;                // TxMessage only
+  unsigned long queuedMillis;
+};
+
+struct TxQueueStats
+{
+  uint32_t queued;
+  uint32_t dropped; // ring full
+  uint8_t depth;
+  uint8_t maxDepth;
+  uint32_t totalQueueMillis;
+  uint32_t maxQueueMillis;
+};
+
+class TxQueue
+{
+public:
+  bool push(TxPriority priority, TxRequestKind kind, uint8_t channel, const void *data, size_t length, const TxSender &sender, unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Ring &ring = rings[priority];
+    TxQueueStats &stat = stats[priority];
+    if (ring.count == TxQueueCapacity[priority] || length > sizeof(ring.items[0].data))
+    {
+      stat.dropped++;
+      return false;
+    }
+
+    TxRequest &request = ring.items[(ring.head + ring.count) % TxQueueCapacity[priority]];
+    request.kind = kind;
+    request.channel = channel;
+    request.length = length;
+    memcpy(request.data, data, length);
+    request.sender = sender;
+    request.queuedMillis = now;
+    ring.count++;
+
+    stat.queued++;
+    stat.depth = ring.count;
+    stat.maxDepth = std::max(stat.maxDepth, ring.count);
+    return true;
+  }
+
+  // copies out the next request, false if nothing is queued
+  bool pop(TxRequest &request, TxPriority &priority, unsigned long now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint8_t p = 0; p < TxPriorityCount; p++)
+    {
+      Ring &ring = rings[p];
+      if (ring.count == 0)
+        continue;
+
+      request = ring.items[ring.head];
+      ring.head = (ring.head + 1) % TxQueueCapacity[p];
+      ring.count--;
+
+      TxQueueStats &stat = stats[p];
+      uint32_t queueMillis = now - request.queuedMillis;
+      stat.depth = ring.count;
+      stat.totalQueueMillis += queueMillis;
+      stat.maxQueueMillis = std::max(stat.maxQueueMillis, queueMillis);
+      priority = (TxPriority)p;
+      return true;
+    }
+    return false;
+  }
+
+  // copies out the request pop() would return without removing it
+  bool peek(TxRequest &request, TxPriority &priority)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint8_t p = 0; p < TxPriorityCount; p++)
+    {
+      if (rings[p].count == 0)
+        continue;
+      request = rings[p].items[rings[p].head];
+      priority = (TxPriority)p;
+      return true;
+    }
+    return false;
+  }
+
+  size_t size(TxPriority priority)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rings[priority].count;
+  }
+
+  TxQueueStats getStats(TxPriority priority)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats[priority];
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint8_t p = 0; p < TxPriorityCount; p++)
+    {
+      rings[p].head = rings[p].count = 0;
+      stats[p] = {};
+    }
+  }
+
+private:
+  struct Ring
+  {
+    TxRequest items[MaxTxQueueCapacity];
+    uint8_t head;
+    uint8_t count;
+  };
+
+  std::mutex mutex;
+  Ring rings[TxPriorityCount] = {};
+  TxQueueStats stats[TxPriorityCount] = {};
+};